@@ -96,6 +96,39 @@ public:
 	};
 };
 
+// statistics of the pixel values of an image (see ImageStatistics)
+struct ImageStats
+{
+	double mean = 0.0;
+	// standard deviation of the population
+	double sd = 0.0;
+	double median = 0.0;
+	// median absolute deviation from the median
+	double mad = 0.0;
+	// standard deviation estimated from the MAD (1.4826 * MAD), which is
+	// not skewed by the bright pixels of the emitters like sd
+	double noise = 0.0;
+};
+
+// statistics of the frame queue of the worker threads
+struct PipelineStats
+{
+	// frames accepted by the queue
+	uint64_t submitted = 0;
+	// frames rejected because the queue was full
+	uint64_t dropped = 0;
+	// frames fitted by the workers
+	uint64_t processed = 0;
+	// number of frame buffers of the queue
+	size_t capacity = 0;
+	// frames waiting, being fitted or with a result that is not polled yet
+	size_t occupancy = 0;
+	// maximum occupancy since the workers were started
+	size_t maxOccupancy = 0;
+	// total time the producers waited for a free frame buffer
+	double waitMS = 0.0;
+};
+
 // time
 using Microseconds = std::chrono::duration<double, std::micro>;
 using Milliseconds = std::chrono::duration<double, std::milli>;
@@ -32,9 +32,13 @@
  
 #include <atomic>
 #include <list>
+#include <vector>
 #include <functional>
+#include <memory>
+#include <string>
 #include "Fitter.h"
 #include "Renderer.h"
+#include "LocalizationStore.h"
 #include "Calibration.h"
 
 namespace LookUpSTORM
@@ -69,14 +73,44 @@ public:
 
 	// generate astigmatism LUT from calibration
 	// the callback function can be used to show the progress (current index, max index)
+	// a single precision LUT needs half of the memory, the symmetry compression
+	// about a quarter (only supported by calibrations without rotation)
 	bool generateFromCalibration(const Calibration& cali, size_t windowSize,
 		double dLat, double dAx, double rangeLat, double rangeAx,
-		std::function<void(size_t index, size_t max)> callback = [](size_t, size_t) {}
+		std::function<void(size_t index, size_t max)> callback = [](size_t, size_t) {},
+		Precision precision = Precision::Double, Layout layout = Layout::Interleaved,
+		Allocation allocation = Allocation::Default, Compression compression = Compression::None
+	);
+
+	// lazy LUT: the templates are drawn when the fitter accesses them for the first time
+	// and are kept in a cache of at most cacheBytes, so only the positions actually fitted 
+	// are generated. This allows finer steps than the memory of a precomputed LUT permits.
+	// The LUT has to implement LUT::templateImage and is kept by the controller.
+	bool setLazyLUT(std::shared_ptr<LUT> lut, size_t windowSize,
+		double dLat, double dAx, double rangeLat, double rangeAx, size_t cacheBytes
+	);
+
+	// lazy astigmatism LUT from calibration (see setLazyLUT), 
+	// the calibration has to be valid as long as the LUT is used
+	bool generateLazyFromCalibration(const Calibration& cali, size_t windowSize,
+		double dLat, double dAx, double rangeLat, double rangeAx, size_t cacheBytes
 	);
 
 	// set the internal lookup table from the generated table of the LUT class 
 	bool setLUT(const LUT& lut);
 
+	// maps a binary LUT file (see LUT::save) read-only without copying the templates,
+	// processes using the same file share the memory of the page cache. Only the header
+	// CRC of version 2 files is checked, the chunk CRCs are checked if verify is true,
+	// which reads the whole file before the first fit (see also verifyLUT).
+	bool loadLUT(const std::string& fileName, bool verify = false);
+
+	// checks the header and the chunk CRCs of a version 2 LUT file without loading it
+	bool verifyLUT(const std::string& fileName) const;
+
+	// releases the LUT of the fitter and closes a mapped LUT file
+	void releaseLUT();
+
 	// thread-safe
 	bool isSMLMImageReady() const;
 
@@ -85,6 +119,55 @@ public:
 	// fit the image provided
 	bool processImage(ImageU16 image, int frame);
 
+	// starts a pool of worker threads that detect and fit submitted images in parallel,
+	// each worker uses its own fitter workspace (0 uses all hardware threads)
+	// the images are queued in queueSize preallocated buffers (0 uses 4 per worker, at least 16),
+	// the results of fitted images count against queueSize until they are polled (see pollImage)
+	// the LUT has to be set before and is not allowed to change while the workers are running
+	bool startWorkers(size_t numWorkers = 0, size_t queueSize = 0);
+	// stops the worker threads, pending images and results are discarded
+	void stopWorkers();
+	// thread-safe
+	bool isWorkersRunning() const;
+
+	// thread-safe, copies the image and queues it for the worker threads,
+	// waits for a free buffer if the queue is full; the queue only gets free if the
+	// results are polled, so pollImage has to be called in between or by another thread
+	bool submitImage(ImageU16 image, int frame);
+
+	// thread-safe and lock-free, same as submitImage for live acquisition, but never waits:
+	// the image is dropped if the queue is full (see pipelineStats)
+	bool pushImage(ImageU16 image, int frame);
+	// same as pushImage, but fill writes the pixels (width * height) directly into the queued buffer
+	bool pushImage(int width, int height, int frame, const std::function<void(uint16_t* pixels)>& fill);
+
+	// thread-safe, back-pressure statistics of the queue since startWorkers
+	PipelineStats pipelineStats() const;
+
+	// retrieves the next fitted image in submission order and adds the localizations 
+	// to the detected and all molecules and the renderer (same as processImage)
+	// if wait is true the call blocks until the next submitted image is fitted
+	// returns false if no fitted image is available
+	bool pollImage(int& frame, bool wait = false);
+
+	// thread-safe, number of submitted images that are not polled yet
+	size_t pendingImages() const;
+
+	// thread-safe, number of threads that fit the canidates of a single image in parallel
+	// (default is 1, 0 uses all hardware threads), the order of the results does not change.
+	// The helper threads are kept in a pool shared by processImage and the worker threads,
+	// together with the workers they never exceed the number of hardware threads.
+	void setFittingThreads(size_t numThreads);
+	// thread-safe
+	size_t fittingThreads() const;
+
+	// thread-safe, number of threads that filter and search horizontal bands of a single image
+	// for canidates in parallel (default is 1, 0 uses all hardware threads), the found canidates
+	// do not depend on the number of threads
+	void setDetectionThreads(size_t numThreads);
+	// thread-safe
+	size_t detectionThreads() const;
+
 	void setImageSize(int width, int height);
 	int imageWidth() const;
 	int imageHeight() const;
@@ -122,7 +205,17 @@ public:
 	// thread-safe
 	bool isWaveletFilterEnabled() const;
 
-	// wavelet threshold factor (typical values 0-2, default is 1.25) for standard derivation of input image
+	// calculates the statistics of the frames without wavelet filter (default is false),
+	// which needs an extra pass over the pixels of each frame
+	// thread-safe
+	void setImageStatisticsEnabled(bool enabled);
+	// thread-safe
+	bool isImageStatisticsEnabled() const;
+
+	// wavelet threshold factor (typical values 1-2, default is 1.25) for the robust noise estimate
+	// of the input image (1.4826 * MAD, see ImageStats::noise). Before, the factor scaled the standard
+	// deviation, which the emitters of dense frames raise well above the noise; a factor raised to
+	// compensate this should be set back to 1-2, on sparse frames both estimates are about the same
 	void setWaveletFactor(float factor);
 	float waveletFactor() const;
 
@@ -144,8 +237,28 @@ public:
 	Fitter& fitter();
 	const Fitter& fitter() const;
 	// get detected localization from the last processImage call
-	std::list<Molecule>& detectedMolecues();
-	std::list<Molecule>& allMolecues();
+	LocalizationStore& detectedMolecues();
+	// all localizations since the last reset in the order of the frames,
+	// not thread-safe while frames are committed (see moleculesSince)
+	LocalizationStore& allMolecues();
+	// number of localizations since the last reset
+	// thread-safe
+	size_t numberOfMolecules() const;
+	// flat export of up to maxCount localizations since the last reset starting at
+	// index first (see LocalizationStore::exportValues); thread-safe
+	size_t exportMolecules(size_t first, double* dst, size_t maxCount, bool columnMajor) const;
+
+	// each localization gets a sequence number in the order they are added, which is 
+	// not reset by reset(); the cursor is the sequence number of the next localization
+	// thread-safe
+	uint64_t moleculeCursor() const;
+	// appends up to maxCount localizations added since the cursor and advances the 
+	// cursor, localizations removed by reset() are skipped, returns the number of
+	// localizations; thread-safe
+	size_t moleculesSince(uint64_t& cursor, std::vector<Molecule>& mols, size_t maxCount = SIZE_MAX) const;
+	// same as moleculesSince with the flat export of LocalizationStore::exportValues
+	// thread-safe
+	size_t moleculesSince(uint64_t& cursor, double* dst, size_t maxCount, bool columnMajor) const;
 
 	// get number of detected localization from the last processImage call
 	// thread-safe
@@ -159,6 +272,12 @@ public:
 	// thread-safe
 	Milliseconds frameFittingTime() const;
 
+	// get the statistics of the pixel values of the last image provided by processImage or
+	// pollImage, calculated in the same pass as the wavelet filter if it is enabled. Without
+	// wavelet filter the statistics are empty unless setImageStatisticsEnabled is set
+	// thread-safe
+	ImageStats imageStatistics() const;
+
 	// get the time needed to render a SMLM image provieded by processImage in ms
 	// thread-safe
 	double renderTimeMS() const;
@@ -183,6 +302,31 @@ public:
 	bool calculateCRLB(const Molecule &mol, double *crlb, const double adu, 
 		const double gain, const double offset, const double pixelSize) const;
 
+	// photons and CRLB of count molecules distributed over the fitting threads, crlb receives
+	// 5 values per molecule (NaN if not available), photons or crlb can be nullptr
+	void calculatePhotonsCRLB(const Molecule* mols, size_t count, double* photons, double* crlb, 
+		const double adu, const double gain, const double offset, const double pixelSize) const;
+
+	// writes all localizations since the last reset with the position and CRLB in nm and
+	// the intensity and background in photons (see calculatePhotons and calculateCRLB),
+	// the conversion is distributed over the fitting threads
+	bool saveMolecules(const std::string& fileName, LocalizationFormat format, 
+		double pixelSize, double adu, double gain, double baseline) const;
+
+	// reads a binary localization file of saveMolecules or startRecording back and checks
+	// the CRC of each column, returns false if the file is corrupt or incomplete
+	bool verifyMolecules(const std::string& fileName) const;
+
+	// streams the localizations of the following frames into a file as they are committed
+	// by processImage or pollImage, same units as saveMolecules; thread-safe
+	bool startRecording(const std::string& fileName, LocalizationFormat format,
+		double pixelSize, double adu, double gain, double baseline);
+	// closes the recorded file, returns false if it could not be written completely
+	// thread-safe
+	bool stopRecording();
+	// thread-safe
+	bool isRecording() const;
+
 	// restore intial conditions to fit a new image
 	void reset();
 
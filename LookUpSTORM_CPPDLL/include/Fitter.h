@@ -37,6 +37,26 @@ namespace LookUpSTORM
 {
 
 class FitterPrivate;
+class FitterWorkspacePrivate;
+
+/*
+ * class FitterWorkspace
+ * Scratch memory of the Gauss-Newton algorithm. A fitter can be used by
+ * multiple threads at the same time if each thread uses its own workspace.
+ */
+class DLL_DEF_LUT FitterWorkspace final
+{
+public:
+	FitterWorkspace();
+	~FitterWorkspace();
+
+	FitterWorkspace(const FitterWorkspace&) = delete;
+	FitterWorkspace& operator=(const FitterWorkspace&) = delete;
+
+private:
+	friend class Fitter;
+	FitterWorkspacePrivate* const d;
+};
 
 class DLL_DEF_LUT Fitter final
 {
@@ -49,21 +69,74 @@ public:
 	// returns true if the LUT is successfully set and there are more than one templates
 	bool isReady() const;
 
+	// uses the internal workspace of the fitter
 	bool fitSingle(const ImageU16& roi, Molecule& mol);
 
-	bool setLookUpTable(const double* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx);
+	// thread-safe if each thread uses its own workspace and the LUT is not changed
+	bool fitSingle(const ImageU16& roi, Molecule& mol, FitterWorkspace& workspace) const;
+
+	// fits n molecules in groups of batchLanes() with SIMD, the molecules contain the start 
+	// values (background, peak) and success receives the result of each fit (can be nullptr),
+	// returns the number of successful fits
+	size_t fitBatch(const ImageU16* rois, Molecule* mols, size_t n, bool* success = nullptr);
+	size_t fitBatch(const ImageU16* rois, Molecule* mols, size_t n, bool* success, FitterWorkspace& workspace) const;
+
+	// number of molecules fitted in lockstep by fitBatch
+	static size_t batchLanes();
+
+	// the layout describes the order of the values within the templates of the array and
+	// the compression which templates are stored (see LUT::setCompression),
+	// if allocated is true the fitter takes the ownership of the array (allocated by new[] or a LUT)
+	bool setLookUpTable(const double* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+		Layout layout = Layout::Interleaved, Compression compression = Compression::None);
+	// single precision LUT, the fit itself is still accumulated in double precision
+	bool setLookUpTable(const float* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+		Layout layout = Layout::Interleaved, Compression compression = Compression::None);
 	bool setLookUpTable(const LUT& lut);
 
+	// lazy LUT: the templates are drawn on their first access with LUT::drawTemplate and kept
+	// in a cache of at most cacheBytes, the least recently used templates are replaced.
+	// The LUT has to be set up (see LUT::setup) and has to outlive the fitter or the LUT
+	// of the fitter has to be released first.
+	bool setLazyLookUpTable(const LUT& lut, size_t cacheBytes);
+
+	// returns true if the templates are drawn on demand (see setLazyLookUpTable)
+	bool isLazy() const;
+
+	// returns the precision of the current LUT
+	Precision precision() const;
+
+	// returns the template layout of the current LUT
+	Layout layout() const;
+
+	// returns the compression of the current LUT
+	Compression compression() const;
+
 	// returns a pointer to the start of the LUT array
+	// or nullptr if the LUT has not the matching precision
 	const double* lookUpTablePtr() const;
+	const float* lookUpTablePtrF32() const;
 
 	// returns a pointer to the start of a template image at x,y,z
-	// the pointer is 4 * windowSize * windowSize long and 
-	// contains the derivatives:
+	// the pointer is 4 * windowSize * windowSize long and contains the
+	// values (e, dx, dy, dz) of each pixel (Layout::Interleaved) or
+	// the planes (Layout::Planar) with the derivatives:
 	//   - dx at the offset (1 * windowSize * windowSize)
 	//   - dy at the offset (2 * windowSize * windowSize)
 	//   - dz at the offset (3 * windowSize * windowSize)
+	// (nullptr for a lazy LUT and for the mirrored templates of a compressed LUT, see copyTemplate)
 	const double* templatePtr(double x, double y, double z) const;
+	const float* templatePtrF32(double x, double y, double z) const;
+
+	// thread-safe, copies the template image at x,y,z into pixels (4 * windowSize * windowSize),
+	// works for all kinds of LUTs and returns false if the position is not valid
+	// (the template is interpolated if the interpolation is enabled)
+	bool copyTemplate(double x, double y, double z, double* pixels) const;
+
+	// thread-safe, sum of the PSF values (e) of the template at x,y,z (interpolated if the
+	// interpolation is enabled) from a table built when the LUT is set, returns false if
+	// the position is not valid or the LUT is lazy (no table)
+	bool templateSum(double x, double y, double z, double& sum) const;
 
 	// returns true if the template at the position x,y,z is valid
 	constexpr bool isValid(double x, double y, double z) const;
@@ -90,6 +163,13 @@ public:
 	// thread-safe
 	size_t maxIter() const;
 
+	// thread-safe, the templates are interpolated trilinearly between the 8 neighbouring
+	// templates during the fit (default is false), the fitted positions are not limited to
+	// the grid of the LUT anymore, which allows coarser steps at the same precision
+	void setInterpolation(bool enabled);
+	// thread-safe
+	bool interpolation() const;
+
 private:
 	FitterPrivate * const d;
 };
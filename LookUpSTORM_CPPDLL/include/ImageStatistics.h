@@ -0,0 +1,98 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef IMAGESTATISTICS_H
+#define IMAGESTATISTICS_H
+
+#include "Common.h"
+#include "Image.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace LookUpSTORM
+{
+
+/*
+ * class ImageStatistics
+ * Statistics of 16 bit images from a histogram of the pixel values. The histogram is
+ * filled in a single pass, row by row while the image is read anyway (e.g. by the wavelet
+ * filter), and the histograms of parts of an image can be merged. Besides the exact mean
+ * and standard deviation it provides the median and the median absolute deviation, which
+ * are not skewed by the bright pixels of the emitters.
+ */
+class DLL_DEF_LUT ImageStatistics
+{
+public:
+	ImageStatistics();
+
+	// removes all pixels
+	void reset();
+
+	// adds count pixel values
+	inline void add(const uint16_t* pixels, size_t count);
+	void add(const ImageU16& image);
+
+	// adds the pixels of other statistics
+	void merge(const ImageStatistics& other);
+
+	// number of added pixels
+	inline uint64_t count() const;
+
+	// calculates the statistics of the added pixels, the median and MAD are interpolated
+	// within the histogram bins (each integer value is spread uniformly over [v - 0.5, v + 0.5))
+	ImageStats stats() const;
+
+	// statistics of the whole image
+	static ImageStats compute(const ImageU16& image);
+
+private:
+	std::vector<uint32_t> m_histogram;
+	uint64_t m_count;
+
+};
+
+inline
+void ImageStatistics::add(const uint16_t* pixels, size_t count)
+{
+	uint32_t* histogram = m_histogram.data();
+	for (size_t i = 0; i < count; ++i)
+		++histogram[pixels[i]];
+	m_count += count;
+}
+
+inline
+uint64_t ImageStatistics::count() const
+{
+	return m_count;
+}
+
+} // namespace LookUpSTORM
+
+#endif // !IMAGESTATISTICS_H
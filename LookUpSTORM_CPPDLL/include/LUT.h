@@ -31,17 +31,83 @@
 #define LUT_H
 
 #include <functional>
+#include <memory>
+#include <vector>
 #include "Common.h"
 
 namespace LookUpSTORM
 {
 
+class LUTWriter;
+class ThreadPool;
+
+// floating point format of the template images in the LUT
+enum class Precision {
+	Double,
+	// halves the memory and bandwidth, the fitter still accumulates in double
+	Float
+};
+
+// memory layout of the template images in the LUT
+enum class Layout {
+	// (e, dx, dy, dz) of each pixel next to each other
+	Interleaved,
+	// planes of e, dx, dy and dz with windowSize * windowSize pixels each,
+	// the fitter reads them with SIMD over the pixels and the residual only needs the e plane
+	Planar
+};
+
+// compression of the LUT
+enum class Compression {
+	None,
+	// the templates mirrored at the window center in x and/or y are not stored (up to 4x smaller),
+	// requires a PSF that is symmetric in x and y (e.g. astigmatism without rotation)
+	// and a grid that contains the mirrored positions
+	Symmetry
+};
+
+// allocation of the LUT memory
+enum class Allocation {
+	// heap memory
+	Default,
+	// huge pages (explicit if reserved, otherwise transparent) reduce the TLB misses
+	// of the random template access with tables of several GB
+	HugePages,
+	// huge pages interleaved over all NUMA nodes, so the workers on each socket
+	// see the same latency instead of accessing a single remote node
+	HugePagesInterleaved
+};
+
 class DLL_DEF_LUT LUT
 {
 public:
 	LUT();
 
-	// generate a LUT table
+	// sets the format of the next generated LUT (default is double)
+	void setPrecision(Precision precision);
+	inline constexpr Precision precision() const;
+
+	// sets the template layout of the next generated LUT (default is interleaved)
+	void setLayout(Layout layout);
+	inline constexpr Layout layout() const;
+
+	// sets the compression of the next generated LUT (default is none)
+	void setCompression(Compression compression);
+	inline constexpr Compression compression() const;
+
+	// sets the memory allocation of the next generated LUT (default is heap memory),
+	// falls back to the next simpler allocation if the system does not support it
+	void setAllocation(Allocation allocation);
+	inline constexpr Allocation allocation() const;
+	// allocation of the generated LUT after the fallbacks (see setAllocation)
+	inline constexpr Allocation usedAllocation() const;
+
+	// sets the number of threads used by generate (0 uses all hardware threads, default),
+	// multiple threads are only used if the subclass implements templateImage
+	void setThreads(size_t threads);
+	inline constexpr size_t threads() const;
+
+	// generate a LUT table, the callback is always called from the calling thread
 	// parameters:
 	// * windowSize: size of the template image in pixels
 	// * dLat: lateral step in pixel
@@ -52,11 +118,27 @@ public:
 		std::function<void(size_t index, size_t max)> callback = [](size_t, size_t) {}
 	);
 
+	// sets the geometry of the LUT like generate without drawing the templates, they can
+	// be drawn on demand with drawTemplate (see Fitter::setLazyLookUpTable)
+	bool setup(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx);
+
+	// thread-safe, draws the template with the index into pixels in the layout of the LUT
+	// (4 * windowSize * windowSize values), returns false if the subclass does 
+	// not implement templateImage
+	bool drawTemplate(size_t index, double* pixels) const;
+
 	// releases the memory allocated for the LUT
 	void release();
 
-	// saves the generated LUT as binary
-	bool save(const std::string& fileName);
+	// saves the generated LUT as binary file, version 2 keeps the precision, layout and
+	// compression of the LUT, version 1 stores uncompressed interleaved doubles
+	bool save(const std::string& fileName, int version = 2);
+
+	// same as generate, but the templates are written block by block into a binary
+	// file (version 2) instead of keeping the whole LUT in memory
+	bool generateFile(const std::string& fileName, size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+		std::function<void(size_t index, size_t max)> callback = [](size_t, size_t) {}
+	);
 
 	// checks if a LUT was generated by calling the method 'generate'
 	inline constexpr bool isValid() const;
@@ -95,19 +177,32 @@ public:
 	inline constexpr double maxAx() const;
 
 	// returns the pointer to the generated lookup table array 
+	// (nullptr if the precision is not double)
 	inline constexpr const double* ptr() const;
 
-	// returns the array size for the generated LUT
+	// returns the pointer to the generated lookup table array 
+	// (nullptr if the precision is not float)
+	inline constexpr const float* ptrF32() const;
+
+	// returns the array size (number of elements) for the generated LUT
+	// (also set by setup, although no array is allocated)
+	// a compressed LUT contains fewer templates than countLat * countLat * countAx
 	inline constexpr const size_t dataSize() const;
 
+	// returns the sum of the PSF values (e) of each stored template, built by generate
+	// (empty otherwise), the photons of a molecule are its peak times this sum
+	inline const std::vector<double>& templateSums() const;
+
 	// calculate the index of a generated LUT by the given xyz-position (xy in pixels, z in nm)
+	// (the index on the uncompressed grid)
 	size_t lookupIndex(double x, double y, double z) const;
 
 	// calculate the xyz-position as tuple (xy in pixels, z in nm) by the given index
 	std::tuple<double, double, double> lookupPosition(size_t index) const;
 
 	// calculates the bytes needed to generate a LUT with the parameters given
-	static size_t calculateUsageBytes(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx);
+	static size_t calculateUsageBytes(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx, 
+		Precision precision = Precision::Double, Compression compression = Compression::None);
 
 protected:
 	// called before the template loop starts
@@ -120,8 +215,49 @@ protected:
 	// called after all pixel of the current template image are finshed
 	virtual void endTemplate(size_t index, double x, double y, double z) = 0;
 
+	// batched alternative to the per pixel methods above: computes the whole template image at x,y,z
+	// into the arrays psf, dx, dy and dz with windowSize * windowSize pixels each (row-major).
+	// Has to be thread-safe, since the templates are generated in parallel, and returns false 
+	// if it is not implemented (default), then start/endTemplate and templateAtPixel are used.
+	virtual bool templateImage(size_t index, double x, double y, double z, double* psf, double* dx, double* dy, double* dz) const;
+
 private:
+	// returns the grid index of each stored template
+	std::vector<size_t> storedIndices() const;
+
+	// draws the templates with the grid indices into data, returns false if a template could not be drawn
+	template<class T>
+	bool fillTemplates(T* data, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback);
+
+	// draws the templates with templateImage on the pool, returns false if the subclass does not
+	// implement it and sets failed if a later template could not be drawn
+	template<class T>
+	bool fillTemplateImages(T* data, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback, bool& failed);
+
+	// draws the templates block by block and appends them to the writer
+	template<class T>
+	bool writeTemplates(LUTWriter& writer, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback);
+
+	bool saveV1(const std::string& fileName);
+
+	// draws the template with the index into the planes (psf, dx, dy, dz) and copies them into pixels
+	template<class T>
+	bool drawTemplate(size_t index, double* planes, T* pixels) const;
+
+	// sums the PSF values of each stored template into m_sums
+	template<class T>
+	void sumTemplates(const T* data);
+
 	double* m_data;
+	float* m_dataF32;
+	Precision m_precision;
+	Layout m_layout;
+	Allocation m_allocation;
+	Allocation m_usedAllocation;
+	Compression m_compression;
+	size_t m_threads;
+	// created by the first multithreaded generate
+	std::shared_ptr<ThreadPool> m_pool;
 	size_t m_dataSize;
 	size_t m_windowSize;
 	size_t m_countLat;
@@ -134,13 +270,50 @@ private:
 	double m_maxLat;
 	double m_minAx;
 	double m_maxAx;
+	std::vector<double> m_sums;
 
 };
 
+inline
+constexpr Precision LUT::precision() const
+{
+	return m_precision;
+}
+
+inline
+constexpr Layout LUT::layout() const
+{
+	return m_layout;
+}
+
+inline
+constexpr Compression LUT::compression() const
+{
+	return m_compression;
+}
+
+inline
+constexpr Allocation LUT::allocation() const
+{
+	return m_allocation;
+}
+
+inline
+constexpr Allocation LUT::usedAllocation() const
+{
+	return m_usedAllocation;
+}
+
+inline
+constexpr size_t LUT::threads() const
+{
+	return m_threads;
+}
+
 inline
 constexpr bool LUT::isValid() const
 {
-	return (m_data != nullptr) && (m_dataSize > 0) && (m_windowSize > 0);
+	return ((m_data != nullptr) || (m_dataF32 != nullptr)) && (m_dataSize > 0) && (m_windowSize > 0);
 }
 
 inline
@@ -215,6 +388,18 @@ constexpr const double* LUT::ptr() const
 	return m_data;
 }
 
+inline
+constexpr const float* LUT::ptrF32() const
+{
+	return m_dataF32;
+}
+
+inline
+const std::vector<double>& LUT::templateSums() const
+{
+	return m_sums;
+}
+
 inline
 constexpr const size_t LUT::dataSize() const
 {
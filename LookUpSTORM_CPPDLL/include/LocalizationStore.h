@@ -0,0 +1,203 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef LOCALIZATIONSTORE_H
+#define LOCALIZATIONSTORE_H
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Common.h"
+
+namespace LookUpSTORM
+{
+
+// file formats of the localizations (see Controller::saveMolecules)
+enum class LocalizationFormat {
+	// columnar blocks of 32 bit values
+	Binary,
+	// columnar blocks with run-length encoded byte planes
+	BinaryCompressed,
+	// text file with the header of the Java plugin
+	CSV
+};
+
+// read-only view of the columns of a block of the LocalizationStore,
+// the values of localization i are at column[i] for i < count
+struct LocalizationBlock
+{
+	// index of the first localization within the store
+	size_t first = 0;
+	size_t count = 0;
+	const float* background = nullptr;
+	const float* peak = nullptr;
+	const double* x = nullptr;
+	const double* y = nullptr;
+	const float* z = nullptr;
+	const int32_t* frame = nullptr;
+	const float* xfit = nullptr;
+	const float* yfit = nullptr;
+	const float* time_us = nullptr;
+
+	Molecule molecule(size_t i) const;
+};
+
+/*
+ * class LocalizationStore
+ * Append-only columnar storage of the localizations. The values are stored as
+ * structure of arrays in blocks of BlockSize localizations, each block is a 
+ * single allocation. An index stays valid until the store is cleared. The image 
+ * position is kept in double precision, the other values in single precision, 
+ * so a localization needs BytesPerLocalization bytes instead of a list node of 
+ * a Molecule (~96 bytes).
+ */
+class DLL_DEF_LUT LocalizationStore final
+{
+public:
+	static constexpr size_t BlockSize = 4096;
+	static constexpr size_t BytesPerLocalization = 2 * sizeof(double) + 6 * sizeof(float) + sizeof(int32_t);
+	// values per localization of exportValues
+	static constexpr size_t Values = 9;
+
+	// same order as Molecule::data
+	enum class Column {
+		Background,
+		Peak,
+		X,
+		Y,
+		Z,
+		Frame,
+		XFit,
+		YFit,
+		TimeUS
+	};
+
+	// iterates the localizations as Molecule values
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Molecule;
+		using difference_type = std::ptrdiff_t;
+		using reference = Molecule;
+		using pointer = const Molecule*;
+
+		struct Proxy {
+			Molecule mol;
+			const Molecule* operator->() const { return &mol; }
+		};
+
+		const_iterator(const LocalizationStore* store, size_t index) : m_store(store), m_index(index) {}
+
+		Molecule operator*() const { return (*m_store)[m_index]; }
+		Proxy operator->() const { return { (*m_store)[m_index] }; }
+		const_iterator& operator++() { ++m_index; return *this; }
+		const_iterator operator++(int) { const_iterator it = *this; ++m_index; return it; }
+		bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+		bool operator!=(const const_iterator& other) const { return m_index != other.m_index; }
+
+		size_t index() const { return m_index; }
+
+	private:
+		const LocalizationStore* m_store;
+		size_t m_index;
+	};
+
+	LocalizationStore();
+	LocalizationStore(const LocalizationStore& other);
+	LocalizationStore(LocalizationStore&& other) noexcept;
+	~LocalizationStore();
+
+	LocalizationStore& operator=(const LocalizationStore& other);
+	LocalizationStore& operator=(LocalizationStore&& other) noexcept;
+
+	// O(1), the frames should be appended in increasing order for a fast frameRange
+	void append(const Molecule& mol);
+	void append(const LocalizationStore& other);
+	template<class It>
+	void append(It first, It last) {
+		for (; first != last; ++first)
+			append(*first);
+	}
+
+	// removes all localizations, the first block is kept for reuse
+	void clear();
+	// removes all localizations and releases the memory
+	void release();
+	void swap(LocalizationStore& other) noexcept;
+
+	size_t size() const;
+	bool empty() const;
+	// allocated bytes of the blocks and the frame index
+	size_t memoryUsage() const;
+
+	Molecule operator[](size_t index) const;
+	Molecule at(size_t index) const;
+
+	const_iterator begin() const;
+	const_iterator end() const;
+
+	// contiguous column access per block
+	size_t blocks() const;
+	LocalizationBlock block(size_t index) const;
+
+	// index range [first, last) of the localizations of a frame, empty if the frame has
+	// no localizations; if a frame was appended more than once the last run is returned
+	std::pair<size_t, size_t> frameRange(int frame) const;
+	// number of frames with localizations
+	size_t frames() const;
+
+	// contiguous export of count localizations starting at first,
+	// return the number of copied localizations
+	size_t copy(size_t first, size_t count, Molecule* dst) const;
+	size_t copyColumn(Column column, size_t first, size_t count, double* dst) const;
+	// flat export of the Values of each localization in the order of Column,
+	// row major: dst[i * Values + column], column major: dst[column * count + i]
+	// with count the returned number of localizations
+	size_t exportValues(size_t first, size_t count, double* dst, bool columnMajor) const;
+
+private:
+	struct Block;
+
+	Block& writeBlock();
+
+	std::vector<std::unique_ptr<Block>> m_blocks;
+	size_t m_size;
+	// first index of each run of localizations of the same frame
+	std::vector<std::pair<int32_t, size_t>> m_frames;
+	bool m_framesSorted;
+
+};
+
+}
+
+#endif // !LOCALIZATIONSTORE_H
@@ -35,6 +35,8 @@
 #include "Fitter.h"
 #include "Renderer.h"
 #include "Image.h"
+#include "ImageStatistics.h"
+#include "LocalizationStore.h"
 #include "Calibration.h"
 
 #endif // LOOKUPSTORM_H
\ No newline at end of file
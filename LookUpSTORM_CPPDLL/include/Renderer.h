@@ -31,8 +31,8 @@
 #define RENDERER_H
 
 #include "Image.h"
+#include "LocalizationStore.h"
 #include <mutex>
-#include <list>
 
 namespace LookUpSTORM
 {
@@ -74,7 +74,7 @@ public:
 	const ImageU32 rawImageHistogram() const;
 
 	// render a molecule list with the possiblity of different projections
-	static ImageU32 render(const std::list<Molecule>& mols, int width, int height,
+	static ImageU32 render(const LocalizationStore& mols, int width, int height,
 		double scaleX, double scaleY, double minZ, double maxZ, double dZ, 
 		double sigma = 1.0, Projection projection = Projection::TopDown);
 
@@ -2,12 +2,17 @@
 #define WAVELET_H
 
 #include "Image.h"
+#include "ImageStatistics.h"
 
 #include <cmath>
+#include <memory>
+#include <vector>
 
 namespace LookUpSTORM
 {
 
+class ThreadPool;
+
 // this class is not thread safe!
 class DLL_DEF_LUT Wavelet
 {
@@ -19,15 +24,32 @@ public:
 
 	const ImageF32 &filter(const ImageU16& input);
 
+	// number of threads filtering horizontal bands of the image (default is 1)
+	void setThreads(int threads);
+	int threads() const;
+
+	// pool whose helper threads filter the bands, without a pool the wavelet
+	// starts its own threads - 1 helper threads on the first filter call
+	void setThreadPool(std::shared_ptr<ThreadPool> pool);
+
+	// statistics of the last filtered image, inputSD is the variance
 	const float inputMean() const;
 	const float inputSD() const;
 	const float inputSTD() const;
+	// robust standard deviation of the last filtered image (see ImageStats::noise)
+	const float inputNoise() const;
+	const ImageStats& inputStats() const;
 
 private:
-	ImageF32 m_padded;
 	ImageF32 m_result;
-	float m_mean;
-	float m_sd;
+	// rolling buffer of the level 1 rows and the column pass line of each band
+	std::vector<float> m_buffers;
+	// histogram of each band
+	std::vector<ImageStatistics> m_statistics;
+	int m_threads;
+	std::shared_ptr<ThreadPool> m_pool;
+	bool m_ownPool;
+	ImageStats m_stats;
 
 };
 
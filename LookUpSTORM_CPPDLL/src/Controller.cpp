@@ -33,12 +33,21 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "LocalMaximumSearch.h"
-#include "LinearMath.h"
 #include "LUT.h"
 #include "AutoThreshold.h"
 #include "Wavelet.h"
+#include "ImageStatistics.h"
+#include "FramePipeline.h"
+#include "ThreadPool.h"
+#include "LUTFile.h"
+#include "LocalizationFile.h"
+#include "Simd.h"
 
 #undef min
 #undef max
@@ -46,50 +55,157 @@
 namespace LookUpSTORM
 {
 
+// number of canidates a fitting thread takes at once from the canidate list
+static constexpr size_t FIT_CHUNK_SIZE = 8;
+// smallest share of a thread of the batch photon and CRLB calculation
+static constexpr size_t MIN_MOLECULES_PER_THREAD = 1024;
+
+// detection and fitting state of a single worker thread
+struct FrameWorker
+{
+    // the bands of the detection run on the helper threads of pool
+    inline explicit FrameWorker(const std::shared_ptr<ThreadPool>& pool)
+        : nms(1, 6)
+    {
+        nms.setThreadPool(pool);
+        wavelet.setThreadPool(pool);
+    }
+
+    // returns the fitter workspace of the i-th fitting thread
+    inline FitterWorkspace& workspace(size_t i)
+    {
+        while (workspaces.size() <= i)
+            workspaces.emplace_back(new FitterWorkspace);
+        return *workspaces[i];
+    }
+
+    LocalMaximumSearch nms;
+    Wavelet wavelet;
+    // statistics of the frames without wavelet filter
+    ImageStatistics statistics;
+    std::vector<std::unique_ptr<FitterWorkspace>> workspaces;
+};
+
+// units of the written localizations
+struct RecordUnits
+{
+    double pixelSize = 1.0;
+    double adu = 1.0;
+    double gain = 1.0;
+    double baseline = 0.0;
+};
+
+// fitting result of a single canidate
+struct FitSlot
+{
+    enum State : uint8_t { Pending, Skipped, Fitted };
+
+    Molecule mol;
+    Rect region;
+    State state = Pending;
+    bool success = false;
+};
+
 class ControllerPrivate
 {
 public:
     inline ControllerPrivate()
         : isSMLMImageReady(false)
-        , nms(1, 6)
         , imageWidth(0)
         , imageHeight(0)
         , threshold(0)
         , frameFittingTimeMS(0.0)
         , renderUpdateRate(5)
         , timeoutMS(250.0)
+        , molsSequence(0)
         , autoThresholdUpdateRate(10)
         , enableRendering(true)
         , waveletFactor(1.25f)
         , enableWavelet(false)
+        , enableImageStatistics(false)
         , verbose(false)
+        , fittingThreads(1)
+        , detectionThreads(1)
+        , pool(std::make_shared<ThreadPool>())
+        , worker(pool)
     {
         numberOfDetectedLocs.store(0);
     }
 
+    // detect and fit all canidates of an image, returns false on timeout
+    bool fitFrame(FrameWorker& worker, ImageU16 image, int frame, FrameResult& result);
+
+    // fit up to FIT_CHUNK_SIZE canidates within a window around the local maxima with the batch fitter
+    void fitChunk(FitterWorkspace& workspace, const LocalMaximum* features, size_t count,
+        const ImageU16& image, int frame, bool verbose, FitSlot* slots) const;
+
+    // sizes the pool for the fitting and detection threads of each frame thread,
+    // so the frame threads and the helpers do not use more threads than cores
+    void resizePool();
+
+    // add a fitted canidate to the frame result, returns false if too many canidates failed
+    bool mergeCanidate(FitSlot& slot, uint16_t threshold, bool collectCanidates,
+        int& failureRetries, FrameResult& result) const;
+
+    // add the results of a fitted frame to the molecule lists, renderer and auto threshold
+    void commit(FrameResult& result);
+
+    // writes the localizations of a committed frame if a recording is started
+    void record(const Controller& controller, const FrameResult& result);
+
+    // photons and CRLB of a molecule (see Controller::calculatePhotons and calculateCRLB),
+    // buffer receives the template if it has to be copied, photons or crlb can be nullptr,
+    // returns false if the template is invalid (photons = 0) or the CRLB is not available
+    bool photonsCRLB(const Molecule& mol, std::vector<double>& buffer, double adu, double gain, 
+        double offset, double pixelSize, double* photons, double* crlb) const;
+
     std::atomic<bool> isSMLMImageReady;
-    LocalMaximumSearch nms;
     int imageWidth;
     int imageHeight;
     std::atomic<uint16_t> threshold;
     Fitter fitter;
-    std::list<Molecule> detectedMolecues;
+    LocalizationStore detectedMolecues;
     std::atomic<int32_t> numberOfDetectedLocs;
     std::atomic<double> frameFittingTimeMS;
     std::atomic<double> renderTimeMS;
     std::atomic<int> renderUpdateRate;
     std::atomic<bool> enableRendering;
-    Wavelet wavelet;
     float waveletFactor;
     std::atomic<bool> enableWavelet;
+    // statistics of the frames without wavelet filter (an extra pass over the pixels)
+    std::atomic<bool> enableImageStatistics;
     std::atomic<double> timeoutMS;
-    std::list<Molecule> mols;
+    LocalizationStore mols;
+    // file of startRecording
+    std::unique_ptr<LocalizationWriter> recorder;
+    RecordUnits recordUnits;
+    std::vector<LocalizationRecord> recordBuffer;
+    mutable std::mutex recorderMutex;
+    // guards mols and molsSequence for the cursor based retrieval
+    mutable std::mutex molsMutex;
+    // sequence number of the first localization of mols
+    uint64_t molsSequence;
+    // statistics of the last committed image
+    ImageStats imageStats;
+    mutable std::mutex statsMutex;
     AutoThreshold autoThreshold;
     std::atomic<int> autoThresholdUpdateRate;
     Renderer renderer;
     std::atomic<bool> verbose;
     Calibration cali;
     Rect changedRegion;
+    std::atomic<size_t> fittingThreads;
+    std::atomic<size_t> detectionThreads;
+    // helper threads of the frame threads (processImage or the pipeline workers)
+    std::shared_ptr<ThreadPool> pool;
+    // mapped LUT file used by the fitter
+    std::unique_ptr<LUTFile> lutFile;
+    // LUT that draws the templates of a lazy fitter
+    std::shared_ptr<LUT> lazyLUT;
+    FrameWorker worker;
+    std::vector<std::unique_ptr<FrameWorker>> workers;
+    // has to be destroyed first, since the worker threads access the other members
+    FramePipeline pipeline;
 
 };
 
@@ -135,8 +251,147 @@ protected:
         const double dz = (tx2 * m_dsx / sx3 + ty2 * m_dsy / sy3) * e;
         return { e, dx, dy, dz };
     }
+
+    // same as templateAtPixel for a whole template, but without member state, so
+    // it can be called in parallel and the exp function is evaluated with SIMD
+    inline
+    virtual bool templateImage(size_t index, double x, double y, double z, 
+        double* psf, double* dx, double* dy, double* dz) const override
+    {
+        using SIMD::VecD;
+
+        double sx, sy, dsx, dsy;
+        std::tie(sx, sy, dsx, dsy) = m_cali.valDer(z + m_cali.focalPlane());
+        const double sx2 = sx * sx, sx3 = sx2 * sx;
+        const double sy2 = sy * sy, sy3 = sy2 * sy;
+        const size_t winSize = windowSize();
+        const size_t n = winSize * winSize;
+
+        // exponent of the gaussian
+        for (size_t pixY = 0, i = 0; pixY < winSize; ++pixY) {
+            const double yi = (pixY - y);
+            for (size_t pixX = 0; pixX < winSize; ++pixX, ++i) {
+                const double xi = (pixX - x);
+                const double tx = xi * m_cosa + yi * m_sina, tx2 = tx * tx;
+                const double ty = -xi * m_sina + yi * m_cosa, ty2 = ty * ty;
+                psf[i] = -0.5 * tx2 / sx2 - 0.5 * ty2 / sy2;
+            }
+        }
+
+        // the last pixels are padded to the vector size
+        size_t i = 0;
+        for (; i + VecD::Lanes <= n; i += VecD::Lanes)
+            exp(VecD::load(psf + i)).store(psf + i);
+        if (i < n) {
+            double tail[VecD::Lanes] = { 0.0 };
+            std::copy(psf + i, psf + n, tail);
+            exp(VecD::load(tail)).store(tail);
+            std::copy(tail, tail + (n - i), psf + i);
+        }
+
+        for (size_t pixY = 0, i = 0; pixY < winSize; ++pixY) {
+            const double yi = (pixY - y);
+            for (size_t pixX = 0; pixX < winSize; ++pixX, ++i) {
+                const double xi = (pixX - x);
+                const double tx = xi * m_cosa + yi * m_sina, tx2 = tx * tx;
+                const double ty = -xi * m_sina + yi * m_cosa, ty2 = ty * ty;
+                const double e = psf[i];
+                dx[i] = (tx * m_cosa / sx2 - ty * m_sina / sy2) * e;
+                dy[i] = (tx * m_sina / sx2 + ty * m_cosa / sy2) * e;
+                dz[i] = (tx2 * dsx / sx3 + ty2 * dsy / sy3) * e;
+            }
+        }
+        return true;
+    }
 };
 
+// sum of the template intensities at the psf in photons
+template<class T>
+static double templatePhotons(const T* psf, Layout layout, size_t pixels, const Molecule& mol, const double photonFactor)
+{
+    const size_t step = (layout == Layout::Planar) ? 1 : 4;
+    double photons = 0.0;
+    for (size_t i = 0; i < pixels; ++i)
+        photons += psf[step * i] * mol.peak * photonFactor;
+    return photons;
+}
+
+// upper triangle (row by row) of the Fisher information matrix of the LUT model at (b, I, x, y, z)
+template<class T>
+static void templateFisher(const T* psf, Layout layout, size_t pixels, const Molecule& mol, double* fisher, 
+    const double photonFactor, const double offset, const double pixelSize)
+{
+    const double photons = mol.peak * photonFactor;
+    const double photonsLat = photons / pixelSize;
+    // distance of the pixels and of the values (e, dx, dy, dz) of a pixel
+    const size_t step = (layout == Layout::Planar) ? 1 : 4;
+    const size_t plane = (layout == Layout::Planar) ? pixels : 1;
+
+    double f[15] = { 0.0 };
+    for (size_t i = 0; i < pixels; ++i) {
+        const T* v = psf + step * i;
+        // intensity of the molecule at the pixel i
+        const double I = photonFactor * (mol.peak * v[0] + mol.background) - offset * photonFactor;
+        const double w = 1.0 / I;
+        // derivatives of the model by the parameters
+        const double d1 = v[0], d2 = v[plane] * photonsLat, d3 = v[2 * plane] * photonsLat, d4 = v[3 * plane] * photons;
+        const double w1 = w * d1, w2 = w * d2, w3 = w * d3, w4 = w * d4;
+        f[0] += w;  f[1] += w1;      f[2] += w2;      f[3] += w3;      f[4] += w4;
+                    f[5] += w1 * d1; f[6] += w1 * d2; f[7] += w1 * d3; f[8] += w1 * d4;
+                                     f[9] += w2 * d2; f[10] += w2 * d3; f[11] += w2 * d4;
+                                                      f[12] += w3 * d3; f[13] += w3 * d4;
+                                                                        f[14] += w4 * d4;
+    }
+    std::copy(f, f + 15, fisher);
+}
+
+// diagonal of the inverse of a symmetric positive definite 5x5 matrix given by its upper
+// triangle (row by row) with the Cholesky factorization A = L L^T, so inv(A) = inv(L)^T inv(L),
+// returns false if the matrix is not positive definite
+static bool inverseDiagonal5(const double* upper, double* diagonal)
+{
+    double a[5][5];
+    for (size_t j = 0, n = 0; j < 5; ++j) {
+        for (size_t k = j; k < 5; ++k, ++n)
+            a[j][k] = a[k][j] = upper[n];
+    }
+
+    double l[5][5] = { { 0.0 } };
+    for (size_t j = 0; j < 5; ++j) {
+        double s = a[j][j];
+        for (size_t k = 0; k < j; ++k)
+            s -= l[j][k] * l[j][k];
+        if (!(s > 0.0))
+            return false;
+        l[j][j] = std::sqrt(s);
+        for (size_t i = j + 1; i < 5; ++i) {
+            double t = a[i][j];
+            for (size_t k = 0; k < j; ++k)
+                t -= l[i][k] * l[j][k];
+            l[i][j] = t / l[j][j];
+        }
+    }
+
+    // inverse of the lower triangular factor
+    double m[5][5] = { { 0.0 } };
+    for (size_t j = 0; j < 5; ++j) {
+        m[j][j] = 1.0 / l[j][j];
+        for (size_t i = j + 1; i < 5; ++i) {
+            double t = 0.0;
+            for (size_t k = j; k < i; ++k)
+                t -= l[i][k] * m[k][j];
+            m[i][j] = t / l[i][i];
+        }
+    }
+
+    for (size_t i = 0; i < 5; ++i) {
+        double s = 0.0;
+        for (size_t k = i; k < 5; ++k)
+            s += m[k][i] * m[k][i];
+        diagonal[i] = s;
+    }
+    return true;
+}
 
 } // namespace LookUpSTORM
 
@@ -168,6 +423,7 @@ void Controller::release()
 
 Controller::~Controller()
 {
+    stopWorkers();
     delete d;
 }
 
@@ -186,12 +442,55 @@ bool Controller::generate(LUT& lut, size_t windowSize, double dLat, double dAx,
 
 bool Controller::generateFromCalibration(const Calibration& cali, size_t windowSize, 
     double dLat, double dAx, double rangeLat, double rangeAx, 
-    std::function<void(size_t index, size_t max)> callback)
+    std::function<void(size_t index, size_t max)> callback, Precision precision, Layout layout, Allocation allocation,
+    Compression compression)
 {
+    // a rotated PSF is not symmetric in x and y
+    if ((compression == Compression::Symmetry) && (cali.theta() != 0.0)) {
+        if (d->verbose)
+            std::cerr << "Controller: Symmetry compression requires a calibration without rotation!" << std::endl;
+        return false;
+    }
+
     AstigmatismLUT lut(cali);
+    lut.setPrecision(precision);
+    lut.setLayout(layout);
+    lut.setAllocation(allocation);
+    lut.setCompression(compression);
     return generate(lut, windowSize, dLat, dAx, rangeLat, rangeAx, callback);
 }
 
+bool Controller::generateLazyFromCalibration(const Calibration& cali, size_t windowSize,
+    double dLat, double dAx, double rangeLat, double rangeAx, size_t cacheBytes)
+{
+    return setLazyLUT(std::make_shared<AstigmatismLUT>(cali), windowSize, dLat, dAx, rangeLat, rangeAx, cacheBytes);
+}
+
+bool Controller::setLazyLUT(std::shared_ptr<LUT> lut, size_t windowSize,
+    double dLat, double dAx, double rangeLat, double rangeAx, size_t cacheBytes)
+{
+    if (!lut || !lut->setup(windowSize, dLat, dAx, rangeLat, rangeAx))
+        return false;
+
+    // the workers share the old LUT
+    stopWorkers();
+
+    if (!d->fitter.setLazyLookUpTable(*lut, cacheBytes)) {
+        if (d->verbose)
+            std::cerr << "Controller: Could not set lazy LUT!" << std::endl;
+        releaseLUT();
+        return false;
+    }
+    // the old LUT is released after the fitter uses the new one
+    d->lazyLUT.swap(lut);
+    d->lutFile.reset();
+
+    d->renderer.setSettings(d->fitter.minAx(), d->fitter.maxAx(), d->fitter.deltaAx(), 1.f);
+    reset();
+
+    return true;
+}
+
 bool Controller::setLUT(const LUT& lut)
 {
     if (!lut.isValid()) {
@@ -200,11 +499,16 @@ bool Controller::setLUT(const LUT& lut)
         return false;
     }
 
-    if (!d->fitter.setLookUpTable(lut.ptr(), lut.dataSize(), true, lut.windowSize(), lut.dLat(), lut.dAx(), lut.rangeLat(), lut.rangeAx())) {
+    // the workers share the old LUT
+    stopWorkers();
+
+    if (!d->fitter.setLookUpTable(lut)) {
         if (d->verbose)
             std::cerr << "Controller: Could not set generated LUT!" << std::endl;
         return false;
     }
+    d->lutFile.reset();
+    d->lazyLUT.reset();
 
     d->renderer.setSettings(lut.minAx(), lut.maxAx(), lut.dAx(), 1.f);
     reset();
@@ -212,6 +516,63 @@ bool Controller::setLUT(const LUT& lut)
     return true;
 }
 
+bool Controller::loadLUT(const std::string& fileName, bool verify)
+{
+    std::unique_ptr<LUTFile> file(new LUTFile);
+    if (!file->open(fileName) || (verify && !file->verify())) {
+        if (d->verbose)
+            std::cerr << "LookUpSTORM: Could not load LUT file " << fileName << "!" << std::endl;
+        return false;
+    }
+
+    // the workers share the old LUT
+    stopWorkers();
+
+    const HeaderLUTv2& hdr = file->header();
+    bool ok;
+    if (hdr.precision == Precision::Float) {
+        ok = d->fitter.setLookUpTable(file->dataF32(), file->dataSize(), false, int(hdr.windowSize), 
+            hdr.dLat, hdr.dAx, hdr.rangeLat, hdr.rangeAx, hdr.layout, hdr.compression);
+    } else {
+        ok = d->fitter.setLookUpTable(file->data(), file->dataSize(), false, int(hdr.windowSize), 
+            hdr.dLat, hdr.dAx, hdr.rangeLat, hdr.rangeAx, hdr.layout, hdr.compression);
+    }
+    if (!ok) {
+        if (d->verbose)
+            std::cerr << "Controller: Could not set LUT of file " << fileName << "!" << std::endl;
+        // the fitter must not use the mapping after it is closed
+        releaseLUT();
+        return false;
+    }
+    // the old mapping is closed after the fitter uses the new one
+    d->lutFile.swap(file);
+    d->lazyLUT.reset();
+
+    d->renderer.setSettings(d->fitter.minAx(), d->fitter.maxAx(), d->fitter.deltaAx(), 1.f);
+    reset();
+
+    return true;
+}
+
+bool Controller::verifyLUT(const std::string& fileName) const
+{
+    LUTFile file;
+    if (!file.open(fileName) || !file.verify()) {
+        if (d->verbose)
+            std::cerr << "LookUpSTORM: LUT file " << fileName << " is corrupt!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Controller::releaseLUT()
+{
+    stopWorkers();
+    d->fitter.release();
+    d->lutFile.reset();
+    d->lazyLUT.reset();
+}
+
 bool Controller::isSMLMImageReady() const
 {
     return d->isSMLMImageReady.load();
@@ -222,48 +583,186 @@ void Controller::clearSMLMImageReady()
     d->isSMLMImageReady.store(false);
 }
 
-bool Controller::processImage(ImageU16 image, int frame)
+void ControllerPrivate::resizePool()
 {
-    const bool verbose = d->verbose.load();
-    if (!isReady()) {
-        if (verbose)
-            std::cerr << "LookUpSTORM: Image processor is not ready!" << std::endl;
-        return false;
-    }
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    const size_t frameThreads = std::max<size_t>(1, pipeline.workers());
+    const size_t threads = std::max(fittingThreads.load(), detectionThreads.load());
+    pool->setThreads(std::min(threads - 1, (cores > frameThreads) ? cores - frameThreads : 0));
+}
 
+bool ControllerPrivate::fitFrame(FrameWorker& worker, ImageU16 image, int frame, FrameResult& result)
+{
+    const bool verbose = this->verbose.load();
     const auto t0 = std::chrono::high_resolution_clock::now();
 
-    const size_t winSize = d->fitter.windowSize();
-    d->nms.setRadius(winSize * 3 / 4);
-    d->nms.setBorder(winSize / 2);
+    const size_t winSize = fitter.windowSize();
+    worker.nms.setRadius(winSize * 3 / 4);
+    worker.nms.setBorder(winSize / 2);
+    const int detectionThreads = int(this->detectionThreads.load());
+    worker.nms.setThreads(detectionThreads);
+    worker.wavelet.setThreads(detectionThreads);
 
-    const uint16_t threshold = d->threshold.load();
-    const double timeoutMS = d->timeoutMS.load();
+    const uint16_t threshold = this->threshold.load();
+    const double timeoutMS = this->timeoutMS.load();
+    const bool collectCanidates = autoThreshold.isEnabled();
 
     std::list<LocalMaximum> features;
-    if (d->enableWavelet.load()) {
-        const ImageF32 &filtered = d->wavelet.filter(image);
-        const float waveletThreshold = d->autoThreshold.isEnabled() ? 0.f : d->waveletFactor * d->wavelet.inputSTD();
-        features = d->nms.find(image, filtered, waveletThreshold);
+    if (enableWavelet.load()) {
+        worker.wavelet.setSize(image.width(), image.height());
+        const ImageF32 &filtered = worker.wavelet.filter(image);
+        // the robust noise is not raised by the emitters of dense frames like the standard deviation
+        const float waveletThreshold = autoThreshold.isEnabled() ? 0.f : waveletFactor * worker.wavelet.inputNoise();
+        features = worker.nms.find(image, filtered, waveletThreshold);
+        result.stats = worker.wavelet.inputStats();
     }
     else {
+        if (enableImageStatistics.load()) {
+            worker.statistics.reset();
+            worker.statistics.add(image);
+            result.stats = worker.statistics.stats();
+        }
+
         // at the moment only use find all for auto threshold
-        if (d->autoThreshold.isEnabled())
-            features = d->nms.findAll(image);
+        if (autoThreshold.isEnabled())
+            features = worker.nms.findAll(image);
         else
-            features = d->nms.find(image, threshold);
+            features = worker.nms.find(image, threshold);
     }
 
-    Molecule m;
-    Rect bounds = image.rect();
-    d->changedRegion = {};
-    d->detectedMolecues.clear();
+    result.frame = frame;
+    result.success = false;
+    result.molecules.clear();
+    result.canidates.clear();
     //std::cout << "Features: " << features.size() << std::endl;
 
+    auto timeout = [t0, timeoutMS]() {
+        const auto t = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::milli>(t - t0).count() > timeoutMS;
+    };
+
     int failureRetries = 25;
 
-    for (const auto& f : features) {
-        auto t_start = std::chrono::high_resolution_clock::now();
+    const size_t n = features.size();
+    const size_t chunks = (n + FIT_CHUNK_SIZE - 1) / FIT_CHUNK_SIZE;
+    const size_t numThreads = std::min({ fittingThreads.load(), chunks, pool->threads() + 1 });
+
+    // the canidates are sorted by intensity and fitted in chunks
+    const std::vector<LocalMaximum> sorted(features.begin(), features.end());
+
+    if (numThreads <= 1) {
+        FitSlot slots[FIT_CHUNK_SIZE];
+        for (size_t c = 0; c < chunks; ++c) {
+            const size_t begin = c * FIT_CHUNK_SIZE;
+            const size_t count = std::min(FIT_CHUNK_SIZE, n - begin);
+            fitChunk(worker.workspace(0), &sorted[begin], count, image, frame, verbose, slots);
+
+            bool retry = true;
+            for (size_t i = 0; (i < count) && retry; ++i) {
+                if (slots[i].state != FitSlot::Skipped)
+                    retry = mergeCanidate(slots[i], threshold, collectCanidates, failureRetries, result);
+            }
+
+            if (timeout()) {
+                if (verbose)
+                    std::cerr << "LookUpSTORM: Timeout!" << std::endl;
+                return false;
+            }
+
+            if (!retry)
+                break;
+        }
+    }
+    else {
+        // each thread takes the next chunk of canidates from the list 
+        // and the results are merged afterwards in the sorted order
+        std::vector<FitSlot> slots(n);
+        std::vector<int> chunkFailures(chunks, -1);
+        std::atomic<size_t> nextChunk(0);
+        std::atomic<bool> abort(false);
+        std::atomic<bool> timedOut(false);
+        std::mutex mutex;
+        size_t mergedChunks = 0;
+        int mergedFailures = 0;
+
+        auto work = [&](FitterWorkspace& workspace) {
+            for (size_t c = nextChunk++; (c < chunks) && !abort.load(); c = nextChunk++) {
+                const size_t begin = c * FIT_CHUNK_SIZE;
+                const size_t end = std::min(n, begin + FIT_CHUNK_SIZE);
+                fitChunk(workspace, &sorted[begin], end - begin, image, frame, verbose, &slots[begin]);
+
+                int failures = 0;
+                for (size_t i = begin; i < end; ++i) {
+                    const FitSlot& slot = slots[i];
+                    if ((slot.state == FitSlot::Fitted) && !(slot.success && (slot.mol.peak >= threshold)))
+                        ++failures;
+                }
+
+                if (timeout()) {
+                    timedOut = true;
+                    abort = true;
+                    return;
+                }
+
+                // stop as soon as the contiguous finished chunks contain enough failures,
+                // so the merged result is the same as for the sequential fitting
+                std::lock_guard<std::mutex> lock(mutex);
+                chunkFailures[c] = failures;
+                while ((mergedChunks < chunks) && (chunkFailures[mergedChunks] >= 0))
+                    mergedFailures += chunkFailures[mergedChunks++];
+                if (mergedFailures >= failureRetries)
+                    abort = true;
+            }
+        };
+
+        // the workspaces are created before the pool threads access them
+        worker.workspace(numThreads - 1);
+        pool->run(numThreads, numThreads, [&](size_t i) { work(*worker.workspaces[i]); });
+
+        for (auto& slot : slots) {
+            // canidates are only pending after a timeout
+            if (slot.state == FitSlot::Pending)
+                break;
+            if (slot.state == FitSlot::Skipped)
+                continue;
+            if (!mergeCanidate(slot, threshold, collectCanidates, failureRetries, result))
+                break;
+        }
+
+        if (timedOut) {
+            if (verbose)
+                std::cerr << "LookUpSTORM: Timeout!" << std::endl;
+            return false;
+        }
+    }
+
+    const auto t1 = std::chrono::high_resolution_clock::now();
+    result.fittingTimeMS = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    result.success = true;
+
+    if (verbose)
+        std::cout << "Fitted " << result.molecules.size() << " emitter of frame " << frame << " in " << result.fittingTimeMS << " ms" << std::endl;
+
+    return true;
+}
+
+void ControllerPrivate::fitChunk(FitterWorkspace& workspace, const LocalMaximum* features, size_t count,
+    const ImageU16& image, int frame, bool verbose, FitSlot* slots) const
+{
+    const size_t winSize = fitter.windowSize();
+    const auto t_start = std::chrono::high_resolution_clock::now();
+
+    ImageU16 rois[FIT_CHUNK_SIZE];
+    Molecule mols[FIT_CHUNK_SIZE];
+    bool success[FIT_CHUNK_SIZE];
+    size_t index[FIT_CHUNK_SIZE];
+    size_t fits = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const LocalMaximum& f = features[i];
+        FitSlot& slot = slots[i];
+
+        Molecule& m = slot.mol;
         m.peak = std::max<double>(0.0, double(f.val) - f.localBg);
         m.background = f.localBg;
         m.x = f.x;
@@ -271,67 +770,243 @@ bool Controller::processImage(ImageU16 image, int frame)
         m.z = 0.0;
         m.frame = frame;
 
-        Rect region(int(f.x) - winSize / 2, int(f.y) - winSize/2, winSize, winSize);
-        if (!region.moveInside(bounds)) {
+        slot.region = Rect(int(f.x) - winSize / 2, int(f.y) - winSize / 2, winSize, winSize);
+        if (!slot.region.moveInside(image.rect())) {
             if (verbose)
                 std::cerr << "LookUpSTORM: Impossible ROI!" << std::endl;
+            slot.state = FitSlot::Skipped;
             continue;
         }
 
-        ImageU16 roi = image.subImage(region);
+        rois[fits] = image.subImage(slot.region);
+        mols[fits] = m;
+        index[fits++] = i;
+    }
 
-        const bool success = d->fitter.fitSingle(roi, m);
-        auto t_end = std::chrono::high_resolution_clock::now();
+    fitter.fitBatch(rois, mols, fits, success, workspace);
+    const auto t_end = std::chrono::high_resolution_clock::now();
+
+    // the fitting time is shared by all canidates of the chunk
+    const double time_us = std::chrono::duration<double, std::micro>(t_end - t_start).count() / std::max<size_t>(1, fits);
+    for (size_t j = 0; j < fits; ++j) {
+        FitSlot& slot = slots[index[j]];
+        slot.mol = mols[j];
+        slot.mol.time_us = time_us;
+        slot.success = success[j];
+        slot.state = FitSlot::Fitted;
+    }
+}
 
-        m.time_us = std::chrono::duration<double, std::micro>(t_end - t_start).count();
+bool ControllerPrivate::mergeCanidate(FitSlot& slot, uint16_t threshold, bool collectCanidates, 
+    int& failureRetries, FrameResult& result) const
+{
+    Molecule& m = slot.mol;
 
-        // add all fitted candiates intensities even if they failed for auto thresholding
-        d->autoThreshold.addMolecule(m);
+    // add all fitted candiates intensities even if they failed for auto thresholding
+    if (collectCanidates)
+        result.canidates.push_back(m);
 
-        if (success && (m.peak >= threshold)) {
-            m.xfit = m.x;
-            m.yfit = m.y;
+    if (slot.success && (m.peak >= threshold)) {
+        m.xfit = m.x;
+        m.yfit = m.y;
 
-            m.x += region.left();
-            m.y += region.top();
+        m.x += slot.region.left();
+        m.y += slot.region.top();
 
-            d->changedRegion.extendByPoint(d->renderer.map(m.x, m.y));
-            d->renderer.set(m.x, m.y, m.z);
+        result.molecules.push_back(m);
+    }
+    else {
+        --failureRetries;
+    }
 
-            d->detectedMolecues.push_back(m);
-            d->mols.push_back(m);
-        }
-        else {
-            --failureRetries;
-        }
+    return failureRetries > 0;
+}
 
-        const auto t = std::chrono::high_resolution_clock::now();
-        if (std::chrono::duration<double, std::milli>(t - t0).count() > timeoutMS) {
-            if (verbose)
-                std::cerr << "LookUpSTORM: Timeout!" << std::endl;
-            return false;
+void ControllerPrivate::commit(FrameResult& result)
+{
+    changedRegion = {};
+
+    for (const auto& m : result.canidates)
+        autoThreshold.addMolecule(m);
+
+    for (const auto& m : result.molecules) {
+        changedRegion.extendByPoint(renderer.map(m.x, m.y));
+        renderer.set(m.x, m.y, m.z);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(molsMutex);
+        mols.append(result.molecules.begin(), result.molecules.end());
+    }
+    detectedMolecues.clear();
+    detectedMolecues.append(result.molecules.begin(), result.molecules.end());
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        imageStats = result.stats;
+    }
+
+    if (result.success) {
+        frameFittingTimeMS.store(result.fittingTimeMS);
+        numberOfDetectedLocs.store(static_cast<uint16_t>(detectedMolecues.size()));
+    }
+}
+
+// same conversion as the JNI export of the molecules, converts count molecules with
+// photons and CRLB of Controller::calculatePhotonsCRLB
+static void toRecords(const RecordUnits& units, const Molecule* mols, size_t count, 
+    const double* photons, const double* crlb, LocalizationRecord* records)
+{
+    for (size_t i = 0; i < count; ++i, crlb += 5) {
+        const Molecule& m = mols[i];
+        LocalizationRecord& r = records[i];
+        r.frame = static_cast<int32_t>(m.frame);
+        r.x = m.x * units.pixelSize;
+        r.y = m.y * units.pixelSize;
+        r.z = m.z;
+        r.intensity = photons[i];
+        r.background = std::max(0.0, (m.background - units.baseline) * units.adu / units.gain);
+        // NaN like the CRLB of the Java molecules if it is not available
+        if (std::isfinite(crlb[2]) && std::isfinite(crlb[3]) && std::isfinite(crlb[4])) {
+            r.crlbX = crlb[2];
+            r.crlbY = crlb[3];
+            r.crlbZ = crlb[4];
+        } else {
+            r.crlbX = r.crlbY = r.crlbZ = std::numeric_limits<double>::quiet_NaN();
         }
+    }
+}
+
+void ControllerPrivate::record(const Controller& controller, const FrameResult& result)
+{
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    const size_t count = result.molecules.size();
+    if (!recorder || (count == 0))
+        return;
+    std::vector<double> photons(count), crlb(5 * count);
+    controller.calculatePhotonsCRLB(result.molecules.data(), count, photons.data(), crlb.data(),
+        recordUnits.adu, recordUnits.gain, recordUnits.baseline, recordUnits.pixelSize);
+    recordBuffer.resize(count);
+    toRecords(recordUnits, result.molecules.data(), count, photons.data(), crlb.data(), recordBuffer.data());
+    recorder->write(recordBuffer.data(), count);
+}
+
+bool Controller::processImage(ImageU16 image, int frame)
+{
+    if (!isReady()) {
+        if (d->verbose.load())
+            std::cerr << "LookUpSTORM: Image processor is not ready!" << std::endl;
+        return false;
+    }
+
+    FrameResult result;
+    d->fitFrame(d->worker, image, frame, result);
+    d->commit(result);
+    d->record(*this, result);
 
-        if (failureRetries == 0)
-            break;
+    return result.success;
+}
+
+bool Controller::startWorkers(size_t numWorkers, size_t queueSize)
+{
+    stopWorkers();
+
+    if (!isReady()) {
+        if (d->verbose.load())
+            std::cerr << "LookUpSTORM: Image processor is not ready!" << std::endl;
+        return false;
     }
 
-    const auto t1 = std::chrono::high_resolution_clock::now();
-    
-    d->frameFittingTimeMS.store(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    if (numWorkers == 0)
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
 
-    if (verbose)
-        std::cout << "Fitted " << d->detectedMolecues.size() << " emitter of frame " << frame << " in " << d->frameFittingTimeMS << " ms" << std::endl;
+    for (size_t i = 0; i < numWorkers; ++i)
+        d->workers.emplace_back(new FrameWorker(d->pool));
+
+    ControllerPrivate* const p = d;
+    d->pipeline.start(numWorkers, [p](size_t worker, ImageU16 image, int frame, FrameResult& result) {
+        p->fitFrame(*p->workers[worker], image, frame, result);
+    }, queueSize);
+    d->resizePool();
 
-    d->numberOfDetectedLocs.store(static_cast<uint16_t>(d->detectedMolecues.size()));
     return true;
 }
 
+void Controller::stopWorkers()
+{
+    d->pipeline.stop();
+    d->workers.clear();
+    d->resizePool();
+}
+
+bool Controller::isWorkersRunning() const
+{
+    return d->pipeline.isRunning();
+}
+
+bool Controller::submitImage(ImageU16 image, int frame)
+{
+    return d->pipeline.submit(image, frame, true);
+}
+
+bool Controller::pushImage(ImageU16 image, int frame)
+{
+    return d->pipeline.submit(image, frame, false);
+}
+
+bool Controller::pushImage(int width, int height, int frame, const std::function<void(uint16_t* pixels)>& fill)
+{
+    return d->pipeline.submit(width, height, frame, fill, false);
+}
+
+PipelineStats Controller::pipelineStats() const
+{
+    return d->pipeline.stats();
+}
+
+bool Controller::pollImage(int& frame, bool wait)
+{
+    FrameResult result;
+    if (!d->pipeline.poll(result, wait))
+        return false;
+    frame = result.frame;
+    d->commit(result);
+    d->record(*this, result);
+    return true;
+}
+
+size_t Controller::pendingImages() const
+{
+    return d->pipeline.pending();
+}
+
+void Controller::setFittingThreads(size_t numThreads)
+{
+    d->fittingThreads.store(numThreads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : numThreads);
+    d->resizePool();
+}
+
+size_t Controller::fittingThreads() const
+{
+    return d->fittingThreads.load();
+}
+
+void Controller::setDetectionThreads(size_t numThreads)
+{
+    d->detectionThreads.store(numThreads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : numThreads);
+    d->resizePool();
+}
+
+size_t Controller::detectionThreads() const
+{
+    return d->detectionThreads.load();
+}
+
 void Controller::setImageSize(int width, int height)
 {
     d->imageWidth = width;
     d->imageHeight = height;
-    d->wavelet.setSize(width, height);
+    d->worker.wavelet.setSize(width, height);
 }
 
 int Controller::imageWidth() const
@@ -428,6 +1103,16 @@ bool Controller::isWaveletFilterEnabled() const
     return d->enableWavelet.load();
 }
 
+void Controller::setImageStatisticsEnabled(bool enabled)
+{
+    d->enableImageStatistics.store(enabled);
+}
+
+bool Controller::isImageStatisticsEnabled() const
+{
+    return d->enableImageStatistics.load();
+}
+
 void Controller::setWaveletFactor(float factor)
 {
     d->waveletFactor = factor;
@@ -468,16 +1153,55 @@ double Controller::timeoutMS() const
     return d->timeoutMS.load();
 }
 
-std::list<Molecule>& Controller::detectedMolecues()
+LocalizationStore& Controller::detectedMolecues()
 {
     return d->detectedMolecues;
 }
 
-std::list<Molecule>& Controller::allMolecues()
+LocalizationStore& Controller::allMolecues()
 {
     return d->mols;
 }
 
+size_t Controller::numberOfMolecules() const
+{
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    return d->mols.size();
+}
+
+size_t Controller::exportMolecules(size_t first, double* dst, size_t maxCount, bool columnMajor) const
+{
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    return d->mols.exportValues(first, maxCount, dst, columnMajor);
+}
+
+uint64_t Controller::moleculeCursor() const
+{
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    return d->molsSequence + d->mols.size();
+}
+
+size_t Controller::moleculesSince(uint64_t& cursor, std::vector<Molecule>& mols, size_t maxCount) const
+{
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    const size_t first = static_cast<size_t>(std::max(cursor, d->molsSequence) - d->molsSequence);
+    const size_t count = first < d->mols.size() ? std::min(maxCount, d->mols.size() - first) : 0;
+    const size_t offset = mols.size();
+    mols.resize(offset + count);
+    d->mols.copy(first, count, mols.data() + offset);
+    cursor = d->molsSequence + std::min(first + count, d->mols.size());
+    return count;
+}
+
+size_t Controller::moleculesSince(uint64_t& cursor, double* dst, size_t maxCount, bool columnMajor) const
+{
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    const size_t first = static_cast<size_t>(std::max(cursor, d->molsSequence) - d->molsSequence);
+    const size_t count = d->mols.exportValues(first, maxCount, dst, columnMajor);
+    cursor = d->molsSequence + std::min(first + count, d->mols.size());
+    return count;
+}
+
 int32_t Controller::numberOfDetectedLocs()
 {
     return d->numberOfDetectedLocs.load();
@@ -498,6 +1222,12 @@ double Controller::frameFittingTimeMS() const
     return d->frameFittingTimeMS.load();
 }
 
+ImageStats Controller::imageStatistics() const
+{
+    std::lock_guard<std::mutex> lock(d->statsMutex);
+    return d->imageStats;
+}
+
 Milliseconds Controller::frameFittingTime() const
 {
     return Milliseconds(d->renderTimeMS.load());
@@ -543,28 +1273,76 @@ void Controller::setRenderSize(int width, int height)
         double(height) / d->imageHeight);
 }
 
-double Controller::calculatePhotons(const Molecule& mol, const double adu, const double gain) const
+bool ControllerPrivate::photonsCRLB(const Molecule& mol, std::vector<double>& buffer, double adu, double gain, 
+    double offset, double pixelSize, double* photons, double* crlb) const
 {
-    if (!d->fitter.isReady()) {
-        if (d->verbose)
-            std::cerr << "LookUpSTORM: LUT is not set!" << std::endl;
-        return std::numeric_limits<double>::quiet_NaN();
-    }
-
-    const size_t winSize = d->fitter.windowSize();
+    const size_t winSize = fitter.windowSize();
     const size_t pixels = winSize * winSize;
     const double photonFactor = adu / gain;
 
-    const double* psf = d->fitter.templatePtr(mol.xfit, mol.yfit, mol.z);
-    if (psf == nullptr) {
-        if (d->verbose)
+    // the photons only need the sum of the template (O(1) with the table of the fitter)
+    double sum = 0.0;
+    const bool summed = (photons != nullptr) && fitter.templateSum(mol.xfit, mol.yfit, mol.z, sum);
+    if (summed) {
+        *photons = mol.peak * photonFactor * sum;
+        if (crlb == nullptr)
+            return true;
+    }
+
+    const double* psf = fitter.templatePtr(mol.xfit, mol.yfit, mol.z);
+    const float* psfF32 = fitter.templatePtrF32(mol.xfit, mol.yfit, mol.z);
+    // the template of a lazy or compressed LUT or the interpolated one has to be copied
+    if (fitter.isLazy() || fitter.interpolation() || (fitter.compression() != Compression::None)) {
+        buffer.resize(4 * pixels);
+        if (fitter.copyTemplate(mol.xfit, mol.yfit, mol.z, buffer.data())) {
+            psf = buffer.data();
+            psfF32 = nullptr;
+        }
+    }
+    if ((psf == nullptr) && (psfF32 == nullptr)) {
+        if (verbose)
             std::cerr << "LookUpSTORM: Molecule at the position " << mol.xfit << "," << mol.yfit << "," << mol.z << "is invalid!" << std::endl;
+        if (photons != nullptr)
+            *photons = 0.0;
         return false;
     }
 
+    if ((photons != nullptr) && !summed) {
+        *photons = (psfF32 != nullptr) ? templatePhotons(psfF32, fitter.layout(), pixels, mol, photonFactor) : 
+            templatePhotons(psf, fitter.layout(), pixels, mol, photonFactor);
+    }
+    if (crlb == nullptr)
+        return true;
+
+    double fisher[15];
+    if (psfF32 != nullptr)
+        templateFisher(psfF32, fitter.layout(), pixels, mol, fisher, photonFactor, offset, pixelSize);
+    else
+        templateFisher(psf, fitter.layout(), pixels, mol, fisher, photonFactor, offset, pixelSize);
+
+    // only the diagonal of the inverse of the Fisher information matrix is needed
+    double variance[5];
+    if (!inverseDiagonal5(fisher, variance)) {
+        if (verbose)
+            std::cerr << "LookUpSTORM: Fisher information matrix is singular!" << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < 5; ++i)
+        crlb[i] = std::sqrt(variance[i]);
+    return true;
+}
+
+double Controller::calculatePhotons(const Molecule& mol, const double adu, const double gain) const
+{
+    if (!d->fitter.isReady()) {
+        if (d->verbose)
+            std::cerr << "LookUpSTORM: LUT is not set!" << std::endl;
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    std::vector<double> buffer;
     double photons = 0.0;
-    for (size_t i = 0; i < pixels; ++i)
-        photons += psf[4 * i] * mol.peak * photonFactor;
+    d->photonsCRLB(mol, buffer, adu, gain, 0.0, 1.0, &photons, nullptr);
     return photons;
 }
 
@@ -582,71 +1360,125 @@ bool Controller::calculateCRLB(const Molecule& mol, double* crlb, const double a
         return false;
     }
 
-    const double photonFactor = adu / gain;
-
-    const size_t winSize = d->fitter.windowSize();
-    const size_t pixels = winSize * winSize;
+    std::vector<double> buffer;
+    return d->photonsCRLB(mol, buffer, adu, gain, offset, pixelSize, nullptr, crlb);
+}
 
-    const double* psf = d->fitter.templatePtr(mol.xfit, mol.yfit, mol.z);
-    if (psf == nullptr) {
+void Controller::calculatePhotonsCRLB(const Molecule* mols, size_t count, double* photons, double* crlb, 
+    const double adu, const double gain, const double offset, const double pixelSize) const
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    if (!d->fitter.isReady()) {
         if (d->verbose)
-            std::cerr << "LookUpSTORM: Molecule at the position " << mol.xfit << "," << mol.yfit << "," << mol.z << "is invalid!" << std::endl;
-        return false;
+            std::cerr << "LookUpSTORM: LUT is not set!" << std::endl;
+        if (photons != nullptr)
+            std::fill_n(photons, count, nan);
+        if (crlb != nullptr)
+            std::fill_n(crlb, 5 * count, nan);
+        return;
     }
 
-    const double photons = mol.peak * photonFactor;
-
-    // helper function for the derivative of the LUT model at (b, I, x, y, z)
-    // parameters: i-th pixel index and p-th parameter index
-    auto der = [psf, pixels, photons, pixelSize](size_t p, size_t i) {
-        double scale = 1.0;
-        if (p == 0) return 1.0;
-        else if ((p == 2) || (p == 3)) scale = photons / pixelSize;
-        else if (p == 4) scale = photons;
-        return psf[4 * i + (p - 1)] * scale;
+    auto work = [&](size_t begin, size_t end) {
+        std::vector<double> buffer;
+        for (size_t i = begin; i < end; ++i) {
+            double* c = (crlb != nullptr) ? crlb + 5 * i : nullptr;
+            if (!d->photonsCRLB(mols[i], buffer, adu, gain, offset, pixelSize, (photons != nullptr) ? photons + i : nullptr, c) && (c != nullptr))
+                std::fill_n(c, 5, nan);
+        }
     };
 
-    Matrix fisher(5, 5, 0.0);
-    for (size_t i = 0; i < pixels; ++i) {
-        // intensity of the molecule at the pixel k 
-        const double I = photonFactor * (mol.peak * psf[4 * i] + mol.background) - offset * photonFactor;
-        for (size_t j = 0; j < 5; ++j) {
-            for (size_t k = 0; k < 5; ++k) {
-                fisher(j, k) += der(j, i) * der(k, i) / I;
-            }
-        }
-    }
+    const size_t numThreads = std::max<size_t>(1, std::min(d->fittingThreads.load(), count / MIN_MOLECULES_PER_THREAD));
+    const size_t perThread = (count + numThreads - 1) / numThreads;
+    const size_t jobs = (perThread > 0) ? (count + perThread - 1) / perThread : 0;
+    d->pool->run(jobs, numThreads, [&](size_t i) {
+        work(i * perThread, std::min(count, (i + 1) * perThread));
+    });
+}
 
-    // calculate inverse of Fisher information matrix
-    int ipiv[5];
-    if (LAPACKE::dgetrf(fisher, ipiv) != 0) {
-        if (d->verbose)
-            std::cerr << "LookUpSTORM: dgetrf failed!" << std::endl;
-        return false;
-    }
-    if (LAPACKE::dgetri(fisher, ipiv) != 0) {
-        if (d->verbose)
-            std::cerr << "LookUpSTORM: dgetri failed!" << std::endl;
+bool Controller::saveMolecules(const std::string& fileName, LocalizationFormat format, 
+    double pixelSize, double adu, double gain, double baseline) const
+{
+    LocalizationWriter writer;
+    if (!writer.open(fileName, format))
         return false;
+
+    const RecordUnits units = { pixelSize, adu, gain, baseline };
+    // rows converted in parallel before they are written
+    const size_t chunkRows = std::max<size_t>(1, d->fittingThreads.load()) * LocalizationStore::BlockSize;
+    std::vector<Molecule> mols(chunkRows);
+    std::vector<double> photons(chunkRows), crlb(5 * chunkRows);
+    std::vector<LocalizationRecord> records(chunkRows);
+
+    std::lock_guard<std::mutex> lock(d->molsMutex);
+    for (size_t first = 0; first < d->mols.size(); first += chunkRows) {
+        const size_t count = d->mols.copy(first, chunkRows, mols.data());
+        calculatePhotonsCRLB(mols.data(), count, photons.data(), crlb.data(), adu, gain, baseline, pixelSize);
+        toRecords(units, mols.data(), count, photons.data(), crlb.data(), records.data());
+        if (!writer.write(records.data(), count)) {
+            std::cerr << "LookUpSTORM: Could not write " << fileName << std::endl;
+            return false;
+        }
     }
+    return writer.close();
+}
 
-    for (size_t i = 0; i < 5; ++i)
-        crlb[i] = std::sqrt(fisher(i, i));
+bool Controller::verifyMolecules(const std::string& fileName) const
+{
+    return LocalizationReader::verify(fileName);
+}
 
+bool Controller::startRecording(const std::string& fileName, LocalizationFormat format, 
+    double pixelSize, double adu, double gain, double baseline)
+{
+    std::unique_ptr<LocalizationWriter> writer(new LocalizationWriter);
+    if (!writer->open(fileName, format))
+        return false;
+
+    std::lock_guard<std::mutex> lock(d->recorderMutex);
+    if (d->recorder)
+        d->recorder->close();
+    d->recorder = std::move(writer);
+    d->recordUnits = { pixelSize, adu, gain, baseline };
     return true;
 }
 
+bool Controller::stopRecording()
+{
+    std::lock_guard<std::mutex> lock(d->recorderMutex);
+    if (!d->recorder)
+        return false;
+    const bool ok = d->recorder->close();
+    d->recorder.reset();
+    d->recordBuffer.clear();
+    d->recordBuffer.shrink_to_fit();
+    return ok;
+}
+
+bool Controller::isRecording() const
+{
+    std::lock_guard<std::mutex> lock(d->recorderMutex);
+    return bool(d->recorder);
+}
+
 void Controller::reset()
 {
     d->autoThreshold.reset();
     d->isSMLMImageReady.store(false);
     d->numberOfDetectedLocs.store(0);
-    d->mols.clear();
+    {
+        std::lock_guard<std::mutex> lock(d->molsMutex);
+        d->molsSequence += d->mols.size();
+        d->mols.release();
+    }
     d->renderer.clear();
     d->imageWidth = 0;
     d->imageHeight = 0;
     d->frameFittingTimeMS = 0;
     d->timeoutMS = 250;
+    {
+        std::lock_guard<std::mutex> lock(d->statsMutex);
+        d->imageStats = ImageStats();
+    }
 }
 
 std::vector<Canidate> Controller::findCanidates(ImageU16 image, size_t windowSize, uint16_t threshold)
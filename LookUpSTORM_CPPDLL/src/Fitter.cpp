@@ -24,10 +24,16 @@
 
 #include "Common.h"
 #include "LocalMaximumSearch.h"
-#include "LinearMath.h"
+#include "Simd.h"
+#include "TemplateCache.h"
+#include "LUTMemory.h"
+#include "LUTSymmetry.h"
 
 #include <iostream>
 #include <atomic>
+#include <vector>
+#include <algorithm>
+#include <memory>
 
 #ifdef USE_AVX_LUT
 #include <immintrin.h>
@@ -36,11 +42,43 @@
 namespace LookUpSTORM
 {
 
+class FitterWorkspacePrivate
+{
+public:
+	// pixels of the batch ROIs, interleaved by lane (pixel * Lanes + lane)
+	std::vector<double> roiLanes;
+	// templates copied from the cache of a lazy LUT
+	std::vector<double> templates;
+	std::vector<float> templatesF32;
+
+	template<class T>
+	T* templateBuffer(size_t size);
+
+};
+
+template<>
+inline double* FitterWorkspacePrivate::templateBuffer<double>(size_t size)
+{
+	templates.resize(size);
+	return templates.data();
+}
+
+template<>
+inline float* FitterWorkspacePrivate::templateBuffer<float>(size_t size)
+{
+	templatesF32.resize(size);
+	return templatesF32.data();
+}
+
 class FitterPrivate
 {
 public:
 	inline FitterPrivate()
-		: lookup(nullptr)
+		: table(nullptr)
+		, tableF32(nullptr)
+		, precision(Precision::Double)
+		, layout(Layout::Interleaved)
+		, compression(Compression::None)
 		, tableAllocated(false)
 		, countLat(0)
 		, countAx(0)
@@ -53,27 +91,108 @@ public:
 		, maxLat(0.0)
 		, minAx(0.0)
 		, maxAx(0)
-		, x0(5, Uninitialized)
-		, x1(5, Uninitialized)
-		, JTJ(5, 5, Uninitialized)
 		, epsilon(1E-2)
 		, maxIter(5)
+		, interpolation(false)
 	{}
 	inline ~FitterPrivate() 
 	{
-		if (tableAllocated && (lookup != nullptr))
-			delete[] lookup;
+		releaseTable();
 	}
 
+	// deletes the LUT if it is owned by the fitter
+	inline void releaseTable()
+	{
+		if (tableAllocated) {
+			LUTMemory::release(table);
+			LUTMemory::release(tableF32);
+		}
+		table = nullptr;
+		tableF32 = nullptr;
+		tableAllocated = false;
+		cache.reset();
+		sums.reset();
+	}
+
+	inline bool hasTable() const { return (table != nullptr) || (tableF32 != nullptr) || cache; }
+
+	// sets the LUT geometry and checks if the size of the supplied array is correct
+	bool setGeometry(size_t dataSize, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx, Compression compression);
+
+	// replaces the LUT by the array and sets its geometry, the template sums are
+	// calculated from the array if they are not supplied (or do not fit)
+	template<class T>
+	bool setTable(const T* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+		Layout layout, Compression compression, const std::vector<double>* templateSums);
+
+	// index of the stored template of the grid index
+	size_t storedIndex(size_t index) const;
+
+	// sum of the PSF values of the template at x,y,z (see Fitter::templateSum)
+	bool templateSum(double x, double y, double z, bool interp, double& sum) const;
+
 	size_t lookupIndex(double x, double y, double z) const;
-	const double* get(double x, double y, double z) const;
+
+	template<class T>
+	const T* tablePtr() const;
+
+	// returns the template of the grid index, the template of a lazy or compressed LUT
+	// is copied into the buffer (templateSize values), which is required in this case
+	template<class T>
+	const T* templateAt(size_t index, T* buffer) const;
+
+	// returns the template at x,y,z (see templateAt)
+	template<class T>
+	const T* get(double x, double y, double z, T* buffer = nullptr) const;
+
+	// blends the 8 neighbouring templates of x,y,z trilinearly into the buffer,
+	// which needs stride + templateSize values
+	template<class T>
+	const T* interpolate(double x, double y, double z, T* buffer) const;
+
+	// number of buffer values needed by templateAt
+	inline size_t templateSize() const
+	{
+		// the mirrored template of a lazy LUT is drawn behind the result
+		if (cache && (compression != Compression::None))
+			return 2 * stride;
+		return (cache || (compression != Compression::None)) ? stride : 0;
+	}
+
+	// number of buffer values needed per template lookup of a fit
+	inline size_t bufferSize(bool interp) const
+	{
+		return interp ? stride + templateSize() : templateSize();
+	}
+
+	// Gauss-Newton fit of the template images of type T
+	template<class T>
+	bool fit(const ImageU16& roi, Molecule& mol, FitterWorkspacePrivate* w) const;
+
+	// Gauss-Newton fit of up to SIMD::VecD::Lanes molecules in lockstep
+	template<class T>
+	size_t fitLanes(const ImageU16* rois, Molecule* mols, size_t count, bool* success, FitterWorkspacePrivate* w) const;
+
+	// checks the fitted parameters (bg, peak, x, y, z) and writes them to the molecule,
+	// the position is snapped to the grid of the LUT if the templates are not interpolated
+	bool finish(const double* x, size_t iter, bool interp, Molecule& mol) const;
 
 	inline constexpr bool isValid(double x, double y, double z) const
 	{
 		return ((x >= minLat) && (x <= maxLat) && (y >= minLat) && (y <= maxLat) && (z >= minAx) && (z <= maxAx));
 	}
 
-	const double* lookup;
+	const double* table;
+	const float* tableF32;
+	// templates of a lazy LUT, shared with the fitters using the same LUT
+	std::shared_ptr<TemplateCache> cache;
+	// sum of the PSF values of each stored template, shared like the cache
+	std::shared_ptr<const std::vector<double>> sums;
+	Precision precision;
+	Layout layout;
+	Compression compression;
+	// stored templates of a compressed LUT
+	SymmetryMap symmetry;
 	bool tableAllocated;
 	size_t countLat;
 	size_t countAx;
@@ -87,13 +206,11 @@ public:
 	double minAx;
 	double maxAx;
 
-	// Gauss-Newton algorithm variables
-	Vector x0;
-	Vector x1;
-	Matrix J;
-	Matrix JTJ;
+	// workspace used by fitSingle without supplied workspace
+	FitterWorkspace workspace;
 	std::atomic<double> epsilon;
 	std::atomic<size_t> maxIter;
+	std::atomic<bool> interpolation;
 
 };
 
@@ -110,253 +227,972 @@ size_t FitterPrivate::lookupIndex(double x, double y, double z) const
 	return index;
 }
 
-const double* FitterPrivate::get(double x, double y, double z) const
+size_t FitterPrivate::storedIndex(size_t index) const
+{
+	if (compression == Compression::None)
+		return index;
+	const size_t zi = index % countAx;
+	const size_t yi = (index / countAx) % countLat;
+	const size_t xi = index / (countAx * countLat);
+	return zi + symmetry.slot(yi) * countAx + symmetry.slot(xi) * countAx * symmetry.slots();
+}
+
+template<>
+inline const double* FitterPrivate::tablePtr<double>() const
+{
+	return table;
+}
+
+template<>
+inline const float* FitterPrivate::tablePtr<float>() const
+{
+	return tableF32;
+}
+
+template<class T>
+const T* FitterPrivate::templateAt(size_t index, T* buffer) const
+{
+	const T* data = tablePtr<T>();
+	if (compression == Compression::None) {
+		if (data != nullptr)
+			return &data[index * stride];
+		return ((buffer != nullptr) && cache->copy(index, buffer)) ? buffer : nullptr;
+	}
+
+	if (buffer == nullptr)
+		return nullptr;
+
+	// the template is restored from the stored one of the fundamental position
+	const size_t zi = index % countAx;
+	const size_t yi = (index / countAx) % countLat;
+	const size_t xi = index / (countAx * countLat);
+	const size_t xs = symmetry.slot(xi);
+	const size_t ys = symmetry.slot(yi);
+	const bool mx = symmetry.mirrored(xi);
+	const bool my = symmetry.mirrored(yi);
+
+	const T* src = nullptr;
+	if (data != nullptr) {
+		src = &data[storedIndex(index) * stride];
+	} else {
+		// the cache uses the index of the uncompressed grid
+		T* drawn = (mx || my) ? buffer + stride : buffer;
+		if (!cache->copy(zi + symmetry.position(ys) * countAx + symmetry.position(xs) * countAx * countLat, drawn))
+			return nullptr;
+		src = drawn;
+	}
+	if (src != buffer)
+		mirrorTemplate(src, buffer, winSize, layout, mx, my);
+	return buffer;
+}
+
+template<class T>
+const T* FitterPrivate::get(double x, double y, double z, T* buffer) const
 {
-	if (!isValid(x, y, z))
+	if (((tablePtr<T>() == nullptr) && !cache) || !isValid(x, y, z))
 		return nullptr;
 	const size_t index = lookupIndex(x, y, z);
 	if (index > countIndex) {
 		std::cout << "Index error: " << x << ", " << y << ", " << z << std::endl;
 		return nullptr;
 	}
-	return &lookup[index * stride];
+	return templateAt(index, buffer);
 }
 
-Fitter::Fitter()
-	: d(new FitterPrivate)
+// lower and upper grid index of the position in grid units and the weight of the upper one
+static inline void gridNeighbours(double pos, size_t count, size_t& i0, size_t& i1, double& w)
 {
+	pos = std::max(0.0, pos);
+	i0 = std::min(static_cast<size_t>(pos), count - 1);
+	i1 = std::min(i0 + 1, count - 1);
+	w = (i1 > i0) ? std::min(1.0, pos - double(i0)) : 0.0;
 }
 
-Fitter::~Fitter()
+// dst += weight * src
+template<class T>
+static inline void addWeighted(T* dst, const T* src, double weight, size_t n)
 {
-	delete d;
+	for (size_t j = 0; j < n; ++j)
+		dst[j] += static_cast<T>(weight * src[j]);
 }
 
-void Fitter::release()
+template<>
+inline void addWeighted<double>(double* dst, const double* src, double weight, size_t n)
 {
-	if (d->tableAllocated && (d->lookup != nullptr)) {
-		delete[] d->lookup;
-		d->lookup = nullptr;
-		d->tableAllocated = false;
+	using SIMD::VecD;
+	const VecD w(weight);
+	size_t j = 0;
+	for (; j + VecD::Lanes <= n; j += VecD::Lanes)
+		fmadd(w, VecD::load(src + j), VecD::load(dst + j)).store(dst + j);
+	for (; j < n; ++j)
+		dst[j] += weight * src[j];
+}
+
+template<class T>
+const T* FitterPrivate::interpolate(double x, double y, double z, T* buffer) const
+{
+	const T* data = tablePtr<T>();
+	if (((data == nullptr) && !cache) || (buffer == nullptr) || !isValid(x, y, z))
+		return nullptr;
+
+	size_t xi[2], yi[2], zi[2];
+	double wx, wy, wz;
+	gridNeighbours((x - minLat) / dLat, countLat, xi[0], xi[1], wx);
+	gridNeighbours((y - minLat) / dLat, countLat, yi[0], yi[1], wy);
+	gridNeighbours((z - minAx) / dAx, countAx, zi[0], zi[1], wz);
+
+	T* neighbour = buffer + stride;
+	std::fill_n(buffer, stride, T(0));
+	for (size_t k = 0; k < 8; ++k) {
+		const size_t a = (k >> 2) & 1, b = (k >> 1) & 1, c = k & 1;
+		const double weight = (a ? wx : 1.0 - wx) * (b ? wy : 1.0 - wy) * (c ? wz : 1.0 - wz);
+		// positions on the grid need less than 8 templates
+		if (weight <= 0.0)
+			continue;
+		const size_t index = zi[c] + yi[b] * countAx + xi[a] * countAx * countLat;
+		const T* templ = templateAt(index, neighbour);
+		if (templ == nullptr)
+			return nullptr;
+		addWeighted(buffer, templ, weight, stride);
 	}
-	d->x0 = Vector(5, Uninitialized);
-	d->x1 = Vector(5, Uninitialized);
-	d->JTJ = Matrix(5, 5, Uninitialized);
-	d->J = {};
-	d->countIndex = 0;
-	d->winSize = 0;
+	return buffer;
 }
 
-bool Fitter::isReady() const
+bool FitterPrivate::templateSum(double x, double y, double z, bool interp, double& sum) const
 {
-	return (d->lookup != nullptr) && (d->countIndex > 1);
+	if (!sums || !isValid(x, y, z))
+		return false;
+	const std::vector<double>& s = *sums;
+	if (!interp) {
+		const size_t index = lookupIndex(x, y, z);
+		if (index >= countIndex)
+			return false;
+		sum = s[storedIndex(index)];
+		return true;
+	}
+
+	// the sum is linear in the template, so the sums are blended like the templates
+	size_t xi[2], yi[2], zi[2];
+	double wx, wy, wz;
+	gridNeighbours((x - minLat) / dLat, countLat, xi[0], xi[1], wx);
+	gridNeighbours((y - minLat) / dLat, countLat, yi[0], yi[1], wy);
+	gridNeighbours((z - minAx) / dAx, countAx, zi[0], zi[1], wz);
+
+	sum = 0.0;
+	for (size_t k = 0; k < 8; ++k) {
+		const size_t a = (k >> 2) & 1, b = (k >> 1) & 1, c = k & 1;
+		const double weight = (a ? wx : 1.0 - wx) * (b ? wy : 1.0 - wy) * (c ? wz : 1.0 - wz);
+		if (weight > 0.0)
+			sum += weight * s[storedIndex(zi[c] + yi[b] * countAx + xi[a] * countAx * countLat)];
+	}
+	return true;
 }
 
-bool Fitter::fitSingle(const ImageU16& roi, Molecule& mol)
+#ifdef USE_AVX_LUT
+// load 4 values (e, dx, dy, dz) from lookup table
+static inline __m256d loadPixel(const double* lookup)
 {
-	const size_t startLat = d->winSize / 2;
-	d->x0[0] = mol.background;
-	d->x0[1] = mol.peak; // std::max(50.0, mol.peak - mol.background);
-	d->x0[2] = startLat;
-	d->x0[3] = startLat;
-	d->x0[4] = 0.0;
+	return _mm256_loadu_pd(lookup);
+}
 
-	const size_t N = d->winSize * d->winSize;
+static inline __m256d loadPixel(const float* lookup)
+{
+	return _mm256_cvtps_pd(_mm_loadu_ps(lookup));
+}
+#endif // USE_AVX_LUT
 
-	const size_t maxIter = d->maxIter.load();
-	const double eps = d->epsilon.load();
+// solves the normal equations A x = b of a Gauss-Newton step in-place (b becomes x),
+// only the upper triangle of the symmetric matrix A is used. The value type is
+// either double or SIMD::VecD to solve the equations of multiple fits at once.
+template<class V>
+static inline void solveNormalEquations(V A[5][5], V b[5])
+{
+#ifdef NO_LAPACKE_LUT
+	// same as BLAS::dtrsv(Upper, Trans) on the upper triangle
+	for (size_t i = 0; i < 5; ++i) {
+		V sum = b[i];
+		for (size_t j = 0; j < i; ++j)
+			sum = sum - A[j][i] * b[j];
+		b[i] = sum / A[i][i];
+	}
+#else
+	// LDL^T decomposition without pivoting, JTJ is positive definite
+	V L[5][5];
+	V D[5];
+	for (size_t j = 0; j < 5; ++j) {
+		V dj = A[j][j];
+		for (size_t k = 0; k < j; ++k)
+			dj = dj - L[j][k] * L[j][k] * D[k];
+		D[j] = dj;
+		for (size_t i = j + 1; i < 5; ++i) {
+			V lij = A[j][i];
+			for (size_t k = 0; k < j; ++k)
+				lij = lij - L[i][k] * L[j][k] * D[k];
+			L[i][j] = lij / dj;
+		}
+	}
 
-	size_t iter = 0;
-	for (; iter < maxIter; ++iter) {
-		const double* lookup = d->get(d->x0[2], d->x0[3], d->x0[4]);
-		if (lookup == nullptr)
-			break;
-		double bg = d->x0[0];
-		double peak = d->x0[1];
+	for (size_t i = 0; i < 5; ++i) {
+		for (size_t k = 0; k < i; ++k)
+			b[i] = b[i] - L[i][k] * b[k];
+	}
+	for (size_t i = 0; i < 5; ++i)
+		b[i] = b[i] / D[i];
+	for (size_t i = 5; i-- > 0;) {
+		for (size_t k = i + 1; k < 5; ++k)
+			b[i] = b[i] - L[k][i] * b[k];
+	}
+#endif // NO_LAPACKE_LUT
+}
 
-		d->x1.setZero();
+// accumulates JTJ (upper triangle) and JTr of an interleaved template without storing the Jacobian
+// and returns the sum of the squared residuals, the derivative of the background is one
+template<class T>
+static inline double accumulateInterleaved(const T* lookup, const ImageU16& roi, size_t N, double bg, double peak, double A[5][5], double b[5])
+{
+	double ssq0 = 0.0;
 
 #ifdef USE_AVX_LUT
-		// intrinic set is reversed! (d3, d2, d1, d0)
-		__m256d vpeak = _mm256_set_pd(peak, peak, peak, 1.0);
-#endif
+	// intrinic set is reversed! (d3, d2, d1, d0)
+	const __m256d vpeak = _mm256_set_pd(peak, peak, peak, 1.0);
+	const __m256d vpeak1 = _mm256_set1_pd(peak);
+	__m256d vA0 = _mm256_setzero_pd();
+	__m256d vA1 = _mm256_setzero_pd();
+	__m256d vA2 = _mm256_setzero_pd();
+	__m256d vA3 = _mm256_setzero_pd();
+	__m256d vA4 = _mm256_setzero_pd();
+	__m256d vb = _mm256_setzero_pd();
+	double b0 = 0.0;
+
+	for (size_t i = 0; i < N; ++i, lookup += 4) {
+		// load 4 values (e, dx, dy, dz) from lookup table and multiply the deltas by peak
+		const __m256d vpsf = _mm256_mul_pd(vpeak, loadPixel(lookup));
+		const double e = _mm256_cvtsd_f64(vpsf);
+
+		// residual
+		const double rval = bg + peak * e - roi[i];
+		ssq0 += rval * rval;
+
+		// JTr
+		b0 += rval;
+		vb = _mm256_fmadd_pd(_mm256_set1_pd(rval), vpsf, vb);
+
+		// JTJ rows
+		vA0 = _mm256_add_pd(vA0, vpsf);
+		vA1 = _mm256_fmadd_pd(_mm256_set1_pd(e), vpsf, vA1);
+		vA2 = _mm256_fmadd_pd(_mm256_mul_pd(vpeak1, _mm256_set1_pd(double(lookup[1]))), vpsf, vA2);
+		vA3 = _mm256_fmadd_pd(_mm256_mul_pd(vpeak1, _mm256_set1_pd(double(lookup[2]))), vpsf, vA3);
+		vA4 = _mm256_fmadd_pd(_mm256_mul_pd(vpeak1, _mm256_set1_pd(double(lookup[3]))), vpsf, vA4);
+	}
 
-		double ssq0 = 0.0;
-		for (int i = 0; i < N; i++) {
-#ifdef USE_AVX_LUT
-			// load 4 double (e, dx, dy, dz) from lookup table
-			__m256d vpsf = _mm256_load_pd(lookup);
-			lookup += 4;
+	b[0] = b0;
+	_mm256_storeu_pd(&b[1], vb);
+	_mm256_storeu_pd(&A[0][1], vA0);
+	_mm256_storeu_pd(&A[1][1], vA1);
+	_mm256_storeu_pd(&A[2][1], vA2);
+	_mm256_storeu_pd(&A[3][1], vA3);
+	_mm256_storeu_pd(&A[4][1], vA4);
+#else
+	std::fill_n(b, 5, 0.0);
+	for (size_t i = 0; i < N; ++i) {
+		const double e = *lookup++;
+		const double dx = peak * (*lookup++);
+		const double dy = peak * (*lookup++);
+		const double dz = peak * (*lookup++);
+		const double h = bg + peak * e;
+
+		// residual or cost
+		const double rval = h - roi[i];
+		ssq0 += rval * rval;
+
+		// JTr
+		b[0] += rval;
+		b[1] += rval * e;
+		b[2] += rval * dx;
+		b[3] += rval * dy;
+		b[4] += rval * dz;
+
+		// JTJ
+		A[0][1] += e;
+		A[0][2] += dx;
+		A[0][3] += dy;
+		A[0][4] += dz;
+		A[1][1] += e * e;
+		A[1][2] += e * dx;
+		A[1][3] += e * dy;
+		A[1][4] += e * dz;
+		A[2][2] += dx * dx;
+		A[2][3] += dx * dy;
+		A[2][4] += dx * dz;
+		A[3][3] += dy * dy;
+		A[3][4] += dy * dz;
+		A[4][4] += dz * dz;
+	}
+#endif // USE_AVX_LUT
+	return ssq0;
+}
 
-			// residual
-			const double rval = bg + peak * vpsf.m256d_f64[0] - roi[i];
-			ssq0 += rval * rval;
+// same as accumulateInterleaved for a planar template with SIMD over the pixels,
+// the ROI pixels are supplied as double
+template<class T>
+static inline double accumulatePlanar(const T* lookup, const double* roi, size_t N, double bg, double peak, double A[5][5], double b[5])
+{
+	using SIMD::VecD;
+	constexpr size_t L = VecD::Lanes;
+
+	const VecD vbg(bg);
+	const VecD vpeak(peak);
+	VecD vA[5][5];
+	VecD vb[5];
+	VecD ssq0;
+
+	auto add = [&](const T* e0, const T* dx0, const T* dy0, const T* dz0, const double* roi0) {
+		const VecD e = VecD::load(e0);
+		const VecD dx = vpeak * VecD::load(dx0);
+		const VecD dy = vpeak * VecD::load(dy0);
+		const VecD dz = vpeak * VecD::load(dz0);
+
+		// residual
+		const VecD rval = fmadd(vpeak, e, vbg) - VecD::load(roi0);
+		ssq0 = fmadd(rval, rval, ssq0);
+
+		// JTr
+		vb[0] = vb[0] + rval;
+		vb[1] = fmadd(rval, e, vb[1]);
+		vb[2] = fmadd(rval, dx, vb[2]);
+		vb[3] = fmadd(rval, dy, vb[3]);
+		vb[4] = fmadd(rval, dz, vb[4]);
+
+		// JTJ
+		vA[0][1] = vA[0][1] + e;
+		vA[0][2] = vA[0][2] + dx;
+		vA[0][3] = vA[0][3] + dy;
+		vA[0][4] = vA[0][4] + dz;
+		vA[1][1] = fmadd(e, e, vA[1][1]);
+		vA[1][2] = fmadd(e, dx, vA[1][2]);
+		vA[1][3] = fmadd(e, dy, vA[1][3]);
+		vA[1][4] = fmadd(e, dz, vA[1][4]);
+		vA[2][2] = fmadd(dx, dx, vA[2][2]);
+		vA[2][3] = fmadd(dx, dy, vA[2][3]);
+		vA[2][4] = fmadd(dx, dz, vA[2][4]);
+		vA[3][3] = fmadd(dy, dy, vA[3][3]);
+		vA[3][4] = fmadd(dy, dz, vA[3][4]);
+		vA[4][4] = fmadd(dz, dz, vA[4][4]);
+	};
+
+	size_t i = 0;
+	for (; i + L <= N; i += L)
+		add(lookup + i, lookup + N + i, lookup + 2 * N + i, lookup + 3 * N + i, roi + i);
+
+	if (i < N) {
+		// the remaining pixels are padded with an empty template and the background,
+		// so the padding has no residual and no derivatives
+		T pad[4][L] = {};
+		double padRoi[L];
+		std::fill_n(padRoi, L, bg);
+		for (size_t j = i; j < N; ++j) {
+			for (size_t k = 0; k < 4; ++k)
+				pad[k][j - i] = lookup[k * N + j];
+			padRoi[j - i] = roi[j];
+		}
+		add(pad[0], pad[1], pad[2], pad[3], padRoi);
+	}
 
-			// multiply delta vector by peak
-			vpsf = _mm256_mul_pd(vpeak, vpsf);
+	for (size_t j = 0; j < 5; ++j) {
+		b[j] = SIMD::sum(vb[j]);
+		for (size_t k = std::max<size_t>(j, 1); k < 5; ++k)
+			A[j][k] = SIMD::sum(vA[j][k]);
+	}
+	return SIMD::sum(ssq0);
+}
 
-			// Jacobian 
-			_mm256_store_pd(&d->J(i, 1), vpsf);
+// sum of the squared residuals of an interleaved template
+template<class T>
+static inline double residualInterleaved(const T* lookup, const ImageU16& roi, size_t N, double bg, double peak)
+{
+	double ssq1 = 0.0;
+	for (size_t i = 0; i < N; i++, lookup += 4) {
+		const double rval = bg + peak * (*lookup) - roi[i];
+		ssq1 += rval * rval;
+	}
+	return ssq1;
+}
 
-			// JTr
-			__m256d vrval = _mm256_set1_pd(rval);
-			d->x1[0] += rval;
-			__m256d vx0 = _mm256_load_pd(&d->x1[1]);
-			vx0 = _mm256_fmadd_pd(vrval, vpsf, vx0);
-			_mm256_store_pd(&d->x1[1], vx0);
-#else
-			const double e = *lookup++;
-			const double dx = peak * (*lookup++);
-			const double dy = peak * (*lookup++);
-			const double dz = peak * (*lookup++);
-			const double h = bg + peak * e;
-
-			// Jacobian 
-			d->J(i, 0) = 1.0;
-			d->J(i, 1) = e;
-			d->J(i, 2) = dx;
-			d->J(i, 3) = dy;
-			d->J(i, 4) = dz;
-
-			// residual or cost
-			const double rval = h - roi[i];
-			ssq0 += rval * rval;
+// sum of the squared residuals of a planar template, only the e plane is read
+template<class T>
+static inline double residualPlanar(const T* e, const double* roi, size_t N, double bg, double peak)
+{
+	using SIMD::VecD;
+	constexpr size_t L = VecD::Lanes;
+
+	VecD vssq;
+	size_t i = 0;
+	for (; i + L <= N; i += L) {
+		const VecD rval = fmadd(VecD(peak), VecD::load(e + i), VecD(bg)) - VecD::load(roi + i);
+		vssq = fmadd(rval, rval, vssq);
+	}
 
-			// JTr
-			d->x1[0] += rval;
-			d->x1[1] += rval * e;
-			d->x1[2] += rval * dx;
-			d->x1[3] += rval * dy;
-			d->x1[4] += rval * dz;
-#endif
-		}
+	double ssq1 = SIMD::sum(vssq);
+	for (; i < N; ++i) {
+		const double rval = bg + peak * e[i] - roi[i];
+		ssq1 += rval * rval;
+	}
+	return ssq1;
+}
 
-		//if (BLAS::dgemm(BLAS::CblasTrans, BLAS::CblasNoTrans, 1.0, d->J, d->J, 0.0, d->JTJ) != LIN_SUCCESS) break;
-		if (BLAS::dsyrk(BLAS::CblasUpper, BLAS::CblasTrans, 1.0, d->J, 0.0, d->JTJ) != LIN_SUCCESS) break;
+template<class T>
+bool FitterPrivate::fit(const ImageU16& roi, Molecule& mol, FitterWorkspacePrivate* w) const
+{
+	const size_t startLat = winSize / 2;
+	double x0[5] = { mol.background, mol.peak, double(startLat), double(startLat), 0.0 };
+	double x1[5];
+
+	const size_t N = winSize * winSize;
+
+	const size_t iterations = maxIter.load();
+	const double eps = epsilon.load();
+
+	const bool interp = interpolation.load();
+	const bool planar = (layout == Layout::Planar);
+
+	// a template is only needed until the next one is looked up
+	const size_t size = bufferSize(interp);
+	T* buffer = (size > 0) ? w->templateBuffer<T>(size) : nullptr;
+	auto templateAt = [this, interp, buffer](double x, double y, double z) {
+		return interp ? interpolate<T>(x, y, z, buffer) : get<T>(x, y, z, buffer);
+	};
+
+	// the planar templates are fitted with SIMD over the pixels, which are loaded as double
+	const double* pixels = nullptr;
+	if (planar) {
+		w->roiLanes.resize(N);
+		for (size_t i = 0; i < N; ++i)
+			w->roiLanes[i] = roi[i];
+		pixels = w->roiLanes.data();
+	}
 
-#ifdef NO_LAPACKE_LUT
-		if (BLAS::dtrsv(BLAS::CblasUpper, BLAS::CblasTrans, BLAS::CblasNonUnit, d->JTJ, d->x1) != LIN_SUCCESS)
-			break;
-#else
-		int ipiv[5];
-		if (LAPACKE::dsysv(LAPACKE::U, d->JTJ, ipiv, d->x1) != 0)
+	size_t iter = 0;
+	for (; iter < iterations; ++iter) {
+		const T* lookup = templateAt(x0[2], x0[3], x0[4]);
+		if (lookup == nullptr)
 			break;
-#endif // NO_LAPACKE_LUT
+		double bg = x0[0];
+		double peak = x0[1];
 
-		/*double delta = 0.0;
-		for (int i = 0; i < 5; ++i)
-			delta += std::abs(d->x1[i]);
+		double A[5][5] = {};
+		const double ssq0 = planar ? accumulatePlanar(lookup, pixels, N, bg, peak, A, x1)
+								   : accumulateInterleaved(lookup, roi, N, bg, peak, A, x1);
+		A[0][0] = double(N);
 
-		if (delta < 1E-3) {
-			std::cout << "Too small change!" << std::endl;
-			break;
-		}*/
+		solveNormalEquations(A, x1);
 
-		double xNew = d->x0[2] - d->x1[2];
-		double yNew = d->x0[3] - d->x1[3];
-		double zNew = d->x0[4] - d->x1[4];
+		double xNew = x0[2] - x1[2];
+		double yNew = x0[3] - x1[3];
+		double zNew = x0[4] - x1[4];
 
-		lookup = d->get(xNew, yNew, zNew);
+		lookup = templateAt(xNew, yNew, zNew);
 		if (lookup == nullptr)
 			break;
 
-		bg -= d->x1[0];
-		peak -= d->x1[1];
+		bg -= x1[0];
+		peak -= x1[1];
 
-		double ssq1 = 0.0;
-		for (int i = 0; i < N; i++, lookup += 4) {
-			const double rval = bg + peak * (*lookup) - roi[i];
-			ssq1 += rval * rval;
-		}
+		const double ssq1 = planar ? residualPlanar(lookup, pixels, N, bg, peak)
+								   : residualInterleaved(lookup, roi, N, bg, peak);
 
 		if ((ssq1 < ssq0) && ((ssq0 - ssq1) > eps)) {
-			d->x0 -= d->x1; 
+			for (size_t k = 0; k < 5; ++k)
+				x0[k] -= x1[k];
 		} else {
 			break;
 		}
 	}
 
-	if ((iter == 0) || (d->x0[0] < 0.0) || (d->x0[1] < 0.0) || (d->x0[0] > 13000.0) || (d->x0[1] > 65536.0) ||
-		cmp(d->x0[2], startLat) || cmp(d->x0[3], startLat) || (d->x0[4] == 0.0)) {
-		//std::cout << "Val error (iter:" << iter << ",bg:" << d->x0[0] << ",I:" << d->x0[1] << std::endl;
+	return finish(x0, iter, interp, mol);
+}
+
+template<class T>
+size_t FitterPrivate::fitLanes(const ImageU16* rois, Molecule* mols, size_t count, bool* success, FitterWorkspacePrivate* w) const
+{
+	using SIMD::VecD;
+	constexpr size_t L = VecD::Lanes;
+
+	const size_t N = winSize * winSize;
+	const size_t startLat = winSize / 2;
+
+	// distance of the pixels and of the values (e, dx, dy, dz) of a pixel in the template
+	const size_t step = (layout == Layout::Planar) ? 1 : 4;
+	const size_t plane = (layout == Layout::Planar) ? N : 1;
+
+	const bool interp = interpolation.load();
+
+	// the templates of a lazy LUT or the interpolated ones are stored in a buffer per lane
+	const size_t size = bufferSize(interp);
+	T* buffer = (size > 0) ? w->templateBuffer<T>(L * size) : nullptr;
+	const T* data = (size > 0) ? buffer : tablePtr<T>();
+
+	// Gauss-Newton variables of each lane (structure of arrays)
+	double x0[5][L];
+	double x1[5][L];
+	double ssq[2][L];
+	int64_t offsets[L];
+	size_t iters[L];
+	bool active[L];
+
+	// copy the ROIs interleaved by lane, unused lanes repeat the first ROI
+	w->roiLanes.resize(N * L);
+	for (size_t l = 0; l < L; ++l) {
+		const ImageU16& roi = rois[l < count ? l : 0];
+		active[l] = (l < count) && (size_t(roi.width()) == winSize) && (size_t(roi.height()) == winSize);
+		iters[l] = 0;
+		offsets[l] = 0;
+		x0[0][l] = (l < count) ? mols[l].background : 0.0;
+		x0[1][l] = (l < count) ? mols[l].peak : 0.0;
+		x0[2][l] = startLat;
+		x0[3][l] = startLat;
+		x0[4][l] = 0.0;
+		if (!active[l])
+			continue;
+
+		double* dst = w->roiLanes.data() + l;
+		for (int y = 0; y < roi.height(); ++y) {
+			const uint16_t* line = roi.scanLine(y);
+			for (int x = 0; x < roi.width(); ++x, dst += L)
+				*dst = line[x];
+		}
+	}
+
+	// sets the template offsets of the active lanes, lanes outside of the LUT are finished
+	auto lookup = [&](size_t iter, bool step) {
+		bool any = false;
+		for (size_t l = 0; l < L; ++l) {
+			if (!active[l])
+				continue;
+			T* laneBuffer = (size > 0) ? buffer + l * size : nullptr;
+			const double x = step ? x0[2][l] - x1[2][l] : x0[2][l];
+			const double y = step ? x0[3][l] - x1[3][l] : x0[3][l];
+			const double z = step ? x0[4][l] - x1[4][l] : x0[4][l];
+			const T* ptr = interp ? interpolate<T>(x, y, z, laneBuffer) : get<T>(x, y, z, laneBuffer);
+			if (ptr == nullptr) {
+				active[l] = false;
+				iters[l] = iter;
+			} else {
+				offsets[l] = ptr - data;
+				any = true;
+			}
+		}
+		return any;
+	};
+
+	const size_t iterations = maxIter.load();
+	const double eps = epsilon.load();
+
+	size_t iter = 0;
+	for (; iter < iterations; ++iter) {
+		if (!lookup(iter, false))
+			break;
+
+		const VecD bg = VecD::load(x0[0]);
+		const VecD peak = VecD::load(x0[1]);
+
+		// JTJ (upper triangle) and JTr accumulated without storing the Jacobian
+		VecD A[5][5];
+		VecD b[5];
+		VecD ssq0;
+		const double* roi = w->roiLanes.data();
+		for (size_t i = 0; i < N; ++i, roi += L) {
+			const T* pixel = data + step * i;
+			const VecD e = VecD::gather(pixel, offsets);
+			const VecD dx = peak * VecD::gather(pixel + plane, offsets);
+			const VecD dy = peak * VecD::gather(pixel + 2 * plane, offsets);
+			const VecD dz = peak * VecD::gather(pixel + 3 * plane, offsets);
+
+			// residual
+			const VecD rval = fmadd(peak, e, bg) - VecD::load(roi);
+			ssq0 = fmadd(rval, rval, ssq0);
+
+			// JTr
+			b[0] = b[0] + rval;
+			b[1] = fmadd(rval, e, b[1]);
+			b[2] = fmadd(rval, dx, b[2]);
+			b[3] = fmadd(rval, dy, b[3]);
+			b[4] = fmadd(rval, dz, b[4]);
+
+			// JTJ, the derivative of the background is one
+			A[0][1] = A[0][1] + e;
+			A[0][2] = A[0][2] + dx;
+			A[0][3] = A[0][3] + dy;
+			A[0][4] = A[0][4] + dz;
+			A[1][1] = fmadd(e, e, A[1][1]);
+			A[1][2] = fmadd(e, dx, A[1][2]);
+			A[1][3] = fmadd(e, dy, A[1][3]);
+			A[1][4] = fmadd(e, dz, A[1][4]);
+			A[2][2] = fmadd(dx, dx, A[2][2]);
+			A[2][3] = fmadd(dx, dy, A[2][3]);
+			A[2][4] = fmadd(dx, dz, A[2][4]);
+			A[3][3] = fmadd(dy, dy, A[3][3]);
+			A[3][4] = fmadd(dy, dz, A[3][4]);
+			A[4][4] = fmadd(dz, dz, A[4][4]);
+		}
+		A[0][0] = VecD(double(N));
+
+		solveNormalEquations(A, b);
+		for (size_t k = 0; k < 5; ++k)
+			b[k].store(x1[k]);
+
+		if (!lookup(iter, true))
+			break;
+
+		const VecD bg1 = bg - b[0];
+		const VecD peak1 = peak - b[1];
+
+		VecD ssq1;
+		roi = w->roiLanes.data();
+		for (size_t i = 0; i < N; ++i, roi += L) {
+			const VecD rval = fmadd(peak1, VecD::gather(data + step * i, offsets), bg1) - VecD::load(roi);
+			ssq1 = fmadd(rval, rval, ssq1);
+		}
+		ssq0.store(ssq[0]);
+		ssq1.store(ssq[1]);
+
+		for (size_t l = 0; l < L; ++l) {
+			if (!active[l])
+				continue;
+			if ((ssq[1][l] < ssq[0][l]) && ((ssq[0][l] - ssq[1][l]) > eps)) {
+				for (size_t k = 0; k < 5; ++k)
+					x0[k][l] -= x1[k][l];
+			} else {
+				active[l] = false;
+				iters[l] = iter;
+			}
+		}
+	}
+
+	size_t fitted = 0;
+	for (size_t l = 0; l < count; ++l) {
+		const double x[5] = { x0[0][l], x0[1][l], x0[2][l], x0[3][l], x0[4][l] };
+		success[l] = finish(x, active[l] ? iter : iters[l], interp, mols[l]);
+		if (success[l])
+			++fitted;
+	}
+	return fitted;
+}
+
+bool FitterPrivate::finish(const double* x, size_t iter, bool interp, Molecule& mol) const
+{
+	const size_t startLat = winSize / 2;
+	if ((iter == 0) || (x[0] < 0.0) || (x[1] < 0.0) || (x[0] > 13000.0) || (x[1] > 65536.0) ||
+		cmp(x[2], startLat) || cmp(x[3], startLat) || (x[4] == 0.0)) {
+		//std::cout << "Val error (iter:" << iter << ",bg:" << x[0] << ",I:" << x[1] << std::endl;
 		return false;
 	}
 
-	d->x0[2] -= fmod(d->x0[2], d->dLat);
-	d->x0[3] -= fmod(d->x0[3], d->dLat);
-	d->x0[4] -= fmod(d->x0[4], d->dAx);
+	// the interpolated templates do not limit the position to the grid
+	const double xPos = interp ? x[2] : x[2] - fmod(x[2], dLat);
+	const double yPos = interp ? x[3] : x[3] - fmod(x[3], dLat);
+	const double zPos = interp ? x[4] : x[4] - fmod(x[4], dAx);
 
-	if (!isValid(d->x0[2], d->x0[3], d->x0[4])) {
+	if (!isValid(xPos, yPos, zPos)) {
 		//std::cout << "Invalid position error" << std::endl;
 		return false;
 	}
 
-	mol.background = d->x0[0];
-	mol.peak = d->x0[1];
-	mol.x = d->x0[2];
-	mol.y = d->x0[3];
-	mol.z = d->x0[4];
+	mol.background = x[0];
+	mol.peak = x[1];
+	mol.x = xPos;
+	mol.y = yPos;
+	mol.z = zPos;
 
 	return true;
 }
 
-bool Fitter::setLookUpTable(const double* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx)
+FitterWorkspace::FitterWorkspace()
+	: d(new FitterWorkspacePrivate)
 {
-	const double borderLat = std::floor((windowSize - rangeLat) / 2);
-	if (borderLat < 1.0) {
-		std::cerr << "LookUpSTORd->CPPDLL: setLookUpTable: Lateral border is less than one! (Lateral range: " << rangeLat << ")" << std::endl;
-		return false;
+}
+
+FitterWorkspace::~FitterWorkspace()
+{
+	delete d;
+}
+
+Fitter::Fitter()
+	: d(new FitterPrivate)
+{
+}
+
+Fitter::~Fitter()
+{
+	delete d;
+}
+
+void Fitter::release()
+{
+	d->releaseTable();
+	d->workspace.d->roiLanes = {};
+	d->workspace.d->templates = {};
+	d->workspace.d->templatesF32 = {};
+	d->countIndex = 0;
+	d->winSize = 0;
+}
+
+bool Fitter::isReady() const
+{
+	return d->hasTable() && (d->countIndex > 1);
+}
+
+bool Fitter::fitSingle(const ImageU16& roi, Molecule& mol)
+{
+	return fitSingle(roi, mol, d->workspace);
+}
+
+bool Fitter::fitSingle(const ImageU16& roi, Molecule& mol, FitterWorkspace& workspace) const
+{
+	// the single fit keeps all variables on the stack, only the templates of a lazy LUT are copied
+	if (d->precision == Precision::Float)
+		return d->fit<float>(roi, mol, workspace.d);
+	return d->fit<double>(roi, mol, workspace.d);
+}
+
+size_t Fitter::fitBatch(const ImageU16* rois, Molecule* mols, size_t n, bool* success)
+{
+	return fitBatch(rois, mols, n, success, d->workspace);
+}
+
+size_t Fitter::fitBatch(const ImageU16* rois, Molecule* mols, size_t n, bool* success, FitterWorkspace& workspace) const
+{
+	constexpr size_t L = SIMD::VecD::Lanes;
+	bool laneSuccess[L];
+
+	size_t fitted = 0;
+	for (size_t i = 0; i < n; i += L) {
+		const size_t count = std::min(L, n - i);
+		bool* s = (success != nullptr) ? success + i : laneSuccess;
+		if (d->precision == Precision::Float)
+			fitted += d->fitLanes<float>(rois + i, mols + i, count, s, workspace.d);
+		else
+			fitted += d->fitLanes<double>(rois + i, mols + i, count, s, workspace.d);
 	}
+	return fitted;
+}
 
-	if ((d->lookup != nullptr) && d->tableAllocated)
-		release();
+size_t Fitter::batchLanes()
+{
+	return SIMD::VecD::Lanes;
+}
+bool FitterPrivate::setGeometry(size_t dataSize, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx, Compression compression)
+{
+	const double borderLat = std::floor((windowSize - rangeLat) / 2);
 
-	d->lookup = data;
-	d->tableAllocated = allocated;
-	d->winSize = windowSize;
+	winSize = windowSize;
 
-	d->dLat = dLat;
-	d->dAx = dAx;
+	this->dLat = dLat;
+	this->dAx = dAx;
 
-	d->minLat = borderLat;
-	d->maxLat = windowSize - borderLat;
-	d->minAx = -rangeAx * 0.5;
-	d->maxAx = rangeAx * 0.5;
-	d->countLat = static_cast<size_t>(std::floor((((d->maxLat - d->minLat) / dLat) + 1)));
-	d->countAx = static_cast<size_t>(std::floor(((rangeAx / dAx) + 1)));
+	minLat = borderLat;
+	maxLat = windowSize - borderLat;
+	minAx = -rangeAx * 0.5;
+	maxAx = rangeAx * 0.5;
+	countLat = static_cast<size_t>(std::floor((((maxLat - minLat) / dLat) + 1)));
+	countAx = static_cast<size_t>(std::floor(((rangeAx / dAx) + 1)));
 
-	d->countIndex = d->countLat * d->countLat * d->countAx;
+	countIndex = countLat * countLat * countAx;
 
-	d->stride = d->winSize * d->winSize * 4;
+	stride = winSize * winSize * 4;
 
-	const size_t expected = d->countIndex * d->stride;
+	this->compression = compression;
+	size_t stored = countIndex;
+	if (compression == Compression::Symmetry) {
+		if (!symmetry.setup(winSize, countLat, minLat, dLat)) {
+			std::cerr << "LookUpSTORM_CPPDLL: setLookUpTable: Mirrored positions are not on the grid of the compressed LUT!" << std::endl;
+			this->compression = Compression::None;
+			return false;
+		}
+		stored = symmetry.slots() * symmetry.slots() * countAx;
+	}
+
+	const size_t expected = stored * stride;
 	if (dataSize != expected) {
-		std::cerr << "LookUpSTORd->CPPDLL: setLookUpTable: Template size does not correspond to the supplied array!" 
+		std::cerr << "LookUpSTORM_CPPDLL: setLookUpTable: Template size does not correspond to the supplied array!" 
 				  << "(expected: " << expected << ", got: " << dataSize << ")" << std::endl;
 		return false;
 	}
 
-	const size_t N = size_t(windowSize) * size_t(windowSize);
-	d->J = Matrix(N, 5, 1.0);
+	return true;
+}
+
+// assigns the array to the pointer of its precision
+static inline void assignTable(FitterPrivate* d, const double* data)
+{
+	d->table = data;
+	d->precision = Precision::Double;
+}
+
+static inline void assignTable(FitterPrivate* d, const float* data)
+{
+	d->tableF32 = data;
+	d->precision = Precision::Float;
+}
+
+template<class T>
+bool FitterPrivate::setTable(const T* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+	Layout layout, Compression compression, const std::vector<double>* templateSums)
+{
+	const double borderLat = std::floor((windowSize - rangeLat) / 2);
+	if (borderLat < 1.0) {
+		std::cerr << "LookUpSTORM_CPPDLL: setLookUpTable: Lateral border is less than one! (Lateral range: " << rangeLat << ")" << std::endl;
+		return false;
+	}
+
+	releaseTable();
+	assignTable(this, data);
+	this->layout = layout;
+	tableAllocated = allocated;
+
+	if (!setGeometry(dataSize, windowSize, dLat, dAx, rangeLat, rangeAx, compression))
+		return false;
+
+	const size_t stored = dataSize / stride;
+	if ((templateSums != nullptr) && (templateSums->size() == stored)) {
+		sums = std::make_shared<const std::vector<double>>(*templateSums);
+		return true;
+	}
 
+	// one pass over the PSF values of the array
+	const size_t n = winSize * winSize;
+	const size_t step = (layout == Layout::Planar) ? 1 : 4;
+	std::vector<double> s(stored);
+	for (size_t i = 0; i < stored; ++i) {
+		const T* pixels = data + i * stride;
+		double sum = 0.0;
+		for (size_t j = 0; j < n; ++j)
+			sum += pixels[j * step];
+		s[i] = sum;
+	}
+	sums = std::make_shared<const std::vector<double>>(std::move(s));
 	return true;
 }
 
+bool Fitter::setLookUpTable(const double* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx, Layout layout, Compression compression)
+{
+	if (d->hasTable() && d->tableAllocated)
+		release();
+	return d->setTable(data, dataSize, allocated, windowSize, dLat, dAx, rangeLat, rangeAx, layout, compression, nullptr);
+}
+
+bool Fitter::setLookUpTable(const float* data, size_t dataSize, bool allocated, int windowSize, double dLat, double dAx, double rangeLat, double rangeAx, Layout layout, Compression compression)
+{
+	if (d->hasTable() && d->tableAllocated)
+		release();
+	return d->setTable(data, dataSize, allocated, windowSize, dLat, dAx, rangeLat, rangeAx, layout, compression, nullptr);
+}
+
 bool LookUpSTORM::Fitter::setLookUpTable(const LUT& lut)
 {
 	if (!lut.isValid())
 		return false;
-	return setLookUpTable(lut.ptr(), lut.dataSize(), true, lut.windowSize(), lut.dLat(), lut.dAx(), lut.rangeLat(), lut.rangeAx());
+	if (d->hasTable() && d->tableAllocated)
+		release();
+	// the LUT already summed its templates during the generation
+	if (lut.precision() == Precision::Float)
+		return d->setTable(lut.ptrF32(), lut.dataSize(), true, int(lut.windowSize()), lut.dLat(), lut.dAx(), lut.rangeLat(), lut.rangeAx(), 
+			lut.layout(), lut.compression(), &lut.templateSums());
+	return d->setTable(lut.ptr(), lut.dataSize(), true, int(lut.windowSize()), lut.dLat(), lut.dAx(), lut.rangeLat(), lut.rangeAx(), 
+		lut.layout(), lut.compression(), &lut.templateSums());
+}
+
+bool Fitter::setLazyLookUpTable(const LUT& lut, size_t cacheBytes)
+{
+	const size_t windowSize = lut.windowSize();
+	const size_t stride = windowSize * windowSize * 4;
+	if ((windowSize == 0) || (lut.dataSize() == 0)) {
+		std::cerr << "LookUpSTORM_CPPDLL: setLazyLookUpTable: LUT is not set up!" << std::endl;
+		return false;
+	}
+
+	// the first template checks if the LUT can draw single templates
+	std::vector<double> pixels(stride);
+	if (!lut.drawTemplate(0, pixels.data())) {
+		std::cerr << "LookUpSTORM_CPPDLL: setLazyLookUpTable: LUT does not support drawing single templates!" << std::endl;
+		return false;
+	}
+
+	if (d->hasTable() && d->tableAllocated)
+		release();
+
+	d->releaseTable();
+	d->cache = std::make_shared<TemplateCache>(stride, cacheBytes / (stride * sizeof(double)),
+		[&lut](size_t index, double* pixels) { return lut.drawTemplate(index, pixels); }
+	);
+	d->precision = Precision::Double;
+	d->layout = lut.layout();
+
+	return d->setGeometry(lut.dataSize(), int(windowSize), lut.dLat(), lut.dAx(), lut.rangeLat(), lut.rangeAx(), lut.compression());
+}
+
+bool Fitter::isLazy() const
+{
+	return bool(d->cache);
+}
+
+Precision Fitter::precision() const
+{
+	return d->precision;
+}
+
+Layout Fitter::layout() const
+{
+	return d->layout;
+}
+
+Compression Fitter::compression() const
+{
+	return d->compression;
 }
 
 const double* Fitter::lookUpTablePtr() const
 {
-	return d->lookup;
+	return d->table;
+}
+
+const float* Fitter::lookUpTablePtrF32() const
+{
+	return d->tableF32;
 }
 
 const double* LookUpSTORM::Fitter::templatePtr(double x, double y, double z) const
 {
-	return d->get(x, y, z);
+	return d->get<double>(x, y, z);
+}
+
+const float* Fitter::templatePtrF32(double x, double y, double z) const
+{
+	return d->get<float>(x, y, z);
+}
+
+template<class T>
+static bool copyTemplate(const FitterPrivate* d, double x, double y, double z, double* pixels)
+{
+	const bool interp = d->interpolation.load();
+	std::vector<T> buffer(d->bufferSize(interp));
+	T* ptr = buffer.empty() ? nullptr : buffer.data();
+	const T* templ = interp ? d->interpolate<T>(x, y, z, ptr) : d->get<T>(x, y, z, ptr);
+	if (templ == nullptr)
+		return false;
+	std::copy_n(templ, d->stride, pixels);
+	return true;
+}
+
+bool Fitter::copyTemplate(double x, double y, double z, double* pixels) const
+{
+	if (d->precision == Precision::Float)
+		return ::copyTemplate<float>(d, x, y, z, pixels);
+	return ::copyTemplate<double>(d, x, y, z, pixels);
+}
+
+bool Fitter::templateSum(double x, double y, double z, double& sum) const
+{
+	return d->templateSum(x, y, z, d->interpolation.load(), sum);
 }
 
 size_t Fitter::windowSize() const
@@ -424,6 +1260,16 @@ size_t Fitter::maxIter() const
 	return d->maxIter.load();
 }
 
+void Fitter::setInterpolation(bool enabled)
+{
+	d->interpolation.store(enabled);
+}
+
+bool Fitter::interpolation() const
+{
+	return d->interpolation.load();
+}
+
 constexpr bool Fitter::isValid(double x, double y, double z) const
 {
 	return d->isValid(x, y, z);
@@ -0,0 +1,265 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "FramePipeline.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace LookUpSTORM;
+
+// the producers do not lock the mutex, so a missed notification is caught by the timeout
+static constexpr std::chrono::milliseconds WAKE_UP_INTERVAL(1);
+
+FramePipeline::FramePipeline()
+	: m_nextPoll(0)
+	, m_pending(0)
+	, m_running(false)
+	, m_producers(0)
+	, m_dropped(0)
+	, m_processed(0)
+	, m_maxOccupancy(0)
+	, m_waitNS(0)
+{
+}
+
+FramePipeline::~FramePipeline()
+{
+	stop();
+}
+
+void FramePipeline::start(size_t workers, Process process, size_t capacity)
+{
+	stop();
+
+	workers = std::max<size_t>(1, workers);
+	if (capacity == 0)
+		capacity = std::max<size_t>(16, 4 * workers);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_ring.reset(new FrameRing(capacity));
+	m_process = process;
+	m_nextPoll = 0;
+	m_pending = 0;
+	m_dropped = 0;
+	m_processed = 0;
+	m_maxOccupancy = 0;
+	m_waitNS = 0;
+	m_running = true;
+	m_threads.reserve(workers);
+	for (size_t i = 0; i < workers; ++i)
+		m_threads.emplace_back(&FramePipeline::run, this, i);
+}
+
+void FramePipeline::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_jobAvailable.notify_all();
+	m_slotAvailable.notify_all();
+	m_resultAvailable.notify_all();
+	for (auto& t : m_threads)
+		t.join();
+	m_threads.clear();
+
+	// producers already within submit finish their frame
+	while (m_producers.load() > 0)
+		std::this_thread::yield();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_ring)
+		m_ring->reset();
+	m_results.clear();
+	m_nextPoll = 0;
+	m_pending = 0;
+}
+
+bool FramePipeline::isRunning() const
+{
+	return m_running.load();
+}
+
+size_t FramePipeline::workers() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_threads.size();
+}
+
+bool FramePipeline::submit(const ImageU16& image, int frame, bool wait)
+{
+	if (image.isNull())
+		return false;
+
+	// copy line by line since the image could be a sub image with a stride
+	return submit(image.width(), image.height(), frame, [&image](uint16_t* pixels) {
+		for (int y = 0; y < image.height(); ++y)
+			std::copy_n(image.scanLine(y), image.width(), pixels + size_t(y) * image.width());
+	}, wait);
+}
+
+bool FramePipeline::submit(int width, int height, int frame, const Fill& fill, bool wait)
+{
+	if ((width <= 0) || (height <= 0))
+		return false;
+
+	m_producers.fetch_add(1);
+	if (!m_running.load()) {
+		m_producers.fetch_sub(1);
+		return false;
+	}
+
+	uint64_t position = 0;
+	bool acquired = acquire();
+	FrameRing::Slot* slot = acquired ? m_ring->reserve(width, height, frame, position) : nullptr;
+	if ((slot == nullptr) && wait) {
+		const auto t0 = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_running) {
+			if (!acquired)
+				acquired = acquire();
+			if (acquired && ((slot = m_ring->reserve(width, height, frame, position)) != nullptr))
+				break;
+			m_slotAvailable.wait_for(lock, WAKE_UP_INTERVAL);
+		}
+		const auto t1 = std::chrono::steady_clock::now();
+		m_waitNS.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()));
+	}
+
+	if (slot == nullptr) {
+		if (acquired)
+			m_pending.fetch_sub(1);
+		if (!wait)
+			m_dropped.fetch_add(1);
+		m_producers.fetch_sub(1);
+		return false;
+	}
+
+	fill(slot->pixels.data());
+	m_ring->publish(slot, position);
+
+	// high-water mark of the frames in the queue or with unpolled results
+	const uint64_t occupancy = m_pending.load();
+	uint64_t max = m_maxOccupancy.load();
+	while ((occupancy > max) && !m_maxOccupancy.compare_exchange_weak(max, occupancy)) {}
+
+	m_producers.fetch_sub(1);
+	m_jobAvailable.notify_one();
+	return true;
+}
+
+bool FramePipeline::poll(FrameResult& result, bool wait)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_ring || (m_nextPoll == m_ring->reserved()))
+		return false;
+
+	auto it = m_results.find(m_nextPoll);
+	if (it == m_results.end()) {
+		if (!wait)
+			return false;
+		m_resultAvailable.wait(lock, [this, &it]() {
+			it = m_results.find(m_nextPoll);
+			return !m_running || (it != m_results.end());
+		});
+		if (it == m_results.end())
+			return false;
+	}
+
+	result = std::move(it->second);
+	m_results.erase(it);
+	++m_nextPoll;
+	m_pending.fetch_sub(1);
+	m_slotAvailable.notify_one();
+	return true;
+}
+
+size_t FramePipeline::pending() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_ring ? static_cast<size_t>(m_ring->reserved() - m_nextPoll) : 0;
+}
+
+PipelineStats FramePipeline::stats() const
+{
+	PipelineStats stats;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_ring)
+		return stats;
+	stats.submitted = m_ring->reserved();
+	stats.dropped = m_dropped.load();
+	stats.processed = m_processed.load();
+	stats.capacity = m_ring->capacity();
+	stats.occupancy = m_pending.load();
+	stats.maxOccupancy = static_cast<size_t>(m_maxOccupancy.load());
+	stats.waitMS = m_waitNS.load() * 1E-6;
+	return stats;
+}
+
+bool FramePipeline::acquire()
+{
+	const size_t capacity = m_ring->capacity();
+	size_t pending = m_pending.load();
+	while (pending < capacity) {
+		if (m_pending.compare_exchange_weak(pending, pending + 1))
+			return true;
+	}
+	return false;
+}
+
+void FramePipeline::run(size_t worker)
+{
+	for (;;) {
+		if (!m_running)
+			return;
+
+		uint64_t position = 0;
+		FrameRing::Slot* slot = m_ring->take(position);
+		if (slot == nullptr) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobAvailable.wait_for(lock, WAKE_UP_INTERVAL, [this]() { return !m_running || m_ring->hasPublished(); });
+			continue;
+		}
+
+		// the frame is fitted in the buffer of the queue
+		FrameResult result;
+		result.frame = slot->frame;
+		m_process(worker, ImageU16(slot->width, slot->height, slot->pixels.data(), false), slot->frame, result);
+		m_ring->release(slot, position);
+		m_processed.fetch_add(1);
+		m_slotAvailable.notify_one();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_results.emplace(position, std::move(result));
+		}
+		m_resultAvailable.notify_all();
+	}
+}
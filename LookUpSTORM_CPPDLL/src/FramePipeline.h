@@ -0,0 +1,140 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include <vector>
+#include <map>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "Common.h"
+#include "Image.h"
+#include "FrameRing.h"
+
+namespace LookUpSTORM
+{
+
+// result of a single frame processed by a worker of the pipeline
+struct FrameResult
+{
+	int frame = 0;
+	// false if the frame fitting was aborted by the timeout
+	bool success = false;
+	// accepted localizations in image coordinates
+	std::vector<Molecule> molecules;
+	// all fitted canidates (including rejected ones), only collected for auto thresholding
+	std::vector<Molecule> canidates;
+	// statistics of the pixel values of the frame
+	ImageStats stats;
+	double fittingTimeMS = 0.0;
+};
+
+/*
+ * class FramePipeline
+ * Pool of worker threads that process submitted frames in parallel. The frames are
+ * queued in a bounded lock-free ring of frame buffers, so a producer never waits for
+ * a lock, and the workers fit them in place. The results are returned in the same
+ * order as the frames were submitted.
+ */
+class FramePipeline
+{
+public:
+	// called by the worker thread with its index to process a frame
+	using Process = std::function<void(size_t worker, ImageU16 image, int frame, FrameResult& result)>;
+	// writes the pixels of a frame into the queued buffer (width * height)
+	using Fill = std::function<void(uint16_t* pixels)>;
+
+	FramePipeline();
+	~FramePipeline();
+
+	// starts the worker threads with a queue of capacity frames (0 uses 4 per worker,
+	// at least 16), stops already running workers first. A frame counts against the
+	// capacity until its result is polled, so unpolled results do not grow unbounded
+	void start(size_t workers, Process process, size_t capacity = 0);
+	// waits until all worker threads are finished, unprocessed frames and results are discarded
+	void stop();
+
+	// thread-safe
+	bool isRunning() const;
+	// thread-safe
+	size_t workers() const;
+
+	// thread-safe, copies the image into a free buffer of the queue. If the queue is full
+	// (including the results not polled yet) the call waits for a free buffer or the frame
+	// is dropped if wait is false.
+	bool submit(const ImageU16& image, int frame, bool wait = true);
+	// thread-safe, same as submit, but fill writes the pixels directly into the buffer
+	bool submit(int width, int height, int frame, const Fill& fill, bool wait);
+
+	// thread-safe, returns the result of the next frame in submission order
+	// if wait is true the call blocks until the result is available
+	// returns false if no result is available (or no frame is pending)
+	bool poll(FrameResult& result, bool wait);
+
+	// thread-safe, returns the number of submitted frames without polled result
+	size_t pending() const;
+
+	// thread-safe, statistics of the queue since start
+	PipelineStats stats() const;
+
+private:
+	void run(size_t worker);
+	// reserves a place of the capacity for a frame and its result
+	bool acquire();
+
+	std::unique_ptr<FrameRing> m_ring;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_jobAvailable;
+	std::condition_variable m_slotAvailable;
+	std::condition_variable m_resultAvailable;
+	std::vector<std::thread> m_threads;
+	std::map<uint64_t, FrameResult> m_results;
+	Process m_process;
+	uint64_t m_nextPoll;
+	// submitted frames without polled result, bounded by the capacity
+	std::atomic<size_t> m_pending;
+	std::atomic<bool> m_running;
+	// producers within submit, the ring is only cleared without producers
+	std::atomic<size_t> m_producers;
+	std::atomic<uint64_t> m_dropped;
+	std::atomic<uint64_t> m_processed;
+	std::atomic<uint64_t> m_maxOccupancy;
+	std::atomic<uint64_t> m_waitNS;
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !FRAMEPIPELINE_H
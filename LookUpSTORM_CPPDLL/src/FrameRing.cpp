@@ -0,0 +1,137 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "FrameRing.h"
+
+using namespace LookUpSTORM;
+
+FrameRing::FrameRing(size_t capacity)
+	: m_mask(0)
+	, m_enqueue(0)
+	, m_dequeue(0)
+	, m_released(0)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_slots.reset(new Slot[size]);
+	m_mask = size - 1;
+	reset();
+}
+
+size_t FrameRing::capacity() const
+{
+	return m_mask + 1;
+}
+
+FrameRing::Slot* FrameRing::reserve(int width, int height, int frame, uint64_t& position)
+{
+	uint64_t pos = m_enqueue.load(std::memory_order_relaxed);
+	Slot* slot = nullptr;
+	for (;;) {
+		slot = &m_slots[pos & m_mask];
+		const uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+		const int64_t diff = int64_t(seq) - int64_t(pos);
+		if (diff == 0) {
+			if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// the slot of the previous round is not released yet
+			return nullptr;
+		} else {
+			pos = m_enqueue.load(std::memory_order_relaxed);
+		}
+	}
+
+	// the buffer only grows, so a constant frame size allocates once per slot
+	const size_t size = size_t(width) * size_t(height);
+	if (slot->pixels.size() < size)
+		slot->pixels.resize(size);
+	slot->frame = frame;
+	slot->width = width;
+	slot->height = height;
+	position = pos;
+	return slot;
+}
+
+void FrameRing::publish(Slot* slot, uint64_t position)
+{
+	slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+FrameRing::Slot* FrameRing::take(uint64_t& position)
+{
+	uint64_t pos = m_dequeue.load(std::memory_order_relaxed);
+	for (;;) {
+		Slot* slot = &m_slots[pos & m_mask];
+		const uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+		const int64_t diff = int64_t(seq) - int64_t(pos + 1);
+		if (diff == 0) {
+			if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				position = pos;
+				return slot;
+			}
+		} else if (diff < 0) {
+			return nullptr;
+		} else {
+			pos = m_dequeue.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void FrameRing::release(Slot* slot, uint64_t position)
+{
+	slot->sequence.store(position + m_mask + 1, std::memory_order_release);
+	m_released.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t FrameRing::reserved() const
+{
+	return m_enqueue.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameRing::released() const
+{
+	return m_released.load(std::memory_order_relaxed);
+}
+
+bool FrameRing::hasPublished() const
+{
+	const uint64_t pos = m_dequeue.load(std::memory_order_relaxed);
+	return m_slots[pos & m_mask].sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+void FrameRing::reset()
+{
+	for (size_t i = 0; i <= m_mask; ++i)
+		m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	m_enqueue.store(0, std::memory_order_relaxed);
+	m_dequeue.store(0, std::memory_order_relaxed);
+	m_released.store(0, std::memory_order_relaxed);
+}
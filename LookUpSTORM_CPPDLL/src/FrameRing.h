@@ -0,0 +1,106 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace LookUpSTORM
+{
+
+/*
+ * class FrameRing
+ * Bounded lock-free ring of frame buffers for multiple producers and consumers
+ * (sequence numbers per slot). A producer reserves a slot, writes the pixels into
+ * its preallocated buffer and publishes it. A consumer takes the oldest published
+ * slot and releases it after processing, so the buffer is used without copy.
+ * A full ring never blocks, tryPush returns false instead.
+ */
+class FrameRing
+{
+public:
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;
+		int frame;
+		int width;
+		int height;
+		std::vector<uint16_t> pixels;
+	};
+
+	// the capacity is rounded up to the next power of two
+	explicit FrameRing(size_t capacity);
+
+	FrameRing(const FrameRing&) = delete;
+	FrameRing& operator=(const FrameRing&) = delete;
+
+	size_t capacity() const;
+
+	// reserves the next slot for a frame of width x height pixels, returns nullptr if
+	// the ring is full, otherwise the slot is published by publish
+	Slot* reserve(int width, int height, int frame, uint64_t& position);
+	void publish(Slot* slot, uint64_t position);
+
+	// takes the oldest published slot, returns nullptr if none is published,
+	// the slot has to be released after processing
+	Slot* take(uint64_t& position);
+	void release(Slot* slot, uint64_t position);
+
+	// number of reserved slots (positions of the frames are 0 ... reserved - 1)
+	uint64_t reserved() const;
+	// number of released slots
+	uint64_t released() const;
+
+	// true if a published slot can be taken
+	bool hasPublished() const;
+
+	// clears the ring, no producer or consumer is allowed to access it
+	void reset();
+
+private:
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+	// producer and consumer positions on separate cache lines
+	char m_pad0[64];
+	std::atomic<uint64_t> m_enqueue;
+	char m_pad1[64 - sizeof(uint64_t)];
+	std::atomic<uint64_t> m_dequeue;
+	char m_pad2[64 - sizeof(uint64_t)];
+	std::atomic<uint64_t> m_released;
+	char m_pad3[64 - sizeof(uint64_t)];
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !FRAMERING_H
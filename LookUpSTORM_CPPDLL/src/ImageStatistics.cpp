@@ -0,0 +1,132 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "ImageStatistics.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace LookUpSTORM;
+
+// number of bins of the histogram (all 16 bit values)
+static constexpr size_t BINS = 65536;
+
+// ratio of the standard deviation and the MAD of a normal distribution
+static constexpr double MAD_TO_SD = 1.4826;
+
+ImageStatistics::ImageStatistics()
+	: m_histogram(BINS, 0u)
+	, m_count(0)
+{
+}
+
+void ImageStatistics::reset()
+{
+	std::fill(m_histogram.begin(), m_histogram.end(), 0u);
+	m_count = 0;
+}
+
+void ImageStatistics::add(const ImageU16& image)
+{
+	for (int y = 0; y < image.height(); ++y)
+		add(image.scanLine(y), size_t(image.width()));
+}
+
+void ImageStatistics::merge(const ImageStatistics& other)
+{
+	for (size_t v = 0; v < BINS; ++v)
+		m_histogram[v] += other.m_histogram[v];
+	m_count += other.m_count;
+}
+
+ImageStats ImageStatistics::stats() const
+{
+	ImageStats ret;
+	if (m_count == 0)
+		return ret;
+
+	// the sums are exact, the bins used are [lo, hi]
+	uint64_t sum = 0, sumSq = 0;
+	size_t lo = BINS, hi = 0;
+	for (size_t v = 0; v < BINS; ++v) {
+		const uint64_t c = m_histogram[v];
+		if (c == 0)
+			continue;
+		sum += c * v;
+		sumSq += c * v * v;
+		lo = std::min(lo, v);
+		hi = v;
+	}
+	const double n = double(m_count);
+	ret.mean = sum / n;
+	ret.sd = std::sqrt(std::max(0.0, (sumSq - double(sum) * sum / n) / n));
+
+	// cumulative[k] is the number of values below the bin lo + k
+	const size_t bins = hi - lo + 1;
+	std::vector<uint64_t> cumulative(bins + 1, 0);
+	for (size_t k = 0; k < bins; ++k)
+		cumulative[k + 1] = cumulative[k] + m_histogram[lo + k];
+
+	// number of values below t
+	auto below = [&](double t) {
+		const double u = t - (lo - 0.5);
+		if (u <= 0.0)
+			return 0.0;
+		if (u >= bins)
+			return n;
+		const size_t k = static_cast<size_t>(u);
+		return cumulative[k] + m_histogram[lo + k] * (u - k);
+	};
+
+	const double half = 0.5 * n;
+	size_t k = 0;
+	while (cumulative[k + 1] < half)
+		++k;
+	ret.median = (lo + k - 0.5) + (half - cumulative[k]) / m_histogram[lo + k];
+
+	// the values within [median - d, median + d] increase with d, so the MAD is found by bisection
+	double d0 = 0.0, d1 = double(bins);
+	for (int i = 0; i < 64; ++i) {
+		const double d = 0.5 * (d0 + d1);
+		if (below(ret.median + d) - below(ret.median - d) < half)
+			d0 = d;
+		else
+			d1 = d;
+	}
+	ret.mad = 0.5 * (d0 + d1);
+	ret.noise = MAD_TO_SD * ret.mad;
+	return ret;
+}
+
+ImageStats ImageStatistics::compute(const ImageU16& image)
+{
+	ImageStatistics statistics;
+	statistics.add(image);
+	return statistics.stats();
+}
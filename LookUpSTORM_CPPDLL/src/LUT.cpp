@@ -28,15 +28,30 @@
  ****************************************************************************/
 
 #include "LUT.h"
+#include "LUTFile.h"
+#include "LUTMemory.h"
+#include "LUTSymmetry.h"
+#include "ThreadPool.h"
 
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 using namespace LookUpSTORM;
 
 LUT::LUT()
     : m_data(nullptr)
+    , m_dataF32(nullptr)
+    , m_precision(Precision::Double)
+    , m_layout(Layout::Interleaved)
+    , m_allocation(Allocation::Default)
+    , m_usedAllocation(Allocation::Default)
+    , m_compression(Compression::None)
+    , m_threads(0)
     , m_dataSize(0)
     , m_windowSize(0)
     , m_countLat(0)
@@ -52,11 +67,38 @@ LUT::LUT()
 {
 }
 
-bool LUT::generate(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx, std::function<void(size_t index, size_t max)> callback)
+void LUT::setPrecision(Precision precision)
+{
+    m_precision = precision;
+}
+
+void LUT::setLayout(Layout layout)
+{
+    m_layout = layout;
+}
+
+void LUT::setCompression(Compression compression)
+{
+    m_compression = compression;
+}
+
+void LUT::setAllocation(Allocation allocation)
+{
+    m_allocation = allocation;
+}
+
+void LUT::setThreads(size_t threads)
 {
-    const size_t n = windowSize * windowSize;
+    m_threads = threads;
+}
+
+bool LUT::templateImage(size_t index, double x, double y, double z, double* psf, double* dx, double* dy, double* dz) const
+{
+    return false;
+}
 
-    size_t i = 0;
+bool LUT::setup(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx)
+{
     const double borderLat = std::floor((windowSize - rangeLat) / 2);
     if (borderLat < 1.0) {
         std::cerr << "LUT: Border during generation is smaller than 1!" << std::endl;
@@ -78,67 +120,313 @@ bool LUT::generate(size_t windowSize, double dLat, double dAx, double rangeLat,
     // calculate amount of template images
     m_countLat = static_cast<size_t>(std::floor((((m_maxLat - m_minLat) / dLat) + 1)));
     m_countAx = static_cast<size_t>(std::floor(((rangeAx / dAx) + 1)));
-    const size_t countIndex = m_countLat * m_countLat * m_countAx;
+    size_t countIndex = m_countLat * m_countLat * m_countAx;
+    if (m_compression == Compression::Symmetry) {
+        SymmetryMap symmetry;
+        if (!symmetry.setup(windowSize, m_countLat, m_minLat, dLat)) {
+            std::cerr << "LUT: Mirrored positions are not on the grid, use a lateral step that divides the range!" << std::endl;
+            return false;
+        }
+        countIndex = symmetry.slots() * symmetry.slots() * m_countAx;
+    }
 
     const size_t stride = windowSize * windowSize * 4ull;
 
     m_dataSize = countIndex * stride;
-    delete m_data;
-    m_data = new double[m_dataSize];
-    
+    release();
+
     preTemplates(windowSize, dLat, dAx, rangeLat, rangeAx);
+    return true;
+}
+
+bool LUT::generate(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx, std::function<void(size_t index, size_t max)> callback)
+{
+    if (!setup(windowSize, dLat, dAx, rangeLat, rangeAx))
+        return false;
+
+    const std::vector<size_t> indices = storedIndices();
+
+    m_usedAllocation = m_allocation;
+    if (m_precision == Precision::Float) {
+        m_dataF32 = LUTMemory::allocate<float>(m_dataSize, m_usedAllocation);
+        if (!fillTemplates(m_dataF32, indices, callback)) {
+            release();
+            return false;
+        }
+        sumTemplates(m_dataF32);
+    } else {
+        m_data = LUTMemory::allocate<double>(m_dataSize, m_usedAllocation);
+        if (!fillTemplates(m_data, indices, callback)) {
+            release();
+            return false;
+        }
+        sumTemplates(m_data);
+    }
+
+    return true;
+}
+
+bool LUT::drawTemplate(size_t index, double* pixels) const
+{
+    if (index >= m_countLat * m_countLat * m_countAx)
+        return false;
+    std::vector<double> planes(m_windowSize * m_windowSize * 4ull);
+    return drawTemplate(index, planes.data(), pixels);
+}
 
-    double* pixels = m_data;
-    for (i = 0; i < countIndex; ++i) {
-        const size_t zidx = i % m_countAx;
-        const size_t yidx = (i / m_countAx) % m_countLat;
-        const size_t xidx = i / (m_countAx * m_countLat);
-
-        const double x = m_minLat + xidx * dLat;
-        const double y = m_minLat + yidx * dLat;
-        const double z = m_minAx + zidx * dAx;
-
-        startTemplate(i, x, y, z);
-        for (size_t j = 0; j < n; ++j, pixels += 4) {
-            const size_t yy = j / windowSize;
-            const size_t xx = j - yy * windowSize;
-            std::tie(pixels[0], pixels[1], pixels[2], pixels[3]) = 
-                templateAtPixel(i, x, y, z, xx, yy);
+template<class T>
+bool LUT::drawTemplate(size_t index, double* planes, T* pixels) const
+{
+    const size_t n = m_windowSize * m_windowSize;
+    double x, y, z;
+    std::tie(x, y, z) = lookupPosition(index);
+
+    if (!templateImage(index, x, y, z, planes, planes + n, planes + 2 * n, planes + 3 * n))
+        return false;
+
+    if (m_layout == Layout::Planar) {
+        std::copy_n(planes, 4 * n, pixels);
+        return true;
+    }
+
+    for (size_t j = 0; j < n; ++j, pixels += 4) {
+        pixels[0] = static_cast<T>(planes[j]);
+        pixels[1] = static_cast<T>(planes[j + n]);
+        pixels[2] = static_cast<T>(planes[j + 2 * n]);
+        pixels[3] = static_cast<T>(planes[j + 3 * n]);
+    }
+    return true;
+}
+
+std::vector<size_t> LUT::storedIndices() const
+{
+    std::vector<size_t> indices;
+    if (m_compression == Compression::Symmetry) {
+        SymmetryMap symmetry;
+        symmetry.setup(m_windowSize, m_countLat, m_minLat, m_dLat);
+        indices.reserve(symmetry.slots() * symmetry.slots() * m_countAx);
+        for (size_t xs = 0; xs < symmetry.slots(); ++xs) {
+            for (size_t ys = 0; ys < symmetry.slots(); ++ys) {
+                const size_t xi = symmetry.position(xs);
+                const size_t yi = symmetry.position(ys);
+                for (size_t zi = 0; zi < m_countAx; ++zi)
+                    indices.push_back(zi + yi * m_countAx + xi * m_countAx * m_countLat);
+            }
         }
-        endTemplate(i, x, y, z);
+    } else {
+        indices.resize(m_countLat * m_countLat * m_countAx);
+        for (size_t i = 0; i < indices.size(); ++i)
+            indices[i] = i;
+    }
+    return indices;
+}
+
+template<class T>
+bool LUT::fillTemplates(T* data, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback)
+{
+    bool failed = false;
+    if (fillTemplateImages(data, indices, callback, failed)) {
+        if (failed)
+            std::cerr << "LUT: Could not draw all templates with templateImage!" << std::endl;
+        return !failed;
+    }
+
+    const size_t countIndex = indices.size();
+
+    const size_t n = m_windowSize * m_windowSize;
+    // distance of the pixels and of the values (e, dx, dy, dz) of a pixel
+    const size_t step = (m_layout == Layout::Planar) ? 1 : 4;
+    const size_t plane = (m_layout == Layout::Planar) ? n : 1;
+
+    for (size_t i = 0; i < countIndex; ++i) {
+        T* pixels = data + i * 4 * n;
+        const size_t index = indices[i];
+        double x, y, z;
+        std::tie(x, y, z) = lookupPosition(index);
+
+        startTemplate(index, x, y, z);
+        for (size_t j = 0; j < n; ++j, pixels += step) {
+            const size_t yy = j / m_windowSize;
+            const size_t xx = j - yy * m_windowSize;
+            const auto val = templateAtPixel(index, x, y, z, xx, yy);
+            pixels[0] = static_cast<T>(std::get<0>(val));
+            pixels[plane] = static_cast<T>(std::get<1>(val));
+            pixels[2 * plane] = static_cast<T>(std::get<2>(val));
+            pixels[3 * plane] = static_cast<T>(std::get<3>(val));
+        }
+        endTemplate(index, x, y, z);
         callback(i, countIndex);
     }
+    return true;
+}
+
+template<class T>
+void LUT::sumTemplates(const T* data)
+{
+    const size_t n = m_windowSize * m_windowSize;
+    const size_t step = (m_layout == Layout::Planar) ? 1 : 4;
+    m_sums.resize(m_dataSize / (4 * n));
+    for (size_t i = 0; i < m_sums.size(); ++i) {
+        const T* pixels = data + i * 4 * n;
+        double sum = 0.0;
+        for (size_t j = 0; j < n; ++j)
+            sum += pixels[j * step];
+        m_sums[i] = sum;
+    }
+}
+
+template<class T>
+bool LUT::fillTemplateImages(T* data, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback, bool& failed)
+{
+    // number of templates a thread takes at once
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    const size_t countIndex = indices.size();
+    const size_t n = m_windowSize * m_windowSize;
+    const size_t stride = 4 * n;
+
+    // draws the i-th stored template into the planes and copies them into the LUT
+    auto draw = [this, data, stride, &indices](size_t i, std::vector<double>& planes) {
+        return drawTemplate(indices[i], planes.data(), data + i * stride);
+    };
+
+    // the first template checks if the subclass implements the batched method
+    std::vector<double> planes(stride);
+    if ((countIndex == 0) || !draw(0, planes))
+        return false;
 
+    const size_t blocks = (countIndex + BLOCK_SIZE - 2) / BLOCK_SIZE;
+    const size_t maxThreads = std::max<size_t>(1, (m_threads > 0) ? m_threads : std::thread::hardware_concurrency());
+    const size_t numThreads = std::min(maxThreads, blocks);
+
+    // the pool keeps its helpers between the generate calls
+    if (!m_pool)
+        m_pool = std::make_shared<ThreadPool>(maxThreads - 1);
+    else if (m_pool->threads() != maxThreads - 1)
+        m_pool->setThreads(maxThreads - 1);
+
+    std::atomic<size_t> nextBlock(0);
+    std::atomic<size_t> finished(1);
+    std::atomic<bool> error(false);
+    const std::thread::id caller = std::this_thread::get_id();
+
+    std::vector<std::vector<double>> threadPlanes(numThreads);
+    threadPlanes[0].swap(planes);
+    m_pool->run(numThreads, numThreads, [&](size_t t) {
+        std::vector<double>& planes = threadPlanes[t];
+        planes.resize(stride);
+        for (size_t b = nextBlock++; (b < blocks) && !error; b = nextBlock++) {
+            const size_t end = std::min(countIndex, 1 + (b + 1) * BLOCK_SIZE);
+            for (size_t i = 1 + b * BLOCK_SIZE; i < end; ++i) {
+                if (!draw(i, planes)) {
+                    error = true;
+                    break;
+                }
+            }
+            const size_t done = (finished += end - (1 + b * BLOCK_SIZE));
+            // only the calling thread reports the progress
+            if (std::this_thread::get_id() == caller)
+                callback(done - 1, countIndex);
+        }
+    });
+
+    failed = error;
+    if (!failed)
+        callback(countIndex - 1, countIndex);
     return true;
 }
 
 void LUT::release()
 {
-    delete m_data;
+    LUTMemory::release(m_data);
+    LUTMemory::release(m_dataF32);
+    m_data = nullptr;
+    m_dataF32 = nullptr;
+    m_usedAllocation = Allocation::Default;
+    m_sums.clear();
 }
 
-bool LookUpSTORM::LUT::save(const std::string& fileName)
+// header of a binary LUT file (version 2) with the geometry and format of the LUT
+static HeaderLUTv2 fileHeader(const LUT& lut)
+{
+    HeaderLUTv2 hdr;
+    hdr.templates = lut.dataSize() / (4 * lut.windowSize() * lut.windowSize());
+    hdr.windowSize = lut.windowSize();
+    hdr.dLat = lut.dLat();
+    hdr.dAx = lut.dAx();
+    hdr.rangeLat = lut.rangeLat();
+    hdr.rangeAx = lut.rangeAx();
+    hdr.precision = lut.precision();
+    hdr.layout = lut.layout();
+    hdr.compression = lut.compression();
+    return hdr;
+}
+
+bool LookUpSTORM::LUT::save(const std::string& fileName, int version)
 {
     if (!isValid())
         return false;
+    if (version == 1)
+        return saveV1(fileName);
 
+    LUTWriter writer;
+    if (!writer.open(fileName, fileHeader(*this)))
+        return false;
+    const size_t templates = m_dataSize / (4 * m_windowSize * m_windowSize);
+    const bool ok = (m_dataF32 != nullptr) ? writer.write(m_dataF32, templates) : writer.write(m_data, templates);
+    return writer.close() && ok;
+}
+
+bool LUT::generateFile(const std::string& fileName, size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx,
+    std::function<void(size_t index, size_t max)> callback)
+{
+    if (!setup(windowSize, dLat, dAx, rangeLat, rangeAx))
+        return false;
+
+    LUTWriter writer;
+    if (!writer.open(fileName, fileHeader(*this)))
+        return false;
+
+    const std::vector<size_t> indices = storedIndices();
+    const bool ok = (m_precision == Precision::Float) ?
+        writeTemplates<float>(writer, indices, callback) : writeTemplates<double>(writer, indices, callback);
+    return writer.close() && ok;
+}
+
+template<class T>
+bool LUT::writeTemplates(LUTWriter& writer, const std::vector<size_t>& indices, std::function<void(size_t index, size_t max)>& callback)
+{
+    // number of templates drawn at once (about 16 MB)
+    const size_t stride = 4 * m_windowSize * m_windowSize;
+    const size_t block = std::max<size_t>(1, (16ull << 20) / (stride * sizeof(T)));
+    std::vector<T> buffer(std::min(block, indices.size()) * stride);
+
+    for (size_t first = 0; first < indices.size(); first += block) {
+        const size_t last = std::min(first + block, indices.size());
+        const std::vector<size_t> blockIndices(indices.begin() + first, indices.begin() + last);
+        std::function<void(size_t index, size_t max)> blockCallback = [&callback, first, &indices](size_t index, size_t) {
+            callback(first + index, indices.size());
+        };
+        if (!fillTemplates(buffer.data(), blockIndices, blockCallback))
+            return false;
+        if (!writer.write(buffer.data(), blockIndices.size()))
+            return false;
+    }
+    return true;
+}
+
+bool LUT::saveV1(const std::string& fileName)
+{
     std::fstream file(fileName, std::ios::out | std::ios::binary);
     if (!file)
         return false;
 
-    struct HeaderLUT {
-        char id[8] = { 'L','U','T','D','S','M','L','M' };
-        size_t dataSize;
-        size_t indices;
-        size_t windowSize;
-        double dLat;
-        double dAx;
-        double rangeLat;
-        double rangeAx;
-    } hdr;
-
-    hdr.dataSize = m_dataSize * sizeof(double);
+    HeaderLUT hdr;
+
+    // the binary format only supports uncompressed double templates
+    const size_t n = m_windowSize * m_windowSize;
     hdr.indices = m_countAx * m_countLat * m_countLat;
+    hdr.dataSize = hdr.indices * 4 * n * sizeof(double);
     hdr.windowSize = m_windowSize;
     hdr.dLat = m_dLat;
     hdr.dAx = m_dAx;
@@ -146,7 +434,43 @@ bool LookUpSTORM::LUT::save(const std::string& fileName)
     hdr.rangeAx = m_rangeAx;
 
     file.write((const char*)&hdr, sizeof(hdr));
-    file.write((const char*)m_data, hdr.dataSize);
+    if ((m_precision == Precision::Float) || (m_layout == Layout::Planar) || (m_compression != Compression::None)) {
+        // converted template by template
+        const size_t plane = (m_layout == Layout::Planar) ? n : 1;
+        const size_t step = (m_layout == Layout::Planar) ? 1 : 4;
+        SymmetryMap symmetry;
+        if (m_compression == Compression::Symmetry)
+            symmetry.setup(m_windowSize, m_countLat, m_minLat, m_dLat);
+
+        std::vector<double> templ(4 * n);
+        std::vector<double> buffer(4 * n);
+        for (size_t i = 0; i < hdr.indices; ++i) {
+            const size_t zi = i % m_countAx;
+            const size_t yi = (i / m_countAx) % m_countLat;
+            const size_t xi = i / (m_countAx * m_countLat);
+
+            // the mirrored templates are restored from the stored ones
+            size_t index = i;
+            bool mx = false, my = false;
+            if (m_compression == Compression::Symmetry) {
+                index = zi + symmetry.slot(yi) * m_countAx + symmetry.slot(xi) * m_countAx * symmetry.slots();
+                mx = symmetry.mirrored(xi);
+                my = symmetry.mirrored(yi);
+            }
+            if (m_dataF32 != nullptr)
+                mirrorTemplate(m_dataF32 + index * 4 * n, templ.data(), m_windowSize, m_layout, mx, my);
+            else
+                mirrorTemplate(m_data + index * 4 * n, templ.data(), m_windowSize, m_layout, mx, my);
+
+            for (size_t j = 0; j < n; ++j) {
+                for (size_t k = 0; k < 4; ++k)
+                    buffer[4 * j + k] = templ[j * step + k * plane];
+            }
+            file.write((const char*)buffer.data(), buffer.size() * sizeof(double));
+        }
+    } else {
+        file.write((const char*)m_data, hdr.dataSize);
+    }
 
     file.close();
     return true;
@@ -174,10 +498,14 @@ std::tuple<double, double, double> LookUpSTORM::LUT::lookupPosition(size_t index
     return { x, y, z };
 }
 
-size_t LookUpSTORM::LUT::calculateUsageBytes(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx)
+size_t LookUpSTORM::LUT::calculateUsageBytes(size_t windowSize, double dLat, double dAx, double rangeLat, double rangeAx, Precision precision, Compression compression)
 {
     const double minLat = std::floor((windowSize - rangeLat) / 2);
-    const size_t countLat = static_cast<size_t>(std::floor((((windowSize - 2.0 * minLat) / dLat) + 1)));
+    size_t countLat = static_cast<size_t>(std::floor((((windowSize - 2.0 * minLat) / dLat) + 1)));
     const size_t countAx = static_cast<size_t>(std::floor(((rangeAx / dAx) + 1)));
-    return countLat * countLat * countAx * 4ull * sizeof(double) * (windowSize * windowSize);
+    const size_t bytes = (precision == Precision::Float) ? sizeof(float) : sizeof(double);
+    SymmetryMap symmetry;
+    if ((compression == Compression::Symmetry) && symmetry.setup(windowSize, countLat, minLat, dLat))
+        countLat = symmetry.slots();
+    return countLat * countLat * countAx * 4ull * bytes * (windowSize * windowSize);
 }
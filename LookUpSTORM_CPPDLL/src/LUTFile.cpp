@@ -0,0 +1,520 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "LUTFile.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _WIN32
+
+using namespace LookUpSTORM;
+
+static_assert(sizeof(HeaderLUT) == 64, "LUT file header has to be 64 bytes");
+
+// little endian fields of the version 2 header
+static inline void putU32(char* dst, uint32_t value)
+{
+	for (size_t i = 0; i < 4; ++i)
+		dst[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+static inline void putU64(char* dst, uint64_t value)
+{
+	for (size_t i = 0; i < 8; ++i)
+		dst[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+static inline void putF64(char* dst, double value)
+{
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	putU64(dst, bits);
+}
+
+static inline uint32_t getU32(const char* src)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < 4; ++i)
+		value |= uint32_t(uint8_t(src[i])) << (8 * i);
+	return value;
+}
+
+static inline uint64_t getU64(const char* src)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < 8; ++i)
+		value |= uint64_t(uint8_t(src[i])) << (8 * i);
+	return value;
+}
+
+static inline double getF64(const char* src)
+{
+	const uint64_t bits = getU64(src);
+	double value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// the payload is mapped directly, so it has to be in the byte order of the host
+static inline bool isLittleEndian()
+{
+	const uint16_t value = 1;
+	char byte;
+	std::memcpy(&byte, &value, 1);
+	return byte == 1;
+}
+
+static inline size_t valueSize(Precision precision)
+{
+	return (precision == Precision::Float) ? sizeof(float) : sizeof(double);
+}
+
+// tables of the slicing-by-8 CRC-32
+static const uint32_t* crcTable()
+{
+	static const std::vector<uint32_t> table = [] {
+		std::vector<uint32_t> t(8 * 256);
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (size_t k = 0; k < 8; ++k)
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			t[i] = c;
+		}
+		for (size_t k = 1; k < 8; ++k) {
+			for (size_t i = 0; i < 256; ++i) {
+				const uint32_t c = t[(k - 1) * 256 + i];
+				t[k * 256 + i] = (c >> 8) ^ t[c & 0xFF];
+			}
+		}
+		return t;
+	}();
+	return table.data();
+}
+
+uint32_t LookUpSTORM::crc32(uint32_t crc, const void* data, size_t size)
+{
+	const uint32_t* t = crcTable();
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	crc = ~crc;
+	for (; size >= 8; size -= 8, p += 8) {
+		const uint32_t lo = crc ^ (uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24));
+		const uint32_t hi = uint32_t(p[4]) | (uint32_t(p[5]) << 8) | (uint32_t(p[6]) << 16) | (uint32_t(p[7]) << 24);
+		crc = t[7 * 256 + (lo & 0xFF)] ^ t[6 * 256 + ((lo >> 8) & 0xFF)] ^ t[5 * 256 + ((lo >> 16) & 0xFF)] ^ t[4 * 256 + (lo >> 24)] ^
+			t[3 * 256 + (hi & 0xFF)] ^ t[2 * 256 + ((hi >> 8) & 0xFF)] ^ t[1 * 256 + ((hi >> 16) & 0xFF)] ^ t[hi >> 24];
+	}
+	for (; size > 0; --size, ++p)
+		crc = t[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+void HeaderLUTv2::encode(char* buffer) const
+{
+	std::fill_n(buffer, Size, char(0));
+	std::memcpy(buffer, "LUTDSMLM", 8);
+	putU32(buffer + 8, version);
+	putU32(buffer + 12, uint32_t(Size));
+	putU64(buffer + 16, payloadOffset);
+	putU64(buffer + 24, payloadSize);
+	putU64(buffer + 32, chunkSize);
+	putU64(buffer + 40, templates);
+	putU64(buffer + 48, windowSize);
+	putF64(buffer + 56, dLat);
+	putF64(buffer + 64, dAx);
+	putF64(buffer + 72, rangeLat);
+	putF64(buffer + 80, rangeAx);
+	putU32(buffer + 88, uint32_t(precision));
+	putU32(buffer + 92, uint32_t(layout));
+	putU32(buffer + 96, uint32_t(compression));
+	// bytes 100 to 123 are reserved
+	putU32(buffer + Size - 4, crc32(0, buffer, Size - 4));
+}
+
+bool HeaderLUTv2::decode(const char* buffer)
+{
+	if ((strncmp(buffer, "LUTDSMLM", 8) != 0) || (getU32(buffer + 8) != 2) || (getU32(buffer + 12) != Size))
+		return false;
+	if (getU32(buffer + Size - 4) != crc32(0, buffer, Size - 4))
+		return false;
+
+	const uint32_t prec = getU32(buffer + 88);
+	const uint32_t lay = getU32(buffer + 92);
+	const uint32_t comp = getU32(buffer + 96);
+	if ((prec > uint32_t(Precision::Float)) || (lay > uint32_t(Layout::Planar)) || (comp > uint32_t(Compression::Symmetry)))
+		return false;
+
+	version = 2;
+	payloadOffset = getU64(buffer + 16);
+	payloadSize = getU64(buffer + 24);
+	chunkSize = getU64(buffer + 32);
+	templates = getU64(buffer + 40);
+	windowSize = getU64(buffer + 48);
+	dLat = getF64(buffer + 56);
+	dAx = getF64(buffer + 64);
+	rangeLat = getF64(buffer + 72);
+	rangeAx = getF64(buffer + 80);
+	precision = static_cast<Precision>(prec);
+	layout = static_cast<Layout>(lay);
+	compression = static_cast<Compression>(comp);
+	return true;
+}
+
+LUTFile::LUTFile()
+	: m_map(nullptr)
+	, m_mapSize(0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#endif // _WIN32
+{
+}
+
+LUTFile::~LUTFile()
+{
+	close();
+}
+
+bool LUTFile::open(const std::string& fileName)
+{
+	close();
+
+	if (!map(fileName))
+		return false;
+
+	if (m_mapSize < sizeof(HeaderLUT)) {
+		std::cerr << "LUTFile: File is too small for the header!" << std::endl;
+		close();
+		return false;
+	}
+
+	if (strncmp(m_map, "LUTDSMLM", 8) != 0) {
+		std::cerr << "LUTFile: ID of file is not correct" << std::endl;
+		close();
+		return false;
+	}
+
+	// the data size of version 1 is a multiple of 8 at the offset of the version
+	const bool ok = (getU32(m_map + 8) == 2) ? readHeaderV2() : readHeaderV1();
+	if (!ok) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool LUTFile::readHeaderV1()
+{
+	HeaderLUT hdr;
+	std::memcpy(&hdr, m_map, sizeof(HeaderLUT));
+	if ((hdr.dataSize % sizeof(double) != 0) || (hdr.dataSize > m_mapSize - sizeof(HeaderLUT))) {
+		std::cerr << "LUTFile: Data size of the header does not correspond to the file size!" << std::endl;
+		return false;
+	}
+
+	m_header.version = 1;
+	m_header.payloadOffset = sizeof(HeaderLUT);
+	m_header.payloadSize = hdr.dataSize;
+	m_header.chunkSize = 0;
+	m_header.templates = hdr.indices;
+	m_header.windowSize = hdr.windowSize;
+	m_header.dLat = hdr.dLat;
+	m_header.dAx = hdr.dAx;
+	m_header.rangeLat = hdr.rangeLat;
+	m_header.rangeAx = hdr.rangeAx;
+	return true;
+}
+
+bool LUTFile::readHeaderV2()
+{
+	if ((m_mapSize < HeaderLUTv2::Size) || !m_header.decode(m_map)) {
+		std::cerr << "LUTFile: Header of version 2 is not valid!" << std::endl;
+		return false;
+	}
+
+	if (!isLittleEndian()) {
+		std::cerr << "LUTFile: Version 2 files are only supported on little endian systems!" << std::endl;
+		return false;
+	}
+
+	const HeaderLUTv2& hdr = m_header;
+	const uint64_t templateSize = 4 * hdr.windowSize * hdr.windowSize * valueSize(hdr.precision);
+	const uint64_t end = hdr.payloadOffset + hdr.payloadSize + 4 * hdr.chunks();
+	if ((hdr.payloadOffset < HeaderLUTv2::Size) || (hdr.payloadOffset % sizeof(double) != 0) || (hdr.chunkSize == 0) ||
+		(hdr.templates * templateSize != hdr.payloadSize) || (end > m_mapSize))
+	{
+		std::cerr << "LUTFile: Payload of the header does not correspond to the file size!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void LUTFile::close()
+{
+#ifdef _WIN32
+	if (m_map != nullptr)
+		UnmapViewOfFile(m_map);
+	if (m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_map != nullptr)
+		munmap(const_cast<char*>(m_map), m_mapSize);
+#endif // _WIN32
+	m_map = nullptr;
+	m_mapSize = 0;
+	m_header = HeaderLUTv2();
+}
+
+bool LUTFile::isOpen() const
+{
+	return m_map != nullptr;
+}
+
+const HeaderLUTv2& LUTFile::header() const
+{
+	return m_header;
+}
+
+bool LUTFile::verify() const
+{
+	if (m_map == nullptr)
+		return false;
+	if (m_header.version < 2)
+		return true;
+
+	const char* payload = m_map + m_header.payloadOffset;
+	const char* crcs = payload + m_header.payloadSize;
+	for (uint64_t i = 0; i < m_header.chunks(); ++i) {
+		const uint64_t offset = i * m_header.chunkSize;
+		const size_t size = static_cast<size_t>(std::min(m_header.chunkSize, m_header.payloadSize - offset));
+		if (crc32(0, payload + offset, size) != getU32(crcs + 4 * i)) {
+			std::cerr << "LUTFile: CRC of chunk " << i << " is not correct!" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+const double* LUTFile::data() const
+{
+	// the payload offset is a multiple of 8, so the templates are aligned within the page aligned mapping
+	if ((m_map == nullptr) || (m_header.precision != Precision::Double))
+		return nullptr;
+	return reinterpret_cast<const double*>(m_map + m_header.payloadOffset);
+}
+
+const float* LUTFile::dataF32() const
+{
+	if ((m_map == nullptr) || (m_header.precision != Precision::Float))
+		return nullptr;
+	return reinterpret_cast<const float*>(m_map + m_header.payloadOffset);
+}
+
+size_t LUTFile::dataSize() const
+{
+	return static_cast<size_t>(m_header.payloadSize / valueSize(m_header.precision));
+}
+
+bool LUTFile::map(const std::string& fileName)
+{
+#ifdef _WIN32
+	m_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		std::cerr << "LUTFile: Could not open " << fileName << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || (size.QuadPart == 0)) {
+		close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr) {
+		std::cerr << "LUTFile: Could not create file mapping!" << std::endl;
+		close();
+		return false;
+	}
+
+	m_map = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_map == nullptr) {
+		std::cerr << "LUTFile: Could not map file!" << std::endl;
+		close();
+		return false;
+	}
+	m_mapSize = static_cast<size_t>(size.QuadPart);
+#else
+	const int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "LUTFile: Could not open " << fileName << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+		::close(fd);
+		return false;
+	}
+
+	void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after closing the file descriptor
+	::close(fd);
+	if (ptr == MAP_FAILED) {
+		std::cerr << "LUTFile: Could not map file!" << std::endl;
+		return false;
+	}
+
+	m_map = static_cast<const char*>(ptr);
+	m_mapSize = static_cast<size_t>(st.st_size);
+#endif // _WIN32
+	return true;
+}
+
+LUTWriter::LUTWriter()
+	: m_written(0)
+	, m_crc(0)
+{
+}
+
+LUTWriter::~LUTWriter()
+{
+	if (isOpen())
+		close();
+}
+
+bool LUTWriter::open(const std::string& fileName, const HeaderLUTv2& header)
+{
+	if (isOpen())
+		close();
+
+	if (!isLittleEndian()) {
+		std::cerr << "LUTWriter: Version 2 files are only supported on little endian systems!" << std::endl;
+		return false;
+	}
+
+	m_header = header;
+	m_header.version = 2;
+	m_header.payloadOffset = HeaderLUTv2::PayloadOffset;
+	m_header.payloadSize = m_header.templates * 4 * m_header.windowSize * m_header.windowSize * valueSize(m_header.precision);
+	if (m_header.chunkSize == 0)
+		m_header.chunkSize = HeaderLUTv2::ChunkSize;
+
+	m_file.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_file) {
+		std::cerr << "LUTWriter: Could not open " << fileName << std::endl;
+		return false;
+	}
+
+	// the header is written by close, until then the file has no valid id
+	const std::vector<char> padding(static_cast<size_t>(m_header.payloadOffset), char(0));
+	m_file.write(padding.data(), padding.size());
+
+	m_crcs.clear();
+	m_written = 0;
+	m_crc = 0;
+	return bool(m_file);
+}
+
+bool LUTWriter::write(const void* templates, size_t count)
+{
+	if (!isOpen())
+		return false;
+
+	const uint64_t bytes = count * 4 * m_header.windowSize * m_header.windowSize * valueSize(m_header.precision);
+	if (m_written + bytes > m_header.payloadSize) {
+		std::cerr << "LUTWriter: More templates than announced in the header!" << std::endl;
+		return false;
+	}
+	append(static_cast<const char*>(templates), static_cast<size_t>(bytes));
+	return bool(m_file);
+}
+
+void LUTWriter::append(const char* data, size_t size)
+{
+	// the CRC chunks are independent of the written blocks
+	while (size > 0) {
+		const size_t n = static_cast<size_t>(std::min<uint64_t>(size, m_header.chunkSize - m_written % m_header.chunkSize));
+		m_crc = crc32(m_crc, data, n);
+		m_file.write(data, n);
+		m_written += n;
+		data += n;
+		size -= n;
+		if (m_written % m_header.chunkSize == 0) {
+			m_crcs.push_back(m_crc);
+			m_crc = 0;
+		}
+	}
+}
+
+bool LUTWriter::close()
+{
+	if (!isOpen())
+		return false;
+
+	const bool complete = (m_written == m_header.payloadSize);
+	if (complete) {
+		if (m_written % m_header.chunkSize != 0)
+			m_crcs.push_back(m_crc);
+
+		std::vector<char> crcs(4 * m_crcs.size());
+		for (size_t i = 0; i < m_crcs.size(); ++i)
+			putU32(crcs.data() + 4 * i, m_crcs[i]);
+		m_file.write(crcs.data(), crcs.size());
+
+		char hdr[HeaderLUTv2::Size];
+		m_header.encode(hdr);
+		m_file.seekp(0);
+		m_file.write(hdr, sizeof(hdr));
+	} else {
+		std::cerr << "LUTWriter: File is incomplete (" << m_written << " of " << m_header.payloadSize << " bytes)!" << std::endl;
+	}
+
+	const bool ok = complete && bool(m_file);
+	m_file.close();
+	m_crcs.clear();
+	return ok;
+}
+
+bool LUTWriter::isOpen() const
+{
+	return m_file.is_open();
+}
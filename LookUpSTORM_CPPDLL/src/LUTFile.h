@@ -0,0 +1,187 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef LUTFILE_H
+#define LUTFILE_H
+
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "LUT.h"
+
+namespace LookUpSTORM
+{
+
+// header of the binary LUT file version 1 (64 bytes), followed by the template array
+// of interleaved doubles
+struct HeaderLUT
+{
+	char id[8] = { 'L','U','T','D','S','M','L','M' };
+	uint64_t dataSize = 0;
+	uint64_t indices = 0;
+	uint64_t windowSize = 0;
+	double dLat = 0.0;
+	double dAx = 0.0;
+	double rangeLat = 0.0;
+	double rangeAx = 0.0;
+};
+
+// header of the binary LUT file version 2, stored as little endian fixed-width fields
+// (see HeaderLUTv2::encode) padded to payloadOffset. The payload is page aligned, so it
+// can be mapped directly, and followed by the CRC-32 of each chunk (uint32 each).
+// The id is the same as of version 1, where the version field holds the lower half of
+// the data size, which is always a multiple of 8.
+struct HeaderLUTv2
+{
+	// bytes of the encoded header
+	static constexpr size_t Size = 128;
+	// offset of the payload in the file
+	static constexpr uint64_t PayloadOffset = 4096;
+	// default bytes of the payload covered by one CRC
+	static constexpr uint64_t ChunkSize = 1ull << 22;
+
+	uint32_t version = 2;
+	uint64_t payloadOffset = PayloadOffset;
+	// bytes of the payload
+	uint64_t payloadSize = 0;
+	uint64_t chunkSize = ChunkSize;
+	// number of stored templates
+	uint64_t templates = 0;
+	uint64_t windowSize = 0;
+	double dLat = 0.0;
+	double dAx = 0.0;
+	double rangeLat = 0.0;
+	double rangeAx = 0.0;
+	Precision precision = Precision::Double;
+	Layout layout = Layout::Interleaved;
+	Compression compression = Compression::None;
+
+	// number of CRC chunks of the payload
+	inline uint64_t chunks() const { return (chunkSize > 0) ? (payloadSize + chunkSize - 1) / chunkSize : 0; }
+
+	// writes the header into buffer (Size bytes) including its CRC
+	void encode(char* buffer) const;
+	// reads the header from buffer (Size bytes), returns false if the id or CRC is wrong
+	bool decode(const char* buffer);
+};
+
+// CRC-32 (IEEE 802.3, same as zlib and java.util.zip.CRC32) continued from crc
+uint32_t crc32(uint32_t crc, const void* data, size_t size);
+
+/*
+ * class LUTFile
+ * Maps a binary LUT file read-only into memory. The templates are not copied,
+ * so multiple processes using the same file share one copy in the page cache.
+ * The mapping has to stay open as long as a fitter uses the templates.
+ * Version 1 files are described by a version 2 header with the default format.
+ */
+class LUTFile
+{
+public:
+	LUTFile();
+	~LUTFile();
+
+	LUTFile(const LUTFile&) = delete;
+	LUTFile& operator=(const LUTFile&) = delete;
+
+	bool open(const std::string& fileName);
+	void close();
+
+	bool isOpen() const;
+
+	const HeaderLUTv2& header() const;
+
+	// checks the CRC of each payload chunk (version 1 files have none)
+	bool verify() const;
+
+	// returns the pointer to the mapped templates
+	// or nullptr if the templates are not of the matching precision
+	const double* data() const;
+	const float* dataF32() const;
+
+	// returns the number of values in the template array
+	size_t dataSize() const;
+
+private:
+	bool map(const std::string& fileName);
+	bool readHeaderV1();
+	bool readHeaderV2();
+
+	HeaderLUTv2 m_header;
+	const char* m_map;
+	size_t m_mapSize;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif // _WIN32
+
+};
+
+/*
+ * class LUTWriter
+ * Writes a binary LUT file of version 2 template by template, so the LUT does not
+ * need to be in memory at once. The header is completed by close.
+ */
+class LUTWriter
+{
+public:
+	LUTWriter();
+	~LUTWriter();
+
+	LUTWriter(const LUTWriter&) = delete;
+	LUTWriter& operator=(const LUTWriter&) = delete;
+
+	// the header describes the geometry and format of the templates,
+	// the payload size is calculated from the number of templates
+	bool open(const std::string& fileName, const HeaderLUTv2& header);
+
+	// appends count templates of the header format
+	bool write(const void* templates, size_t count);
+
+	// writes the CRCs and the header, returns false if not all templates were written
+	bool close();
+
+	bool isOpen() const;
+
+private:
+	void append(const char* data, size_t size);
+
+	std::ofstream m_file;
+	HeaderLUTv2 m_header;
+	std::vector<uint32_t> m_crcs;
+	uint64_t m_written;
+	uint32_t m_crc;
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !LUTFILE_H
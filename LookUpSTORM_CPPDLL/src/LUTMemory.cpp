@@ -0,0 +1,170 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "LUTMemory.h"
+
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // _WIN32
+
+using namespace LookUpSTORM;
+
+// sizes of the page mapped allocations, the other ones are allocated by new[]
+static std::mutex MAPPINGS_MUTEX;
+static std::unordered_map<const void*, size_t> MAPPINGS;
+
+#ifdef _WIN32
+static void* mapPages(size_t& bytes, Allocation& allocation)
+{
+	// large pages need the "Lock pages in memory" privilege, interleaving is not supported
+	const size_t largePage = GetLargePageMinimum();
+	if (largePage > 0) {
+		const size_t size = (bytes + largePage - 1) / largePage * largePage;
+		void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (ptr != nullptr) {
+			bytes = size;
+			allocation = Allocation::HugePages;
+			return ptr;
+		}
+	}
+	allocation = Allocation::Default;
+	return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void unmapPages(void* ptr, size_t)
+{
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+#else
+// size of a huge page on x86-64
+static constexpr size_t HUGE_PAGE_SIZE = 2ull << 20;
+
+static void* mapPages(size_t& bytes, Allocation& allocation)
+{
+	const size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+	// explicit huge pages are only available if they are reserved by the administrator
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr == MAP_FAILED) {
+		// transparent huge pages need a mapping aligned to the huge page size
+		char* map = static_cast<char*>(mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (map == MAP_FAILED)
+			return nullptr;
+		const size_t head = (HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(map) % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+		if (head > 0)
+			munmap(map, head);
+		munmap(map + head + size, HUGE_PAGE_SIZE - head);
+		ptr = map + head;
+#ifdef MADV_HUGEPAGE
+		madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	if (allocation == Allocation::HugePagesInterleaved) {
+		bool interleaved = false;
+#if defined(SYS_mbind) && defined(SYS_get_mempolicy)
+		// MPOL_INTERLEAVE over the nodes the process may use, a mask with other nodes
+		// is rejected by the kernel; it has to be set before the pages are touched
+		constexpr int MPOL_INTERLEAVE = 3;
+		constexpr unsigned long MPOL_F_MEMS_ALLOWED = 4;
+		int mode = 0;
+		unsigned long nodes = 0;
+		if ((syscall(SYS_get_mempolicy, &mode, &nodes, sizeof(nodes) * 8, nullptr, MPOL_F_MEMS_ALLOWED) == 0) &&
+			(syscall(SYS_mbind, ptr, size, MPOL_INTERLEAVE, &nodes, sizeof(nodes) * 8, 0) == 0))
+			interleaved = true;
+#else
+		errno = ENOSYS;
+#endif // SYS_mbind && SYS_get_mempolicy
+		if (!interleaved) {
+			std::cerr << "LUTMemory: Could not interleave the huge pages (" << std::strerror(errno)
+				<< "), the pages are allocated on the local node!" << std::endl;
+			allocation = Allocation::HugePages;
+		}
+	}
+
+	bytes = size;
+	return ptr;
+}
+
+static void unmapPages(void* ptr, size_t bytes)
+{
+	munmap(ptr, bytes);
+}
+#endif // _WIN32
+
+template<class T>
+T* LUTMemory::allocate(size_t count, Allocation& allocation)
+{
+	if (allocation != Allocation::Default) {
+		size_t bytes = count * sizeof(T);
+		void* ptr = mapPages(bytes, allocation);
+		if (ptr != nullptr) {
+			std::lock_guard<std::mutex> lock(MAPPINGS_MUTEX);
+			MAPPINGS[ptr] = bytes;
+			return static_cast<T*>(ptr);
+		}
+	}
+	allocation = Allocation::Default;
+	return new T[count];
+}
+
+template<class T>
+void LUTMemory::release(const T* ptr)
+{
+	if (ptr == nullptr)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(MAPPINGS_MUTEX);
+		auto it = MAPPINGS.find(ptr);
+		if (it != MAPPINGS.end()) {
+			unmapPages(const_cast<T*>(ptr), it->second);
+			MAPPINGS.erase(it);
+			return;
+		}
+	}
+	delete[] ptr;
+}
+
+template double* LUTMemory::allocate<double>(size_t count, Allocation& allocation);
+template float* LUTMemory::allocate<float>(size_t count, Allocation& allocation);
+template void LUTMemory::release<double>(const double* ptr);
+template void LUTMemory::release<float>(const float* ptr);
@@ -0,0 +1,61 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef LUTMEMORY_H
+#define LUTMEMORY_H
+
+#include <cstddef>
+
+#include "LUT.h"
+
+namespace LookUpSTORM
+{
+
+/*
+ * Allocation of the LUT templates. Huge pages reduce the TLB misses of the
+ * random template access of the fitter, the interleaved allocation spreads
+ * the pages over all NUMA nodes. If the system does not support the requested
+ * allocation, the next simpler one is used.
+ */
+namespace LUTMemory
+{
+
+// allocates count values of T, allocation is set to the allocation that is used
+template<class T>
+T* allocate(size_t count, Allocation& allocation);
+
+// releases the memory allocated by allocate or by new[]
+template<class T>
+void release(const T* ptr);
+
+} // namespace LUTMemory
+
+} // namespace LookUpSTORM
+
+#endif // !LUTMEMORY_H
@@ -0,0 +1,127 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef LUTSYMMETRY_H
+#define LUTSYMMETRY_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+#include "LUT.h"
+
+namespace LookUpSTORM
+{
+
+/*
+ * class SymmetryMap
+ * Maps the lateral grid positions of a symmetry compressed LUT to the stored
+ * templates. A template at x is the mirror image of the template at
+ * (windowSize - 1) - x, so only the positions up to the window center and the
+ * positions without mirrored partner on the grid are stored. The same map is
+ * used for the x- and y-axis.
+ */
+class SymmetryMap
+{
+public:
+	inline SymmetryMap() {}
+
+	// returns false if the mirrored grid positions are not on the grid
+	inline bool setup(size_t windowSize, size_t countLat, double minLat, double dLat)
+	{
+		m_slot.assign(countLat, 0);
+		m_mirrored.assign(countLat, 0);
+		m_positions.clear();
+
+		// grid index of the position mirrored at the window center
+		const double mirror = ((windowSize - 1.0) - 2.0 * minLat) / dLat;
+		const int64_t m = static_cast<int64_t>(std::round(mirror));
+		if (std::abs(mirror - m) > 1E-6)
+			return false;
+
+		for (size_t i = 0; i < countLat; ++i) {
+			const int64_t partner = m - int64_t(i);
+			if ((partner >= 0) && (partner < int64_t(i))) {
+				m_slot[i] = m_slot[partner];
+				m_mirrored[i] = 1;
+			} else {
+				m_slot[i] = m_positions.size();
+				m_positions.push_back(i);
+			}
+		}
+		return true;
+	}
+
+	// number of stored lateral positions
+	inline size_t slots() const { return m_positions.size(); }
+
+	// stored lateral position of the grid index
+	inline size_t slot(size_t i) const { return m_slot[i]; }
+
+	// grid index of the stored lateral position
+	inline size_t position(size_t slot) const { return m_positions[slot]; }
+
+	// returns true if the template of the grid index is mirrored
+	inline bool mirrored(size_t i) const { return m_mirrored[i] != 0; }
+
+private:
+	std::vector<size_t> m_slot;
+	std::vector<uint8_t> m_mirrored;
+	std::vector<size_t> m_positions;
+
+};
+
+// copies the template src into dst and mirrors it in x and/or y, the derivative
+// in the mirrored direction changes its sign
+template<class S, class D>
+static inline void mirrorTemplate(const S* src, D* dst, size_t windowSize, Layout layout, bool mx, bool my)
+{
+	const size_t n = windowSize * windowSize;
+	const size_t step = (layout == Layout::Planar) ? 1 : 4;
+	const size_t plane = (layout == Layout::Planar) ? n : 1;
+	const D sx = mx ? D(-1) : D(1);
+	const D sy = my ? D(-1) : D(1);
+
+	for (size_t py = 0; py < windowSize; ++py) {
+		const size_t sy0 = my ? windowSize - 1 - py : py;
+		for (size_t px = 0; px < windowSize; ++px) {
+			const size_t sx0 = mx ? windowSize - 1 - px : px;
+			const S* s = src + (sy0 * windowSize + sx0) * step;
+			D* d = dst + (py * windowSize + px) * step;
+			d[0] = static_cast<D>(s[0]);
+			d[plane] = sx * static_cast<D>(s[plane]);
+			d[2 * plane] = sy * static_cast<D>(s[2 * plane]);
+			d[3 * plane] = static_cast<D>(s[3 * plane]);
+		}
+	}
+}
+
+} // namespace LookUpSTORM
+
+#endif // !LUTSYMMETRY_H
@@ -28,47 +28,88 @@
  ****************************************************************************/
 
 #include "LocalMaximumSearch.h"
+#include "Simd.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
 #include <functional>
+#include <limits>
+#include <vector>
 
 namespace LookUpSTORM
 {
 
-template<class T>
-inline T localBackground(const T* data, int x, int y, int w, int h, int W, int H, int stride)
+// summed-area table of the rows [y0, y1) of an image for O(1) box sums, the table is
+// accumulated modulo 2^32 which keeps the sums of small boxes exact
+class BoxSums
 {
-	T ret = 0;
-	int n = 0;
-	auto inc = [&ret, &n, &data, &W, &H, &stride](int x, int y) {
-		if (x >= 0 && y >= 0 && x < W && y < H) {
-			ret += data[x + y * stride];
-			++n;
+public:
+	BoxSums(const ImageU16& image, int y0, int y1, uint32_t* table)
+		: m_image(image), m_y0(y0), m_y1(y1), m_w(image.width() + 1), m_table(table)
+	{
+		std::fill(m_table, m_table + m_w, 0u);
+		for (int y = y0; y < y1; ++y) {
+			const uint16_t* src = image.scanLine(y);
+			const uint32_t* above = m_table + (y - y0) * size_t(m_w);
+			uint32_t* row = m_table + (y - y0 + 1) * size_t(m_w);
+			uint32_t sum = 0;
+			row[0] = 0;
+			for (int x = 0; x < m_w - 1; ++x) {
+				sum += src[x];
+				row[x + 1] = above[x + 1] + sum;
+			}
 		}
-	};
+	}
 
-	if (w == h) {
-		for (int i = 0; i < w; ++i) {
-			inc(x + i, y);
-			inc(x + i, y + h - 1);
-			inc(x, y + i);
-			inc(x + w - 1, y + i);
+	// number of table values for the rows [y0, y1) of an image of the given width
+	static size_t size(int width, int y0, int y1) { return size_t(y1 - y0 + 1) * size_t(width + 1); }
+
+	// mean of the perimeter of the size x size box at (x, y) with the corners counted twice,
+	// pixels outside the image are ignored
+	uint16_t background(int x, int y, int size) const
+	{
+		int n = 0;
+		uint32_t ret = sum(x, y, x + size, y + size, n);
+		if (size > 2) {
+			int inner = 0;
+			ret -= sum(x + 1, y + 1, x + size - 1, y + size - 1, inner);
+			n -= inner;
 		}
+		auto corner = [&](int x, int y) {
+			if (x >= 0 && y >= 0 && x < m_image.width() && y < m_image.height()) {
+				ret += m_image.scanLine(y)[x];
+				++n;
+			}
+		};
+		corner(x, y);
+		corner(x + size - 1, y);
+		corner(x, y + size - 1);
+		corner(x + size - 1, y + size - 1);
+		return uint16_t(n == 0 ? 0 : ret / n);
 	}
-	else {
-		for (int i = 0; i < w; ++i) {
-			inc(x + i, y);
-			inc(x + i, y + h - 1);
-			ret += data[x + i + y * stride];
-			ret += data[x + i + (y + h - 1) * stride];
-		}
-		for (int i = 1; i < (h - 1); ++i) {
-			inc(x, y + i);
-			inc(x + w - 1, y + i);
-		}
+
+private:
+	// sum and number of the pixels of the box [x0, x1) x [y0, y1) clipped to the table
+	inline uint32_t sum(int x0, int y0, int x1, int y1, int& n) const
+	{
+		x0 = std::max(x0, 0);
+		x1 = std::min(x1, m_w - 1);
+		y0 = std::max(y0, m_y0) - m_y0;
+		y1 = std::min(y1, m_y1) - m_y0;
+		if (x0 >= x1 || y0 >= y1)
+			return 0;
+		n += (x1 - x0) * (y1 - y0);
+		const uint32_t* top = m_table + y0 * size_t(m_w);
+		const uint32_t* bottom = m_table + y1 * size_t(m_w);
+		return bottom[x1] - bottom[x0] - top[x1] + top[x0];
 	}
 
-	return (n == 0 ? 0 : ret / n);
-}
+	const ImageU16& m_image;
+	const int m_y0;
+	const int m_y1;
+	const int m_w;
+	uint32_t* m_table;
+};
 
 template<class T>
 inline uint16_t centerMean(const T* data, int x, int y, int W, int H, int stride)
@@ -97,112 +138,269 @@ struct greater
 	bool operator()(const LocalMaximum& f1, const LocalMaximum& f2) { return f1.val > f2.val; }
 };
 
+// minimal number of block rows of a band searched by its own thread
+static constexpr int MIN_BAND_BLOCKS = 8;
+
+// returns false if the image is too small for the search
 template<class T>
-void nms(const Image<T>& image, int r, int b, std::function<void(T, int, int)> maxima)
+inline bool nmsValid(const Image<T>& image, int r, int b)
 {
 	const int bg_radius = r + 1;
+	return (image.width() > (2 * bg_radius + 2 * b + 1)) && (image.height() > (2 * bg_radius + 2 * b + 1));
+}
 
-	if (image.width() <= (2 * bg_radius + 2 * b + 1) || image.height() <= (2 * bg_radius + 2 * b + 1))
+// number of block rows of the search
+template<class T>
+inline int nmsBlockRows(const Image<T>& image, int r, int b)
+{
+	const int h = image.height() - (b + 1);
+	return std::max(0, (h - b + r) / (r + 1));
+}
+
+// number of buffer values of a band: 3r+1 rows of row maxima, the column maxima of a block row and two van Herk/Gil-Werman rows
+inline size_t nmsBufferSize(int width, int r)
+{
+	return size_t(3 * r + 2) * size_t(width) + 2 * size_t(width + 2 * r);
+}
+
+// Running maximum of width 2r+1 of the row src with n pixels (pixels outside the row are ignored)
+// with the van Herk/Gil-Werman algorithm, which needs 3 comparisons per pixel independent of r.
+// g and h are buffers of n + 2r values.
+template<class T>
+static void rowMaximum(const T* src, float* dst, int n, int r, float* g, float* h)
+{
+	const int k = 2 * r + 1;
+	const int m = n + 2 * r;
+	std::fill(h, h + r, std::numeric_limits<float>::lowest());
+	for (int x = 0; x < n; ++x)
+		h[r + x] = float(src[x]);
+	std::fill(h + r + n, h + m, std::numeric_limits<float>::lowest());
+
+	// prefix (g) and suffix (h) maxima of the segments of k values
+	for (int s = 0; s < m; s += k) {
+		const int e = std::min(s + k, m);
+		g[s] = h[s];
+		for (int x = s + 1; x < e; ++x)
+			g[x] = std::max(g[x - 1], h[x]);
+		for (int x = e - 2; x >= s; --x)
+			h[x] = std::max(h[x], h[x + 1]);
+	}
+
+	// the window [x, x + 2r] covers the end of one segment and the start of the next
+	for (int x = 0; x < n; ++x)
+		dst[x] = std::max(h[x], g[x + 2 * r]);
+}
+
+// maximum of the n rows into dst
+template<class T>
+static inline void columnMaximum(const T* const* rows, int n, float* dst, int w)
+{
+	using SIMD::VecF;
+	int x = 0;
+	for (; x + int(VecF::Lanes) <= w; x += int(VecF::Lanes)) {
+		VecF m = VecF::load(rows[0] + x);
+		for (int k = 1; k < n; ++k)
+			m = max(m, VecF::load(rows[k] + x));
+		m.store(dst + x);
+	}
+	for (; x < w; ++x) {
+		float m = float(rows[0][x]);
+		for (int k = 1; k < n; ++k)
+			m = std::max(m, float(rows[k][x]));
+		dst[x] = m;
+	}
+}
+
+// A. Neubeck et.al., 'Efficient Non-MaximumSuppression', 2006, (2n+1)x(2n+1)-Block Algorithm
+// Searches the blocks of the block rows [rowBegin, rowEnd) row by row. The maximum of a block is taken
+// from the column maxima of its block row (the first maximum by columns like a scan of the block) and is
+// a local maximum if the row maxima of width 2r+1 of the 2r+1 rows around it are not larger. The row
+// maxima are kept in a rolling buffer of 3r+1 rows. The blocks only read the image within a radius
+// of r around them, so the bands of block rows can be searched in parallel.
+template<class T>
+void nms(const Image<T>& image, int r, int b, int rowBegin, int rowEnd, float* buffer, const std::function<void(T, int, int)>& maxima)
+{
+	if (!nmsValid(image, r, b))
 		return;
 
-	const int w = image.width() - (b + 1);
-	const int h = image.height() - (b + 1);
+	const int W = image.width();
+	const int H = image.height();
+	const int k = 3 * r + 1;
+	const int w = W - (b + 1);
+	const int h = std::min(H - (b + 1), b + rowEnd * (r + 1));
 
-	T value, canidate;
+	float* rowMax = buffer;
+	float* colMax = rowMax + k * size_t(W);
+	float* g = colMax + W;
+	float* gh = g + (W + 2 * r);
+	std::vector<const T*> src(r + 1);
 
-	// A. Neubeck et.al., 'Efficient Non-MaximumSuppression', 2006, (2n+1)(2n+1)-Block Algorithm
-	// with sorted insert into a list
-	for (int i = b; i < w; i += (r + 1)) {
-		for (int j = b; j < h; j += (r + 1)) {
-			int mi = i;
-			int mj = j;
-			for (int i2 = i; i2 <= i + r; ++i2) {
-				for (int j2 = j; j2 <= j + r; ++j2) {
-					if (!image.pixel(i2, j2, value))
-						continue;
-					if (value > image(mi, mj)) {
-						mi = i2;
-						mj = j2;
-					}
-				}
-			}
+	int next = std::max(0, b + rowBegin * (r + 1) - r);
+	for (int j = b + rowBegin * (r + 1); j < h; j += (r + 1)) {
+		const int jEnd = std::min(j + r, H - 1);
 
-			canidate = image(mi, mj);
-			for (int i2 = mi - r; i2 <= mi + r; ++i2) {
-				for (int j2 = mj - r; j2 <= mj + r; ++j2) {
-					if (!image.pixel(i2, j2, value))
-						continue;
-					if (value > canidate)
-						goto failed;
-				}
-			}
+		// the row maxima of the rows [j - r, jEnd + r]
+		for (; next <= std::min(jEnd + r, H - 1); ++next)
+			rowMaximum(image.scanLine(next), rowMax + (next % k) * size_t(W), W, r, g, gh);
 
-			maxima(canidate, mi, mj);
+		for (int y = j; y <= jEnd; ++y)
+			src[y - j] = image.scanLine(y);
+		columnMaximum(src.data(), jEnd - j + 1, colMax, W);
 
-		failed:;
+		for (int i = b; i < w; i += (r + 1)) {
+			const int iEnd = std::min(i + r, W - 1);
+			float value = colMax[i];
+			for (int i2 = i + 1; i2 <= iEnd; ++i2)
+				value = std::max(value, colMax[i2]);
+
+			int mi = i;
+			while ((mi < iEnd) && (colMax[mi] != value))
+				++mi;
+			int mj = j;
+			while ((mj < jEnd) && (float(src[mj - j][mi]) != value))
+				++mj;
+			const T canidate = src[mj - j][mi];
+
+			float neighbors = std::numeric_limits<float>::lowest();
+			for (int y = std::max(0, mj - r); y <= std::min(H - 1, mj + r); ++y)
+				neighbors = std::max(neighbors, rowMax[(y % k) * size_t(W) + mi]);
+			if (!(neighbors > float(canidate)))
+				maxima(canidate, mi, mj);
 		}
 	}
 }
 
+// Splits the search into horizontal bands of block rows which are searched by up to 'threads' threads.
+// Each maximum lies within its block, so every maximum is found by exactly one band and the bands
+// do not need to be deduplicated at their seams. Each band has a summed-area table of the raw image
+// rows of its blocks and their background boxes. The accept function adds the maxima to the features
+// of the band, which are returned in the order of the original search (by block columns).
+template<class T>
+std::vector<LocalMaximum> nmsBands(const Image<T>& image, const ImageU16& raw, int r, int b, int threads,
+	ThreadPool* pool, std::vector<float>& buffers, std::vector<uint32_t>& sums,
+	const std::function<void(T, int, int, const BoxSums&, std::vector<LocalMaximum>&)>& accept)
+{
+	std::vector<LocalMaximum> features;
+	if (!nmsValid(image, r, b))
+		return features;
+
+	const int H = image.height();
+	const int rows = nmsBlockRows(image, r, b);
+	const int bands = std::max(1, std::min(threads, rows / MIN_BAND_BLOCKS));
+	std::vector<std::vector<LocalMaximum>> found(bands);
+
+	// rows of the summed-area table of a band, the background box of (x, y) starts at (x - 1, y - 1)
+	auto sumRows = [&](int band, int& y0, int& y1) {
+		y0 = std::max(0, b + (rows * band / bands) * (r + 1) - 1);
+		y1 = std::min(H, b + (rows * (band + 1) / bands) * (r + 1) + r);
+	};
+	const size_t bufferSize = nmsBufferSize(image.width(), r);
+	std::vector<size_t> offsets(bands + 1, 0);
+	for (int band = 0; band < bands; ++band) {
+		int y0, y1;
+		sumRows(band, y0, y1);
+		offsets[band + 1] = offsets[band] + BoxSums::size(image.width(), y0, y1);
+	}
+	buffers.resize(bands * bufferSize);
+	sums.resize(offsets[bands]);
+
+	auto job = [&](int band) {
+		int y0, y1;
+		sumRows(band, y0, y1);
+		const BoxSums boxSums(raw, y0, y1, sums.data() + offsets[band]);
+		std::vector<LocalMaximum>& f = found[band];
+		nms<T>(image, r, b, rows * band / bands, rows * (band + 1) / bands, buffers.data() + band * bufferSize,
+			[&accept, &boxSums, &f](T canidate, int x, int y) { accept(canidate, x, y, boxSums, f); });
+	};
+	if ((bands > 1) && pool) {
+		pool->run(size_t(bands), size_t(bands), [&job](size_t band) { job(int(band)); });
+	}
+	else {
+		for (int band = 0; band < bands; ++band)
+			job(band);
+	}
+
+	if (bands == 1) {
+		features = std::move(found[0]);
+	}
+	else {
+		size_t n = 0;
+		for (const auto& f : found)
+			n += f.size();
+		features.reserve(n);
+		for (const auto& f : found)
+			features.insert(features.end(), f.begin(), f.end());
+	}
+
+	// the bands are searched row by row, the original search visits the block columns in the outer loop
+	const int step = r + 1;
+	std::stable_sort(features.begin(), features.end(), [step, b](const LocalMaximum& f1, const LocalMaximum& f2) {
+		return (f1.x - b) / step < (f2.x - b) / step;
+	});
+	return features;
+}
+
+// sorts the features by their value (descending), features of the same value are
+// in reverse search order like the sorted insert into a list
+static std::list<LocalMaximum> sortFeatures(std::vector<LocalMaximum>& features)
+{
+	std::reverse(features.begin(), features.end());
+	std::stable_sort(features.begin(), features.end(), greater());
+	return std::list<LocalMaximum>(features.begin(), features.end());
+}
+
 }
 
 using namespace LookUpSTORM;
 
 LocalMaximumSearch::LocalMaximumSearch(int border, int radius)
-    : m_border(border), m_radius(radius)
+    : m_border(border), m_radius(radius), m_threads(1), m_ownPool(false)
 {
 }
 
 std::list<LocalMaximum> LocalMaximumSearch::find(ImageU16 image, uint16_t threshold)
 {
-    std::list<LocalMaximum> features;
 	const int bg_radius = m_radius + 1;
-	nms<uint16_t>(image, m_radius, m_border, 
-		[&](uint16_t canidate, int x, int y) {
-			uint16_t localBg = localBackground(image.constData(), x - 1, y - 1, bg_radius, bg_radius, image.width(), image.height(), image.stride());
+	std::vector<LocalMaximum> features = nmsBands<uint16_t>(image, image, m_radius, m_border, m_threads, pool(), m_buffers, m_sums,
+		[&](uint16_t canidate, int x, int y, const BoxSums& sums, std::vector<LocalMaximum>& features) {
+			uint16_t localBg = sums.background(x - 1, y - 1, bg_radius);
 			uint16_t mean = centerMean(image.constData(), x, y, image.width(), image.height(), image.stride());
 			if ((canidate - localBg) < threshold || (mean - localBg) < threshold)
 				return;
 
-			LocalMaximum f = { canidate, localBg, x, y };
-			features.insert(std::lower_bound(features.begin(), features.end(), f, greater()), f);
+			features.push_back({ canidate, localBg, x, y });
 		});
 
-    return features;
+    return sortFeatures(features);
 }
 
 std::list<LocalMaximum> LocalMaximumSearch::find(const ImageU16& image, const ImageF32& filteredImage, float filterThreshold)
 {
-	std::list<LocalMaximum> features;
-
 	const int bg_radius = m_radius + 1;
-	nms<float>(filteredImage, m_radius, m_border, 
-		[&](float canidate, int x, int y) {
+	std::vector<LocalMaximum> features = nmsBands<float>(filteredImage, image, m_radius, m_border, m_threads, pool(), m_buffers, m_sums,
+		[&](float canidate, int x, int y, const BoxSums& sums, std::vector<LocalMaximum>& features) {
 
 			if (canidate < filterThreshold)
 				return;
 
 			uint16_t found = image(x, y);
-			uint16_t localBg = localBackground(image.constData(), x - 1, y - 1, bg_radius, bg_radius, image.width(), image.height(), image.stride());
+			uint16_t localBg = sums.background(x - 1, y - 1, bg_radius);
 
-			LocalMaximum f = { found, localBg, x, y };
-			features.insert(std::lower_bound(features.begin(), features.end(), f, greater()), f);
+			features.push_back({ found, localBg, x, y });
 		});
 
-	return features;
+	return sortFeatures(features);
 }
 
 std::list<LocalMaximum> LookUpSTORM::LocalMaximumSearch::findAll(const ImageU16& image)
 {
-	std::list<LocalMaximum> features;
 	const int bg_radius = m_radius + 1;
-	nms<uint16_t>(image, m_radius, m_border, 
-		[&](uint16_t canidate, int x, int y) {
-			uint16_t localBg = localBackground(image.constData(), x - 1, y - 1, bg_radius, bg_radius, image.width(), image.height(), image.stride());
-			features.push_back({ canidate, localBg, x, y });
+	std::vector<LocalMaximum> features = nmsBands<uint16_t>(image, image, m_radius, m_border, m_threads, pool(), m_buffers, m_sums,
+		[&](uint16_t canidate, int x, int y, const BoxSums& sums, std::vector<LocalMaximum>& features) {
+			features.push_back({ canidate, sums.background(x - 1, y - 1, bg_radius), x, y });
 		});
 
-	return features;
+	return std::list<LocalMaximum>(features.begin(), features.end());
 }
 
 int LocalMaximumSearch::border() const
@@ -223,4 +421,31 @@ int LocalMaximumSearch::radius() const
 void LocalMaximumSearch::setRadius(int radius)
 {
     m_radius = radius;
-}
\ No newline at end of file
+}
+
+int LocalMaximumSearch::threads() const
+{
+    return m_threads;
+}
+
+void LocalMaximumSearch::setThreads(int threads)
+{
+    m_threads = std::max(1, threads);
+    if (m_ownPool && (m_pool->threads() != size_t(m_threads - 1)))
+        m_pool->setThreads(size_t(m_threads - 1));
+}
+
+void LocalMaximumSearch::setThreadPool(std::shared_ptr<ThreadPool> pool)
+{
+    m_pool = std::move(pool);
+    m_ownPool = false;
+}
+
+ThreadPool* LocalMaximumSearch::pool()
+{
+    if ((m_threads > 1) && !m_pool) {
+        m_pool = std::make_shared<ThreadPool>(size_t(m_threads - 1));
+        m_ownPool = true;
+    }
+    return m_pool.get();
+}
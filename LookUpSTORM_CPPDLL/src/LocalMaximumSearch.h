@@ -31,11 +31,15 @@
 #define LOCALMAXIMUMSEARCH_H
 
 #include <list>
+#include <memory>
+#include <vector>
 #include "Image.h"
 
 namespace LookUpSTORM
 {
 
+class ThreadPool;
+
 struct LocalMaximum {
 	uint16_t val;
 	uint16_t localBg;
@@ -60,9 +64,27 @@ public:
 	int radius() const;
 	void setRadius(int radius);
 
+	// number of threads searching horizontal bands of the image (default is 1),
+	// the found maxima do not depend on the number of threads
+	int threads() const;
+	void setThreads(int threads);
+
+	// pool whose helper threads search the bands, without a pool the search
+	// starts its own threads - 1 helper threads on the first search
+	void setThreadPool(std::shared_ptr<ThreadPool> pool);
+
 private:
+	// returns the pool of the bands (null for a single thread)
+	ThreadPool* pool();
+
 	int m_border;
 	int m_radius;
+	int m_threads;
+	std::shared_ptr<ThreadPool> m_pool;
+	bool m_ownPool;
+	// row maxima and summed-area tables of the bands
+	std::vector<float> m_buffers;
+	std::vector<uint32_t> m_sums;
 
 };
 
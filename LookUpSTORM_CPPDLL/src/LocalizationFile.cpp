@@ -0,0 +1,527 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "LocalizationFile.h"
+#include "LUTFile.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+
+using namespace LookUpSTORM;
+
+static const char LOCALIZATION_ID[8] = { 'L','O','C','S','M','L','M','\0' };
+
+// rows of the CSV file formatted before they are written
+static constexpr size_t CSV_BLOCK_ROWS = 4096;
+// maximum characters of a CSV row
+static constexpr size_t CSV_ROW_SIZE = 10 * 24;
+
+static inline void putU32(uint8_t* dst, uint32_t value)
+{
+	for (size_t i = 0; i < 4; ++i)
+		dst[i] = static_cast<uint8_t>((value >> (8 * i)) & 0xFF);
+}
+
+static inline void putU64(uint8_t* dst, uint64_t value)
+{
+	for (size_t i = 0; i < 8; ++i)
+		dst[i] = static_cast<uint8_t>((value >> (8 * i)) & 0xFF);
+}
+
+static inline uint32_t getU32(const uint8_t* src)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < 4; ++i)
+		value |= uint32_t(src[i]) << (8 * i);
+	return value;
+}
+
+static inline uint64_t getU64(const uint8_t* src)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < 8; ++i)
+		value |= uint64_t(src[i]) << (8 * i);
+	return value;
+}
+
+static inline uint32_t bitsOf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline float floatOf(uint32_t bits)
+{
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// value columns of a block after the frame column
+static double LocalizationRecord::* const VALUE_COLUMNS[] = {
+	&LocalizationRecord::x, &LocalizationRecord::y, &LocalizationRecord::z,
+	&LocalizationRecord::intensity, &LocalizationRecord::background,
+	&LocalizationRecord::crlbX, &LocalizationRecord::crlbY, &LocalizationRecord::crlbZ
+};
+
+// PackBits: a header n < 128 is followed by n + 1 literal bytes,
+// a header n > 128 repeats the next byte 257 - n times
+static void packBits(const uint8_t* src, size_t size, std::vector<uint8_t>& dst)
+{
+	size_t i = 0;
+	while (i < size) {
+		size_t run = 1;
+		while ((i + run < size) && (run < 128) && (src[i + run] == src[i]))
+			++run;
+		if (run >= 3) {
+			dst.push_back(static_cast<uint8_t>(257 - run));
+			dst.push_back(src[i]);
+			i += run;
+			continue;
+		}
+		// literals until the next run of at least 3 bytes
+		size_t end = i;
+		while ((end < size) && (end - i < 128)) {
+			if ((end + 2 < size) && (src[end] == src[end + 1]) && (src[end] == src[end + 2]))
+				break;
+			++end;
+		}
+		dst.push_back(static_cast<uint8_t>(end - i - 1));
+		dst.insert(dst.end(), src + i, src + end);
+		i = end;
+	}
+}
+
+// inverse of packBits, returns false if the runs do not decode to exactly size bytes
+static bool unpackBits(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t size)
+{
+	size_t i = 0, n = 0;
+	while (i < srcSize) {
+		const uint8_t header = src[i++];
+		if (header < 128) {
+			const size_t count = size_t(header) + 1;
+			if ((i + count > srcSize) || (n + count > size))
+				return false;
+			std::memcpy(dst + n, src + i, count);
+			i += count;
+			n += count;
+		} else if (header > 128) {
+			const size_t count = 257 - size_t(header);
+			if ((i >= srcSize) || (n + count > size))
+				return false;
+			std::memset(dst + n, src[i++], count);
+			n += count;
+		}
+	}
+	return n == size;
+}
+
+// fixed point formatting without locale and printf overhead
+static inline char* appendInt(char* p, int64_t value)
+{
+	char digits[20];
+	uint64_t v = (value < 0) ? uint64_t(-(value + 1)) + 1 : uint64_t(value);
+	if (value < 0)
+		*p++ = '-';
+	size_t n = 0;
+	do {
+		digits[n++] = char('0' + v % 10);
+		v /= 10;
+	} while (v > 0);
+	while (n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+static inline char* appendFixed(char* p, double value, int decimals)
+{
+	static const int64_t scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+	if (!std::isfinite(value)) {
+		const char* text = std::isnan(value) ? "NaN" : (value > 0 ? "Infinity" : "-Infinity");
+		const size_t n = std::strlen(text);
+		std::memcpy(p, text, n);
+		return p + n;
+	}
+	const int64_t scale = scales[decimals];
+	// exponent notation for values beyond the range of the fixed point
+	if (std::abs(value) * scale >= 9.0E18)
+		return p + std::snprintf(p, 24, "%.6E", value);
+
+	const int64_t fixed = std::llround(std::abs(value) * scale);
+	if ((value < 0) && (fixed != 0))
+		*p++ = '-';
+	p = appendInt(p, fixed / scale);
+	*p++ = '.';
+	int64_t fraction = fixed % scale;
+	for (int64_t s = scale / 10; s > 0; s /= 10) {
+		*p++ = char('0' + fraction / s);
+		fraction %= s;
+	}
+	return p;
+}
+
+void HeaderLocalizations::encode(char* buffer) const
+{
+	uint8_t* dst = reinterpret_cast<uint8_t*>(buffer);
+	std::memset(dst, 0, Size);
+	std::memcpy(dst, LOCALIZATION_ID, sizeof(LOCALIZATION_ID));
+	putU32(dst + 8, version);
+	putU32(dst + 12, columns);
+	putU32(dst + 16, compressed);
+	putU32(dst + 20, blockRows);
+	putU64(dst + 24, rows);
+	putU64(dst + 32, blocks);
+	putU32(dst + Size - 4, crc32(0, dst, Size - 4));
+}
+
+bool HeaderLocalizations::decode(const char* buffer)
+{
+	const uint8_t* src = reinterpret_cast<const uint8_t*>(buffer);
+	if ((std::memcmp(src, LOCALIZATION_ID, sizeof(LOCALIZATION_ID)) != 0) ||
+		(getU32(src + Size - 4) != crc32(0, src, Size - 4)))
+		return false;
+	version = getU32(src + 8);
+	columns = getU32(src + 12);
+	compressed = getU32(src + 16);
+	blockRows = getU32(src + 20);
+	rows = getU64(src + 24);
+	blocks = getU64(src + 32);
+	return true;
+}
+
+LocalizationWriter::LocalizationWriter()
+	: m_format(LocalizationFormat::Binary)
+{
+}
+
+LocalizationWriter::~LocalizationWriter()
+{
+	if (isOpen())
+		close();
+}
+
+bool LocalizationWriter::open(const std::string& fileName, LocalizationFormat format)
+{
+	if (isOpen())
+		close();
+
+	m_file.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_file) {
+		std::cerr << "LocalizationWriter: Could not open " << fileName << std::endl;
+		return false;
+	}
+
+	m_format = format;
+	m_header = HeaderLocalizations();
+	m_header.compressed = (format == LocalizationFormat::BinaryCompressed) ? 1 : 0;
+	m_rows.clear();
+	if (format == LocalizationFormat::CSV) {
+		m_rows.reserve(CSV_BLOCK_ROWS);
+		m_buffer.resize(CSV_BLOCK_ROWS * CSV_ROW_SIZE);
+		static const char header[] = "index,frame,x_nm,y_nm,z_nm,intensity,background,crlb_x,crlb_y,crlb_z\n";
+		m_file.write(header, sizeof(header) - 1);
+	} else {
+		// the header is written by close, until then the file has no valid id
+		m_rows.reserve(m_header.blockRows);
+		const char padding[HeaderLocalizations::Size] = { 0 };
+		m_file.write(padding, sizeof(padding));
+	}
+	return bool(m_file);
+}
+
+bool LocalizationWriter::write(const LocalizationRecord* records, size_t count)
+{
+	if (!isOpen())
+		return false;
+
+	const size_t blockRows = (m_format == LocalizationFormat::CSV) ? CSV_BLOCK_ROWS : m_header.blockRows;
+	while (count > 0) {
+		const size_t n = std::min(count, blockRows - m_rows.size());
+		m_rows.insert(m_rows.end(), records, records + n);
+		records += n;
+		count -= n;
+		if (m_rows.size() == blockRows) {
+			if (m_format == LocalizationFormat::CSV)
+				writeCSV();
+			else
+				writeBlock();
+		}
+	}
+	return bool(m_file);
+}
+
+void LocalizationWriter::appendColumn(size_t size, bool compress)
+{
+	const size_t rows = m_rows.size();
+	const uint8_t* data = m_column.data();
+	if (compress) {
+		// byte planes, so the similar high bytes of the values form runs
+		std::vector<uint8_t>& planes = m_encoded;
+		planes.resize(size);
+		for (size_t i = 0; i < rows; ++i)
+			for (size_t b = 0; b < 4; ++b)
+				planes[b * rows + i] = data[4 * i + b];
+		m_column.clear();
+		packBits(planes.data(), size, m_column);
+		data = m_column.data();
+		size = m_column.size();
+	}
+
+	uint8_t prefix[8];
+	putU32(prefix, static_cast<uint32_t>(size));
+	putU32(prefix + 4, crc32(0, data, size));
+	m_file.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+	m_file.write(reinterpret_cast<const char*>(data), size);
+}
+
+void LocalizationWriter::writeBlock()
+{
+	const size_t rows = m_rows.size();
+	if (rows == 0)
+		return;
+	const bool compress = (m_header.compressed != 0);
+	const size_t size = 4 * rows;
+
+	uint8_t count[4];
+	putU32(count, static_cast<uint32_t>(rows));
+	m_file.write(reinterpret_cast<const char*>(count), sizeof(count));
+
+	int32_t previous = 0;
+	m_column.resize(size);
+	for (size_t i = 0; i < rows; ++i) {
+		const int32_t frame = m_rows[i].frame;
+		putU32(m_column.data() + 4 * i, static_cast<uint32_t>(compress ? frame - previous : frame));
+		previous = frame;
+	}
+	appendColumn(size, compress);
+
+	for (const auto column : VALUE_COLUMNS) {
+		m_column.resize(size);
+		for (size_t i = 0; i < rows; ++i)
+			putU32(m_column.data() + 4 * i, bitsOf(static_cast<float>(m_rows[i].*column)));
+		appendColumn(size, compress);
+	}
+
+	m_header.rows += rows;
+	++m_header.blocks;
+	m_rows.clear();
+}
+
+void LocalizationWriter::writeCSV()
+{
+	char* p = m_buffer.data();
+	for (const auto& r : m_rows) {
+		p = appendInt(p, static_cast<int64_t>(++m_header.rows));
+		*p++ = ',';
+		p = appendInt(p, static_cast<int64_t>(r.frame) + 1);
+		const double values[] = { r.x, r.y, r.z, r.intensity, r.background, r.crlbX, r.crlbY, r.crlbZ };
+		for (double v : values) {
+			*p++ = ',';
+			p = appendFixed(p, v, 3);
+		}
+		*p++ = '\n';
+	}
+	m_file.write(m_buffer.data(), p - m_buffer.data());
+	m_rows.clear();
+}
+
+bool LocalizationWriter::close()
+{
+	if (!isOpen())
+		return false;
+
+	if (m_format == LocalizationFormat::CSV) {
+		writeCSV();
+	} else {
+		writeBlock();
+		char hdr[HeaderLocalizations::Size];
+		m_header.encode(hdr);
+		m_file.seekp(0);
+		m_file.write(hdr, sizeof(hdr));
+	}
+
+	const bool ok = bool(m_file);
+	m_file.close();
+	m_rows.clear();
+	m_rows.shrink_to_fit();
+	m_buffer.clear();
+	m_buffer.shrink_to_fit();
+	return ok;
+}
+
+bool LocalizationWriter::isOpen() const
+{
+	return m_file.is_open();
+}
+
+uint64_t LocalizationWriter::rows() const
+{
+	return m_header.rows + m_rows.size();
+}
+
+LocalizationReader::LocalizationReader()
+	: m_block(0)
+	, m_corrupt(false)
+{
+}
+
+bool LocalizationReader::open(const std::string& fileName)
+{
+	close();
+	m_file.open(fileName, std::ios::in | std::ios::binary);
+	if (!m_file) {
+		std::cerr << "LocalizationReader: Could not open " << fileName << std::endl;
+		return false;
+	}
+
+	char hdr[HeaderLocalizations::Size];
+	if (!m_file.read(hdr, sizeof(hdr)) || !m_header.decode(hdr))
+		return fail("Header is not valid!");
+	if ((m_header.version != 1) || (m_header.columns != HeaderLocalizations::Columns) ||
+		(m_header.compressed > 1) || (m_header.blockRows == 0))
+		return fail("Version or columns are not supported!");
+	return true;
+}
+
+bool LocalizationReader::fail(const char* message)
+{
+	std::cerr << "LocalizationReader: " << message << std::endl;
+	m_corrupt = true;
+	m_file.close();
+	return false;
+}
+
+// reads the next column of rows values into m_column and checks its CRC
+bool LocalizationReader::readColumn(size_t rows)
+{
+	const size_t size = 4 * rows;
+	uint8_t prefix[8];
+	if (!m_file.read(reinterpret_cast<char*>(prefix), sizeof(prefix)))
+		return false;
+	const size_t stored = getU32(prefix);
+	// a PackBits literal run adds one byte to 128 bytes
+	if (m_header.compressed ? (stored > size + size / 128 + 1) : (stored != size))
+		return false;
+	m_encoded.resize(stored);
+	if (!m_file.read(reinterpret_cast<char*>(m_encoded.data()), stored) ||
+		(getU32(prefix + 4) != crc32(0, m_encoded.data(), stored)))
+		return false;
+
+	m_column.resize(size);
+	if (!m_header.compressed) {
+		std::memcpy(m_column.data(), m_encoded.data(), size);
+		return true;
+	}
+	// byte planes back into little endian values
+	std::vector<uint8_t> planes(size);
+	if (!unpackBits(m_encoded.data(), stored, planes.data(), size))
+		return false;
+	for (size_t i = 0; i < rows; ++i)
+		for (size_t b = 0; b < 4; ++b)
+			m_column[4 * i + b] = planes[b * rows + i];
+	return true;
+}
+
+bool LocalizationReader::read(std::vector<LocalizationRecord>& records)
+{
+	records.clear();
+	if (!isOpen() || (m_block >= m_header.blocks))
+		return false;
+
+	uint8_t count[4];
+	if (!m_file.read(reinterpret_cast<char*>(count), sizeof(count)))
+		return fail("File is truncated!");
+	const size_t rows = getU32(count);
+	if ((rows == 0) || (rows > m_header.blockRows))
+		return fail("Number of rows of a block is not valid!");
+
+	records.resize(rows);
+	if (!readColumn(rows))
+		return fail("Frame column is corrupt!");
+	int32_t previous = 0;
+	for (size_t i = 0; i < rows; ++i) {
+		const int32_t value = static_cast<int32_t>(getU32(m_column.data() + 4 * i));
+		records[i].frame = m_header.compressed ? static_cast<int32_t>(uint32_t(previous) + uint32_t(value)) : value;
+		previous = records[i].frame;
+	}
+	for (const auto column : VALUE_COLUMNS) {
+		if (!readColumn(rows))
+			return fail("Value column is corrupt!");
+		for (size_t i = 0; i < rows; ++i)
+			records[i].*column = floatOf(getU32(m_column.data() + 4 * i));
+	}
+	++m_block;
+	return true;
+}
+
+void LocalizationReader::close()
+{
+	if (m_file.is_open())
+		m_file.close();
+	m_header = HeaderLocalizations();
+	m_block = 0;
+	m_corrupt = false;
+}
+
+bool LocalizationReader::isOpen() const
+{
+	return m_file.is_open();
+}
+
+bool LocalizationReader::isCorrupt() const
+{
+	return m_corrupt;
+}
+
+const HeaderLocalizations& LocalizationReader::header() const
+{
+	return m_header;
+}
+
+bool LocalizationReader::verify(const std::string& fileName)
+{
+	LocalizationReader reader;
+	if (!reader.open(fileName))
+		return false;
+	std::vector<LocalizationRecord> records;
+	uint64_t rows = 0;
+	while (reader.read(records))
+		rows += records.size();
+	if (reader.isCorrupt())
+		return false;
+	if (rows != reader.header().rows) {
+		std::cerr << "LocalizationReader: Number of rows does not match the header!" << std::endl;
+		return false;
+	}
+	return true;
+}
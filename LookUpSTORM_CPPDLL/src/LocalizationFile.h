@@ -0,0 +1,167 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef LOCALIZATIONFILE_H
+#define LOCALIZATIONFILE_H
+
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include "LocalizationStore.h"
+
+namespace LookUpSTORM
+{
+
+// localization in physical units as written to a file, the CSV file is formatted from
+// the double values, the binary file stores them as float32
+struct LocalizationRecord
+{
+	int32_t frame = 0;
+	// position in nm
+	double x = 0.0;
+	double y = 0.0;
+	double z = 0.0;
+	// photons
+	double intensity = 0.0;
+	double background = 0.0;
+	// CRLB in nm, NaN if not available
+	double crlbX = std::numeric_limits<double>::quiet_NaN();
+	double crlbY = std::numeric_limits<double>::quiet_NaN();
+	double crlbZ = std::numeric_limits<double>::quiet_NaN();
+};
+
+// header of the binary localization file (64 bytes, little endian), followed by blocks of 
+// at most blockRows localizations. Each block starts with its number of rows (uint32) and 
+// holds the columns frame (int32), x, y, z, intensity, background, crlb_x, crlb_y, crlb_z
+// (float32) one after another, each prefixed with its stored size and CRC-32 (uint32 each).
+// Compressed blocks store the frame column delta coded and every column with its bytes 
+// shuffled into planes and run-length encoded (PackBits).
+struct HeaderLocalizations
+{
+	static constexpr size_t Size = 64;
+	static constexpr uint32_t Columns = 9;
+	static constexpr uint32_t BlockRows = 1u << 16;
+
+	uint32_t version = 1;
+	uint32_t columns = Columns;
+	uint32_t compressed = 0;
+	uint32_t blockRows = BlockRows;
+	uint64_t rows = 0;
+	uint64_t blocks = 0;
+
+	// writes the header into buffer (Size bytes) including its CRC
+	void encode(char* buffer) const;
+	// reads the header from buffer (Size bytes), returns false if the id or CRC is wrong
+	bool decode(const char* buffer);
+};
+
+/*
+ * class LocalizationWriter
+ * Streams localizations into a binary (see HeaderLocalizations) or a CSV file with the 
+ * header of the Java plugin. The rows are buffered and written in blocks, the header 
+ * of the binary file is completed by close.
+ */
+class LocalizationWriter
+{
+public:
+	LocalizationWriter();
+	~LocalizationWriter();
+
+	LocalizationWriter(const LocalizationWriter&) = delete;
+	LocalizationWriter& operator=(const LocalizationWriter&) = delete;
+
+	bool open(const std::string& fileName, LocalizationFormat format);
+	bool write(const LocalizationRecord* records, size_t count);
+	// writes the remaining rows and the header
+	bool close();
+
+	bool isOpen() const;
+	uint64_t rows() const;
+
+private:
+	void writeBlock();
+	void writeCSV();
+	void appendColumn(size_t size, bool compress);
+
+	std::ofstream m_file;
+	LocalizationFormat m_format;
+	HeaderLocalizations m_header;
+	std::vector<LocalizationRecord> m_rows;
+	std::vector<uint8_t> m_column;
+	std::vector<uint8_t> m_encoded;
+	std::vector<char> m_buffer;
+
+};
+
+/*
+ * class LocalizationReader
+ * Reads a binary localization file (see HeaderLocalizations) block by block and checks
+ * the CRC of each column.
+ */
+class LocalizationReader
+{
+public:
+	LocalizationReader();
+
+	LocalizationReader(const LocalizationReader&) = delete;
+	LocalizationReader& operator=(const LocalizationReader&) = delete;
+
+	// opens the file and checks its header
+	bool open(const std::string& fileName);
+	// reads the rows of the next block into records, returns false at the end of the
+	// file or if the block is corrupt (see isCorrupt)
+	bool read(std::vector<LocalizationRecord>& records);
+	void close();
+
+	bool isOpen() const;
+	bool isCorrupt() const;
+	const HeaderLocalizations& header() const;
+
+	// reads all blocks of the file, returns false if the file is corrupt or incomplete
+	static bool verify(const std::string& fileName);
+
+private:
+	bool fail(const char* message);
+	bool readColumn(size_t rows);
+
+	std::ifstream m_file;
+	HeaderLocalizations m_header;
+	uint64_t m_block;
+	bool m_corrupt;
+	std::vector<uint8_t> m_column;
+	std::vector<uint8_t> m_encoded;
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !LOCALIZATIONFILE_H
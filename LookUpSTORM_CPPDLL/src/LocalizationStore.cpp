@@ -0,0 +1,398 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "LocalizationStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace LookUpSTORM;
+
+static_assert((LocalizationStore::BlockSize & (LocalizationStore::BlockSize - 1)) == 0, "Block size has to be a power of 2");
+
+// the columns of a block share a single allocation, ordered by size so
+// each column is aligned to at least 64 bytes
+struct LocalizationStore::Block
+{
+	std::unique_ptr<uint8_t[]> memory;
+	size_t count;
+	double* x;
+	double* y;
+	float* background;
+	float* peak;
+	float* z;
+	float* xfit;
+	float* yfit;
+	float* time_us;
+	int32_t* frame;
+
+	Block() 
+		: memory(new uint8_t[BlockSize * BytesPerLocalization])
+		, count(0)
+	{
+		uint8_t* ptr = memory.get();
+		x = reinterpret_cast<double*>(ptr); ptr += BlockSize * sizeof(double);
+		y = reinterpret_cast<double*>(ptr); ptr += BlockSize * sizeof(double);
+		background = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		peak = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		z = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		xfit = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		yfit = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		time_us = reinterpret_cast<float*>(ptr); ptr += BlockSize * sizeof(float);
+		frame = reinterpret_cast<int32_t*>(ptr);
+	}
+
+	void set(size_t i, const Molecule& mol)
+	{
+		background[i] = static_cast<float>(mol.background);
+		peak[i] = static_cast<float>(mol.peak);
+		x[i] = mol.x;
+		y[i] = mol.y;
+		z[i] = static_cast<float>(mol.z);
+		frame[i] = static_cast<int32_t>(mol.frame);
+		xfit[i] = static_cast<float>(mol.xfit);
+		yfit[i] = static_cast<float>(mol.yfit);
+		time_us[i] = static_cast<float>(mol.time_us);
+	}
+
+	void copyFrom(const Block& other)
+	{
+		count = other.count;
+		std::copy_n(other.memory.get(), BlockSize * BytesPerLocalization, memory.get());
+	}
+};
+
+Molecule LocalizationBlock::molecule(size_t i) const
+{
+	Molecule mol;
+	mol.background = background[i];
+	mol.peak = peak[i];
+	mol.x = x[i];
+	mol.y = y[i];
+	mol.z = z[i];
+	mol.frame = frame[i];
+	mol.xfit = xfit[i];
+	mol.yfit = yfit[i];
+	mol.time_us = time_us[i];
+	return mol;
+}
+
+LocalizationStore::LocalizationStore()
+	: m_size(0)
+	, m_framesSorted(true)
+{
+}
+
+LocalizationStore::LocalizationStore(const LocalizationStore& other)
+	: LocalizationStore()
+{
+	*this = other;
+}
+
+LocalizationStore::LocalizationStore(LocalizationStore&& other) noexcept
+	: LocalizationStore()
+{
+	swap(other);
+}
+
+LocalizationStore::~LocalizationStore()
+{
+}
+
+LocalizationStore& LocalizationStore::operator=(const LocalizationStore& other)
+{
+	if (this == &other)
+		return *this;
+	m_blocks.resize(other.m_blocks.size());
+	for (size_t i = 0; i < m_blocks.size(); ++i) {
+		if (!m_blocks[i])
+			m_blocks[i].reset(new Block);
+		m_blocks[i]->copyFrom(*other.m_blocks[i]);
+	}
+	m_size = other.m_size;
+	m_frames = other.m_frames;
+	m_framesSorted = other.m_framesSorted;
+	return *this;
+}
+
+LocalizationStore& LocalizationStore::operator=(LocalizationStore&& other) noexcept
+{
+	swap(other);
+	return *this;
+}
+
+LocalizationStore::Block& LocalizationStore::writeBlock()
+{
+	const size_t b = m_size / BlockSize;
+	if (b >= m_blocks.size())
+		m_blocks.emplace_back(new Block);
+	return *m_blocks[b];
+}
+
+void LocalizationStore::append(const Molecule& mol)
+{
+	Block& block = writeBlock();
+	block.set(block.count++, mol);
+
+	const int32_t frame = static_cast<int32_t>(mol.frame);
+	if (m_frames.empty() || (m_frames.back().first != frame)) {
+		if (!m_frames.empty() && (m_frames.back().first > frame))
+			m_framesSorted = false;
+		m_frames.emplace_back(frame, m_size);
+	}
+	++m_size;
+}
+
+void LocalizationStore::append(const LocalizationStore& other)
+{
+	if (this == &other) {
+		const LocalizationStore copy(other);
+		append(copy);
+		return;
+	}
+	for (const auto& b : other.m_blocks) {
+		for (size_t i = 0; i < b->count; ++i) {
+			Block& block = writeBlock();
+			const size_t j = block.count++;
+			block.background[j] = b->background[i];
+			block.peak[j] = b->peak[i];
+			block.x[j] = b->x[i];
+			block.y[j] = b->y[i];
+			block.z[j] = b->z[i];
+			block.frame[j] = b->frame[i];
+			block.xfit[j] = b->xfit[i];
+			block.yfit[j] = b->yfit[i];
+			block.time_us[j] = b->time_us[i];
+			if (m_frames.empty() || (m_frames.back().first != b->frame[i])) {
+				if (!m_frames.empty() && (m_frames.back().first > b->frame[i]))
+					m_framesSorted = false;
+				m_frames.emplace_back(b->frame[i], m_size);
+			}
+			++m_size;
+		}
+	}
+}
+
+void LocalizationStore::clear()
+{
+	if (m_blocks.size() > 1)
+		m_blocks.resize(1);
+	if (!m_blocks.empty())
+		m_blocks.front()->count = 0;
+	m_size = 0;
+	m_frames.clear();
+	m_framesSorted = true;
+}
+
+void LocalizationStore::release()
+{
+	m_blocks.clear();
+	m_blocks.shrink_to_fit();
+	m_size = 0;
+	m_frames.clear();
+	m_frames.shrink_to_fit();
+	m_framesSorted = true;
+}
+
+void LocalizationStore::swap(LocalizationStore& other) noexcept
+{
+	std::swap(m_blocks, other.m_blocks);
+	std::swap(m_size, other.m_size);
+	std::swap(m_frames, other.m_frames);
+	std::swap(m_framesSorted, other.m_framesSorted);
+}
+
+size_t LocalizationStore::size() const
+{
+	return m_size;
+}
+
+bool LocalizationStore::empty() const
+{
+	return m_size == 0;
+}
+
+size_t LocalizationStore::memoryUsage() const
+{
+	return m_blocks.size() * (BlockSize * BytesPerLocalization + sizeof(Block)) + 
+		m_frames.capacity() * sizeof(m_frames[0]);
+}
+
+Molecule LocalizationStore::operator[](size_t index) const
+{
+	return block(index / BlockSize).molecule(index % BlockSize);
+}
+
+Molecule LocalizationStore::at(size_t index) const
+{
+	if (index >= m_size)
+		throw std::out_of_range("LocalizationStore: Index out of range");
+	return (*this)[index];
+}
+
+LocalizationStore::const_iterator LocalizationStore::begin() const
+{
+	return const_iterator(this, 0);
+}
+
+LocalizationStore::const_iterator LocalizationStore::end() const
+{
+	return const_iterator(this, m_size);
+}
+
+size_t LocalizationStore::blocks() const
+{
+	return (m_size + BlockSize - 1) / BlockSize;
+}
+
+LocalizationBlock LocalizationStore::block(size_t index) const
+{
+	LocalizationBlock view;
+	if (index >= blocks())
+		return view;
+	const Block& b = *m_blocks[index];
+	view.first = index * BlockSize;
+	view.count = b.count;
+	view.background = b.background;
+	view.peak = b.peak;
+	view.x = b.x;
+	view.y = b.y;
+	view.z = b.z;
+	view.frame = b.frame;
+	view.xfit = b.xfit;
+	view.yfit = b.yfit;
+	view.time_us = b.time_us;
+	return view;
+}
+
+std::pair<size_t, size_t> LocalizationStore::frameRange(int frame) const
+{
+	auto run = m_frames.end();
+	if (m_framesSorted) {
+		run = std::lower_bound(m_frames.begin(), m_frames.end(), frame, 
+			[](const std::pair<int32_t, size_t>& f, int frame) { return f.first < frame; });
+		if ((run != m_frames.end()) && (run->first != frame))
+			run = m_frames.end();
+	}
+	else {
+		for (auto it = m_frames.rbegin(); it != m_frames.rend(); ++it) {
+			if (it->first == frame) {
+				run = std::prev(it.base());
+				break;
+			}
+		}
+	}
+	if (run == m_frames.end())
+		return { m_size, m_size };
+	const size_t last = (std::next(run) == m_frames.end()) ? m_size : std::next(run)->second;
+	return { run->second, last };
+}
+
+size_t LocalizationStore::frames() const
+{
+	return m_frames.size();
+}
+
+size_t LocalizationStore::copy(size_t first, size_t count, Molecule* dst) const
+{
+	if (first >= m_size)
+		return 0;
+	count = std::min(count, m_size - first);
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = (*this)[first + i];
+	return count;
+}
+
+template<class T>
+static void copyValues(const T* src, size_t count, double* dst)
+{
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = static_cast<double>(src[i]);
+}
+
+size_t LocalizationStore::copyColumn(Column column, size_t first, size_t count, double* dst) const
+{
+	if (first >= m_size)
+		return 0;
+	count = std::min(count, m_size - first);
+	size_t copied = 0;
+	while (copied < count) {
+		const size_t index = first + copied;
+		const LocalizationBlock b = block(index / BlockSize);
+		const size_t offset = index % BlockSize;
+		const size_t n = std::min(count - copied, b.count - offset);
+		switch (column) {
+		case Column::Background: copyValues(b.background + offset, n, dst + copied); break;
+		case Column::Peak: copyValues(b.peak + offset, n, dst + copied); break;
+		case Column::X: copyValues(b.x + offset, n, dst + copied); break;
+		case Column::Y: copyValues(b.y + offset, n, dst + copied); break;
+		case Column::Z: copyValues(b.z + offset, n, dst + copied); break;
+		case Column::Frame: copyValues(b.frame + offset, n, dst + copied); break;
+		case Column::XFit: copyValues(b.xfit + offset, n, dst + copied); break;
+		case Column::YFit: copyValues(b.yfit + offset, n, dst + copied); break;
+		case Column::TimeUS: copyValues(b.time_us + offset, n, dst + copied); break;
+		}
+		copied += n;
+	}
+	return copied;
+}
+
+size_t LocalizationStore::exportValues(size_t first, size_t count, double* dst, bool columnMajor) const
+{
+	if (first >= m_size)
+		return 0;
+	count = std::min(count, m_size - first);
+	if (columnMajor) {
+		for (size_t c = 0; c < Values; ++c)
+			copyColumn(static_cast<Column>(c), first, count, dst + c * count);
+		return count;
+	}
+
+	size_t copied = 0;
+	while (copied < count) {
+		const size_t index = first + copied;
+		const LocalizationBlock b = block(index / BlockSize);
+		const size_t offset = index % BlockSize;
+		const size_t n = std::min(count - copied, b.count - offset);
+		double* row = dst + copied * Values;
+		for (size_t i = offset; i < offset + n; ++i, row += Values) {
+			row[0] = b.background[i];
+			row[1] = b.peak[i];
+			row[2] = b.x[i];
+			row[3] = b.y[i];
+			row[4] = b.z[i];
+			row[5] = b.frame[i];
+			row[6] = b.xfit[i];
+			row[7] = b.yfit[i];
+			row[8] = b.time_us[i];
+		}
+		copied += n;
+	}
+	return copied;
+}
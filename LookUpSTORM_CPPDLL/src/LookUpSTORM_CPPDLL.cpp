@@ -99,37 +99,22 @@ JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setLookUpTable__Lja
 (JNIEnv* env, jobject, jstring jFileName)
 {
 	const char* fileName = env->GetStringUTFChars(jFileName, nullptr);
-	std::ifstream file(fileName, std::ios::binary);
+	const std::string name(fileName);
 	env->ReleaseStringUTFChars(jFileName, fileName);
-	if (!file.is_open())
-		return false;
 
-	struct HeaderLUT {
-		char id[8];
-		size_t dataSize;
-		size_t indices;
-		size_t windowSize;
-		double dLat;
-		double dAx;
-		double rangeLat;
-		double rangeAx;
-	} hdr{};
-
-	file.read((char*)&hdr, sizeof(hdr));
-	if (strncmp(hdr.id, "LUTDSMLM", 8) != 0) {
-		std::cerr << "LookUpSTORM_CPPDLL: Load LUT: ID of file is not correct" << std::endl;
-		return false;
-	}
-	const size_t size = hdr.dataSize / sizeof(double);
-	double* data = new double[size];
-	file.read((char*)data, hdr.dataSize);
-	file.close();
-	Fitter& f = Controller::inst()->fitter();
-	if (!f.setLookUpTable(data, size, true, hdr.windowSize, hdr.dLat, hdr.dAx, hdr.rangeLat, hdr.rangeAx))
-		return false;
-	Controller::inst()->renderer().setSettings(f.minAx(), f.maxAx(), f.deltaAx(), 1.f);
-	Controller::inst()->reset();
-	return true;
+	// the file is mapped read-only and shared with other processes using the same LUT,
+	// the chunk CRCs are not read here, so the fitting can start without reading the whole file
+	return Controller::inst()->loadLUT(name);
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_verifyLookUpTable
+(JNIEnv* env, jobject, jstring jFileName)
+{
+	const char* fileName = env->GetStringUTFChars(jFileName, nullptr);
+	const std::string name(fileName);
+	env->ReleaseStringUTFChars(jFileName, fileName);
+
+	return Controller::inst()->verifyLUT(name);
 }
 
 JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_releaseLookUpTable
@@ -144,8 +129,7 @@ JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_releaseLookUpTable
 		}
 		_JLookUpTableHelper = { nullptr };
 	}
-	Fitter& f = Controller::inst()->fitter();
-	f.release();
+	Controller::inst()->releaseLUT();
 	return true;
 }
 
@@ -173,7 +157,7 @@ JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getLocs
 	// https://gamedev.stackexchange.com/questions/96947/jni-multidimensional-array-as-return-value
 	jobjectArray result;
 
-	std::list<Molecule>& mols = Controller::inst()->detectedMolecues();
+	const LocalizationStore& mols = Controller::inst()->detectedMolecues();
 
 	const jclass doubleArray1DClass = env->FindClass("[D");
 
@@ -200,7 +184,10 @@ JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getAllLocs
 	// https://gamedev.stackexchange.com/questions/96947/jni-multidimensional-array-as-return-value
 	jobjectArray result;
 
-	std::list<Molecule>& mols = Controller::inst()->allMolecues();
+	// copy of the localizations, frames may be committed concurrently
+	uint64_t cursor = 0;
+	std::vector<Molecule> mols;
+	Controller::inst()->moleculesSince(cursor, mols);
 
 	const jclass doubleArray1DClass = env->FindClass("[D");
 
@@ -218,7 +205,125 @@ JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getAllLocs
 JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_numberOfAllLocs
 (JNIEnv*, jobject)
 {
-	return static_cast<jint>(Controller::inst()->allMolecues().size());
+	return static_cast<jint>(Controller::inst()->numberOfMolecules());
+}
+
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_copyAllLocs
+(JNIEnv* env, jobject, jint first, jdoubleArray jData, jboolean columnMajor)
+{
+	const size_t count = size_t(env->GetArrayLength(jData)) / LocalizationStore::Values;
+	if ((first < 0) || (count == 0))
+		return 0;
+
+	jdouble* data = (jdouble*)env->GetPrimitiveArrayCritical(jData, nullptr);
+	if (data == nullptr) {
+		std::cerr << "LookUpSTORM_CPPDLL: copyAllLocs: Array error!" << std::endl;
+		return 0;
+	}
+	const size_t copied = Controller::inst()->exportMolecules(size_t(first), data, count, columnMajor);
+	env->ReleasePrimitiveArrayCritical(jData, data, copied > 0 ? 0 : JNI_ABORT);
+
+	return static_cast<jint>(copied);
+}
+
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_copyAllLocsDirect
+(JNIEnv* env, jobject, jint first, jobject jBuffer, jboolean columnMajor)
+{
+	double* data = static_cast<double*>(env->GetDirectBufferAddress(jBuffer));
+	if (data == nullptr) {
+		std::cerr << "LookUpSTORM_CPPDLL: copyAllLocsDirect: Buffer error!" << std::endl;
+		return 0;
+	}
+	const size_t count = size_t(std::max<jlong>(0, env->GetDirectBufferCapacity(jBuffer))) / (LocalizationStore::Values * sizeof(double));
+	if (first < 0)
+		return 0;
+
+	return static_cast<jint>(Controller::inst()->exportMolecules(size_t(first), data, count, columnMajor));
+}
+
+JNIEXPORT jlong JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getLocCursor
+(JNIEnv*, jobject)
+{
+	return static_cast<jlong>(Controller::inst()->moleculeCursor());
+}
+
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getLocsSince
+(JNIEnv* env, jobject, jlongArray jCursor, jdoubleArray jData, jboolean columnMajor)
+{
+	jlong cursor = 0;
+	if (env->GetArrayLength(jCursor) < 1)
+		return 0;
+	env->GetLongArrayRegion(jCursor, 0, 1, &cursor);
+	const size_t count = size_t(env->GetArrayLength(jData)) / LocalizationStore::Values;
+	if ((cursor < 0) || (count == 0))
+		return 0;
+
+	jdouble* data = (jdouble*)env->GetPrimitiveArrayCritical(jData, nullptr);
+	if (data == nullptr) {
+		std::cerr << "LookUpSTORM_CPPDLL: getLocsSince: Array error!" << std::endl;
+		return 0;
+	}
+	uint64_t position = static_cast<uint64_t>(cursor);
+	const size_t copied = Controller::inst()->moleculesSince(position, data, count, columnMajor);
+	env->ReleasePrimitiveArrayCritical(jData, data, copied > 0 ? 0 : JNI_ABORT);
+
+	cursor = static_cast<jlong>(position);
+	env->SetLongArrayRegion(jCursor, 0, 1, &cursor);
+	return static_cast<jint>(copied);
+}
+
+// format constants of the Java class
+static bool toLocalizationFormat(jint format, LocalizationFormat& result)
+{
+	switch (format) {
+	case 0: result = LocalizationFormat::Binary; return true;
+	case 1: result = LocalizationFormat::BinaryCompressed; return true;
+	case 2: result = LocalizationFormat::CSV; return true;
+	}
+	std::cerr << "LookUpSTORM_CPPDLL: Unknown localization format " << format << "!" << std::endl;
+	return false;
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_saveLocs
+(JNIEnv* env, jobject, jstring jFileName, jint jFormat, jdouble pixelSize, jdouble adu, jdouble gain, jdouble baseline)
+{
+	LocalizationFormat format;
+	if (!toLocalizationFormat(jFormat, format))
+		return false;
+	const char* fileName = env->GetStringUTFChars(jFileName, nullptr);
+	const std::string name(fileName);
+	env->ReleaseStringUTFChars(jFileName, fileName);
+
+	return Controller::inst()->saveMolecules(name, format, pixelSize, adu, gain, baseline);
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_verifyLocs
+(JNIEnv* env, jobject, jstring jFileName)
+{
+	const char* fileName = env->GetStringUTFChars(jFileName, nullptr);
+	const std::string name(fileName);
+	env->ReleaseStringUTFChars(jFileName, fileName);
+
+	return Controller::inst()->verifyMolecules(name);
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_startRecording
+(JNIEnv* env, jobject, jstring jFileName, jint jFormat, jdouble pixelSize, jdouble adu, jdouble gain, jdouble baseline)
+{
+	LocalizationFormat format;
+	if (!toLocalizationFormat(jFormat, format))
+		return false;
+	const char* fileName = env->GetStringUTFChars(jFileName, nullptr);
+	const std::string name(fileName);
+	env->ReleaseStringUTFChars(jFileName, fileName);
+
+	return Controller::inst()->startRecording(name, format, pixelSize, adu, gain, baseline);
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_stopRecording
+(JNIEnv*, jobject)
+{
+	return Controller::inst()->stopRecording();
 }
 
 JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setImagePara
@@ -394,35 +499,140 @@ JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getFittedMolecu
 	JNI_POSREC jniPosRec;
 	LoadJniPosRec(&jniPosRec, env);
 	
-	std::list<Molecule>& mols = Controller::inst()->allMolecues();
-
-	const jclass doubleArray1DClass = env->FindClass("[D");
+	Controller* controller = Controller::inst();
+	// copy of the localizations, frames may be committed concurrently
+	uint64_t cursor = 0;
+	std::vector<Molecule> mols;
+	controller->moleculesSince(cursor, mols);
 
 	jobjectArray result = env->NewObjectArray(mols.size(), jniPosRec.cls, nullptr);
 	
-	double crlb[5];
-	auto it = mols.begin();
-	for (size_t i = 0; i < mols.size(); ++i, ++it) {
-		const double photons = Controller::inst()->calculatePhotons(*it, adu, gain);
-		const double bg = std::max(0.0, (it->background - baseline) * adu / gain);
-
-		jobject jPosRec = env->NewObject(jniPosRec.cls, jniPosRec.constructortorID);
-		env->SetIntField(jPosRec, jniPosRec.frameID, (jint)it->frame);
-		env->SetDoubleField(jPosRec, jniPosRec.xID, (jdouble)(it->x * pixelSize));
-		env->SetDoubleField(jPosRec, jniPosRec.yID, (jdouble)(it->y * pixelSize));
-		env->SetDoubleField(jPosRec, jniPosRec.zID, (jdouble)it->z);
-		env->SetDoubleField(jPosRec, jniPosRec.intensityID, (jdouble)photons);
-		env->SetDoubleField(jPosRec, jniPosRec.backgroundID, (jdouble)bg);
-		if (Controller::inst()->calculateCRLB(*it, crlb, adu, gain, baseline, pixelSize) &&
-			std::isfinite(crlb[2]) && std::isfinite(crlb[3]) && std::isfinite(crlb[4])) {
-			env->SetDoubleField(jPosRec, jniPosRec.crlb_xID, (jdouble)crlb[2]);
-			env->SetDoubleField(jPosRec, jniPosRec.crlb_yID, (jdouble)crlb[3]);
-			env->SetDoubleField(jPosRec, jniPosRec.crlb_zID, (jdouble)crlb[4]);
+	// the photons and CRLB are calculated in parallel for a chunk of molecules
+	const size_t chunkSize = 1 << 16;
+	std::vector<double> photons(std::min(chunkSize, mols.size())), crlbs(5 * photons.size());
+	for (size_t first = 0; first < mols.size(); first += chunkSize) {
+		const size_t count = std::min(chunkSize, mols.size() - first);
+		const Molecule* chunk = mols.data() + first;
+		controller->calculatePhotonsCRLB(chunk, count, photons.data(), crlbs.data(), adu, gain, baseline, pixelSize);
+
+		for (size_t i = 0; i < count; ++i) {
+			const Molecule& m = chunk[i];
+			const double* crlb = &crlbs[5 * i];
+			const double bg = std::max(0.0, (m.background - baseline) * adu / gain);
+
+			jobject jPosRec = env->NewObject(jniPosRec.cls, jniPosRec.constructortorID);
+			env->SetIntField(jPosRec, jniPosRec.frameID, (jint)m.frame);
+			env->SetDoubleField(jPosRec, jniPosRec.xID, (jdouble)(m.x * pixelSize));
+			env->SetDoubleField(jPosRec, jniPosRec.yID, (jdouble)(m.y * pixelSize));
+			env->SetDoubleField(jPosRec, jniPosRec.zID, (jdouble)m.z);
+			env->SetDoubleField(jPosRec, jniPosRec.intensityID, (jdouble)photons[i]);
+			env->SetDoubleField(jPosRec, jniPosRec.backgroundID, (jdouble)bg);
+			if (std::isfinite(crlb[2]) && std::isfinite(crlb[3]) && std::isfinite(crlb[4])) {
+				env->SetDoubleField(jPosRec, jniPosRec.crlb_xID, (jdouble)crlb[2]);
+				env->SetDoubleField(jPosRec, jniPosRec.crlb_yID, (jdouble)crlb[3]);
+				env->SetDoubleField(jPosRec, jniPosRec.crlb_zID, (jdouble)crlb[4]);
+			}
+			env->SetObjectArrayElement(result, first + i, jPosRec);
+			env->DeleteLocalRef(jPosRec);
 		}
-		env->SetObjectArrayElement(result, i, jPosRec);
 	}
 
 	return result;
 }
 
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_startStreaming
+(JNIEnv*, jobject, jint workers, jint queueSize)
+{
+	return Controller::inst()->startWorkers(size_t(std::max(0, workers)), size_t(std::max(0, queueSize)));
+}
+
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_stopStreaming
+(JNIEnv*, jobject)
+{
+	Controller::inst()->stopWorkers();
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pushFrame
+(JNIEnv* env, jobject, jshortArray jImage, jint width, jint height, jint frame)
+{
+	if ((width <= 0) || (height <= 0) || (env->GetArrayLength(jImage) != (width * height)))
+		return 0;
+
+	// the pixels are copied into the queue without pinning the array, which would block the GC
+	return Controller::inst()->pushImage(width, height, frame, [env, jImage, width, height](uint16_t* pixels) {
+		env->GetShortArrayRegion(jImage, 0, width * height, reinterpret_cast<jshort*>(pixels));
+	});
+}
+
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pushFrameDirect
+(JNIEnv* env, jobject, jobject jBuffer, jint width, jint height, jint frame)
+{
+	const uint16_t* data = static_cast<const uint16_t*>(env->GetDirectBufferAddress(jBuffer));
+	const size_t n = size_t(std::max(0, width)) * size_t(std::max(0, height));
+	if ((data == nullptr) || (n == 0) || (env->GetDirectBufferCapacity(jBuffer) < jlong(n * sizeof(uint16_t)))) {
+		std::cerr << "LookUpSTORM_CPPDLL: pushFrameDirect: Buffer error!" << std::endl;
+		return 0;
+	}
+
+	return Controller::inst()->pushImage(width, height, frame, [data, n](uint16_t* pixels) {
+		std::copy_n(data, n, pixels);
+	});
+}
+
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pollFrames
+(JNIEnv* env, jobject, jboolean wait, jintArray jRenderImage, jint renderWidth, jint renderHeight)
+{
+	Controller* controller = Controller::inst();
+	const int width = controller->imageWidth();
+	const int height = controller->imageHeight();
+	if ((width <= 0) || (height <= 0))
+		return 0;
+	controller->renderer().setSize(renderWidth, renderHeight, double(renderWidth) / width, double(renderHeight) / height);
+
+	// only the first frame is waited for
+	jint count = 0;
+	int frame = 0;
+	while (controller->pollImage(frame, wait && (count == 0)))
+		++count;
+	if (count == 0)
+		return 0;
+
+	jint* renderImg = (jint*)env->GetPrimitiveArrayCritical(jRenderImage, nullptr);
+	if (renderImg == nullptr) {
+		std::cerr << "LookUpSTORM_CPPDLL: pollFrames: Render image error!" << std::endl;
+		return count;
+	}
+	ImageU32 renderImage(renderWidth, renderHeight, (uint32_t*)renderImg, false);
+	const bool changed = controller->renderToImage(renderImage, frame);
+	env->ReleasePrimitiveArrayCritical(jRenderImage, renderImg, changed ? 0 : JNI_ABORT);
+
+	return count;
+}
+
+JNIEXPORT jlongArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getStreamingStats
+(JNIEnv* env, jobject)
+{
+	const PipelineStats stats = Controller::inst()->pipelineStats();
+	const jlong values[7] = {
+		jlong(stats.submitted), jlong(stats.dropped), jlong(stats.processed), jlong(stats.capacity),
+		jlong(stats.occupancy), jlong(stats.maxOccupancy), jlong(stats.waitMS * 1E3)
+	};
+	jlongArray result = env->NewLongArray(7);
+	if (result != nullptr)
+		env->SetLongArrayRegion(result, 0, 7, values);
+	return result;
+}
+
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setFittingThreads
+(JNIEnv*, jobject, jint threads)
+{
+	Controller::inst()->setFittingThreads(size_t(std::max(0, threads)));
+}
+
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setDetectionThreads
+(JNIEnv*, jobject, jint threads)
+{
+	Controller::inst()->setDetectionThreads(size_t(std::max(0, threads)));
+}
+
 #endif // JNI_EXPORT
\ No newline at end of file
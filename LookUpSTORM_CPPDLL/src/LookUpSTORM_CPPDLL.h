@@ -23,6 +23,14 @@ JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setLookUpTable___3D
 JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setLookUpTable__Ljava_lang_String_2
   (JNIEnv *, jobject, jstring);
 
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    verifyLookUpTable
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_verifyLookUpTable
+  (JNIEnv *, jobject, jstring);
+
 /*
  * Class:     at_fhlinz_imagej_LookUpSTORM
  * Method:    releaseLookUpTable
@@ -87,6 +95,70 @@ JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getAllLocs
 JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_numberOfAllLocs
   (JNIEnv *, jobject);
 
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    copyAllLocs
+ * Signature: (I[DZ)I
+ */
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_copyAllLocs
+  (JNIEnv *, jobject, jint, jdoubleArray, jboolean);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    copyAllLocsDirect
+ * Signature: (ILjava/nio/ByteBuffer;Z)I
+ */
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_copyAllLocsDirect
+  (JNIEnv *, jobject, jint, jobject, jboolean);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    getLocCursor
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getLocCursor
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    getLocsSince
+ * Signature: ([J[DZ)I
+ */
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getLocsSince
+  (JNIEnv *, jobject, jlongArray, jdoubleArray, jboolean);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    saveLocs
+ * Signature: (Ljava/lang/String;IDDDD)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_saveLocs
+  (JNIEnv *, jobject, jstring, jint, jdouble, jdouble, jdouble, jdouble);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    verifyLocs
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_verifyLocs
+  (JNIEnv *, jobject, jstring);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    startRecording
+ * Signature: (Ljava/lang/String;IDDDD)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_startRecording
+  (JNIEnv *, jobject, jstring, jint, jdouble, jdouble, jdouble, jdouble);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    stopRecording
+ * Signature: ()Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_stopRecording
+  (JNIEnv *, jobject);
+
 /*
  * Class:     at_fhlinz_imagej_LookUpSTORM
  * Method:    setImagePara
@@ -215,6 +287,70 @@ JNIEXPORT jstring JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getVersion
 JNIEXPORT jobjectArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getFittedMolecules
   (JNIEnv *, jobject, jdouble, jdouble, jdouble, jdouble);
 
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    startStreaming
+ * Signature: (II)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_startStreaming
+  (JNIEnv *, jobject, jint, jint);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    stopStreaming
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_stopStreaming
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    pushFrame
+ * Signature: ([SIII)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pushFrame
+  (JNIEnv *, jobject, jshortArray, jint, jint, jint);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    pushFrameDirect
+ * Signature: (Ljava/nio/ByteBuffer;III)Z
+ */
+JNIEXPORT jboolean JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pushFrameDirect
+  (JNIEnv *, jobject, jobject, jint, jint, jint);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    pollFrames
+ * Signature: (Z[III)I
+ */
+JNIEXPORT jint JNICALL Java_at_fhlinz_imagej_LookUpSTORM_pollFrames
+  (JNIEnv *, jobject, jboolean, jintArray, jint, jint);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    getStreamingStats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_at_fhlinz_imagej_LookUpSTORM_getStreamingStats
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    setFittingThreads
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setFittingThreads
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     at_fhlinz_imagej_LookUpSTORM
+ * Method:    setDetectionThreads
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL Java_at_fhlinz_imagej_LookUpSTORM_setDetectionThreads
+  (JNIEnv *, jobject, jint);
+
 #ifdef __cplusplus
 }
 #endif
@@ -318,7 +318,7 @@ const ImageU32 Renderer::rawImageHistogram() const
     return d->histogramImage;
 }
 
-ImageU32 Renderer::render(const std::list<Molecule>& mols, int width, int height, double scaleX, 
+ImageU32 Renderer::render(const LocalizationStore& mols, int width, int height, double scaleX, 
     double scaleY, double minZ, double maxZ, double dZ, double sigma, Projection projection)
 {
     ImageU32 image(width, height);
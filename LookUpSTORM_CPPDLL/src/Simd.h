@@ -0,0 +1,343 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+#ifdef USE_AVX_LUT
+#include <immintrin.h>
+#endif
+
+namespace LookUpSTORM
+{
+
+namespace SIMD
+{
+
+#ifdef USE_AVX_LUT
+// range of the exponential function without under- or overflow
+static constexpr double EXP_MIN = -708.39641853226408;
+static constexpr double EXP_MAX = 709.0;
+static constexpr double LOG2E = 1.4426950408889634073599;
+
+class VecD;
+static inline VecD expReduced(VecD x, VecD n);
+#endif // USE_AVX_LUT
+
+/*
+ * class VecD
+ * Vector of double values, one lane per molecule of a batch fit.
+ * Uses AVX-512 (8 lanes) or AVX2 (4 lanes) if available, otherwise
+ * plain arrays which are vectorized by the compiler.
+ */
+#if defined(USE_AVX_LUT) && defined(__AVX512F__)
+
+class VecD
+{
+public:
+	static constexpr size_t Lanes = 8;
+
+	inline VecD() : v(_mm512_setzero_pd()) {}
+	inline VecD(double x) : v(_mm512_set1_pd(x)) {}
+	inline VecD(__m512d x) : v(x) {}
+
+	static inline VecD load(const double* p) { return _mm512_loadu_pd(p); }
+	static inline VecD load(const float* p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+	inline void store(double* p) const { _mm512_storeu_pd(p, v); }
+
+	// loads base[offsets[i]] into the i-th lane
+	static inline VecD gather(const double* base, const int64_t* offsets) 
+	{
+		return _mm512_i64gather_pd(_mm512_loadu_si512(offsets), base, 8);
+	}
+	static inline VecD gather(const float* base, const int64_t* offsets)
+	{
+		return _mm512_cvtps_pd(_mm512_i64gather_ps(_mm512_loadu_si512(offsets), base, 4));
+	}
+
+	inline friend VecD operator+(VecD a, VecD b) { return _mm512_add_pd(a.v, b.v); }
+	inline friend VecD operator-(VecD a, VecD b) { return _mm512_sub_pd(a.v, b.v); }
+	inline friend VecD operator*(VecD a, VecD b) { return _mm512_mul_pd(a.v, b.v); }
+	inline friend VecD operator/(VecD a, VecD b) { return _mm512_div_pd(a.v, b.v); }
+
+	// a * b + c
+	inline friend VecD fmadd(VecD a, VecD b, VecD c) { return _mm512_fmadd_pd(a.v, b.v, c.v); }
+
+	// exponential function (Cephes), accurate to about one ulp
+	inline friend VecD exp(VecD a)
+	{
+		const __mmask8 underflow = _mm512_cmp_pd_mask(a.v, _mm512_set1_pd(EXP_MIN), _CMP_LT_OQ);
+		const __mmask8 overflow = _mm512_cmp_pd_mask(a.v, _mm512_set1_pd(EXP_MAX), _CMP_GT_OQ);
+		const __m512d x = _mm512_min_pd(_mm512_max_pd(a.v, _mm512_set1_pd(EXP_MIN)), _mm512_set1_pd(EXP_MAX));
+		const __m512d n = _mm512_roundscale_pd(_mm512_fmadd_pd(x, _mm512_set1_pd(LOG2E), _mm512_set1_pd(0.5)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		const VecD r = expReduced(VecD(x), VecD(n));
+		__m512d y = _mm512_scalef_pd(r.v, n);
+		y = _mm512_mask_blend_pd(underflow, y, _mm512_setzero_pd());
+		return _mm512_mask_blend_pd(overflow, y, _mm512_set1_pd(HUGE_VAL));
+	}
+
+private:
+	__m512d v;
+};
+
+#elif defined(USE_AVX_LUT)
+
+class VecD
+{
+public:
+	static constexpr size_t Lanes = 4;
+
+	inline VecD() : v(_mm256_setzero_pd()) {}
+	inline VecD(double x) : v(_mm256_set1_pd(x)) {}
+	inline VecD(__m256d x) : v(x) {}
+
+	static inline VecD load(const double* p) { return _mm256_loadu_pd(p); }
+	static inline VecD load(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+	inline void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+	// loads base[offsets[i]] into the i-th lane
+	static inline VecD gather(const double* base, const int64_t* offsets)
+	{
+		return _mm256_i64gather_pd(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets)), 8);
+	}
+	static inline VecD gather(const float* base, const int64_t* offsets)
+	{
+		return _mm256_cvtps_pd(_mm256_i64gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets)), 4));
+	}
+
+	inline friend VecD operator+(VecD a, VecD b) { return _mm256_add_pd(a.v, b.v); }
+	inline friend VecD operator-(VecD a, VecD b) { return _mm256_sub_pd(a.v, b.v); }
+	inline friend VecD operator*(VecD a, VecD b) { return _mm256_mul_pd(a.v, b.v); }
+	inline friend VecD operator/(VecD a, VecD b) { return _mm256_div_pd(a.v, b.v); }
+
+	// a * b + c
+	inline friend VecD fmadd(VecD a, VecD b, VecD c) { return _mm256_fmadd_pd(a.v, b.v, c.v); }
+
+	// exponential function (Cephes), accurate to about one ulp
+	inline friend VecD exp(VecD a)
+	{
+		const __m256d underflow = _mm256_cmp_pd(a.v, _mm256_set1_pd(EXP_MIN), _CMP_LT_OQ);
+		const __m256d overflow = _mm256_cmp_pd(a.v, _mm256_set1_pd(EXP_MAX), _CMP_GT_OQ);
+		const __m256d x = _mm256_min_pd(_mm256_max_pd(a.v, _mm256_set1_pd(EXP_MIN)), _mm256_set1_pd(EXP_MAX));
+		const __m256d n = _mm256_floor_pd(_mm256_fmadd_pd(x, _mm256_set1_pd(LOG2E), _mm256_set1_pd(0.5)));
+		const VecD r = expReduced(VecD(x), VecD(n));
+
+		// 2^n by setting the exponent bits
+		const __m256i e = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n)), _mm256_set1_epi64x(1023));
+		__m256d y = _mm256_mul_pd(r.v, _mm256_castsi256_pd(_mm256_slli_epi64(e, 52)));
+		y = _mm256_andnot_pd(underflow, y);
+		return _mm256_blendv_pd(y, _mm256_set1_pd(HUGE_VAL), overflow);
+	}
+
+private:
+	__m256d v;
+};
+
+#else
+
+class VecD
+{
+public:
+	static constexpr size_t Lanes = 4;
+
+	inline VecD() : v{ 0.0 } {}
+	inline VecD(double x) { for (size_t i = 0; i < Lanes; ++i) v[i] = x; }
+
+	template<class T>
+	static inline VecD load(const T* p) 
+	{ 
+		VecD r; 
+		for (size_t i = 0; i < Lanes; ++i) r.v[i] = p[i]; 
+		return r; 
+	}
+	inline void store(double* p) const { for (size_t i = 0; i < Lanes; ++i) p[i] = v[i]; }
+
+	// loads base[offsets[i]] into the i-th lane
+	template<class T>
+	static inline VecD gather(const T* base, const int64_t* offsets)
+	{
+		VecD r;
+		for (size_t i = 0; i < Lanes; ++i) r.v[i] = base[offsets[i]];
+		return r;
+	}
+
+	inline friend VecD operator+(VecD a, VecD b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] += b.v[i]; return a; }
+	inline friend VecD operator-(VecD a, VecD b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] -= b.v[i]; return a; }
+	inline friend VecD operator*(VecD a, VecD b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] *= b.v[i]; return a; }
+	inline friend VecD operator/(VecD a, VecD b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] /= b.v[i]; return a; }
+
+	// a * b + c
+	inline friend VecD fmadd(VecD a, VecD b, VecD c) { return a * b + c; }
+
+	inline friend VecD exp(VecD a) { for (size_t i = 0; i < Lanes; ++i) a.v[i] = std::exp(a.v[i]); return a; }
+
+private:
+	double v[Lanes];
+};
+
+#endif
+
+/*
+ * class VecF
+ * Vector of float values, one lane per pixel of the image filters.
+ * Uses AVX-512 (16 lanes) or AVX2 (8 lanes) if available, otherwise
+ * plain arrays which are vectorized by the compiler.
+ */
+#if defined(USE_AVX_LUT) && defined(__AVX512F__)
+
+class VecF
+{
+public:
+	static constexpr size_t Lanes = 16;
+
+	inline VecF() : v(_mm512_setzero_ps()) {}
+	inline VecF(float x) : v(_mm512_set1_ps(x)) {}
+	inline VecF(__m512 x) : v(x) {}
+
+	static inline VecF load(const float* p) { return _mm512_loadu_ps(p); }
+	static inline VecF load(const uint16_t* p) { return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)))); }
+	inline void store(float* p) const { _mm512_storeu_ps(p, v); }
+
+	inline friend VecF operator+(VecF a, VecF b) { return _mm512_add_ps(a.v, b.v); }
+	inline friend VecF operator-(VecF a, VecF b) { return _mm512_sub_ps(a.v, b.v); }
+	inline friend VecF operator*(VecF a, VecF b) { return _mm512_mul_ps(a.v, b.v); }
+
+	// a * b + c
+	inline friend VecF fmadd(VecF a, VecF b, VecF c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+
+	// max(a, b) per lane
+	inline friend VecF max(VecF a, VecF b) { return _mm512_max_ps(a.v, b.v); }
+
+private:
+	__m512 v;
+};
+
+#elif defined(USE_AVX_LUT)
+
+class VecF
+{
+public:
+	static constexpr size_t Lanes = 8;
+
+	inline VecF() : v(_mm256_setzero_ps()) {}
+	inline VecF(float x) : v(_mm256_set1_ps(x)) {}
+	inline VecF(__m256 x) : v(x) {}
+
+	static inline VecF load(const float* p) { return _mm256_loadu_ps(p); }
+	static inline VecF load(const uint16_t* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))); }
+	inline void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	inline friend VecF operator+(VecF a, VecF b) { return _mm256_add_ps(a.v, b.v); }
+	inline friend VecF operator-(VecF a, VecF b) { return _mm256_sub_ps(a.v, b.v); }
+	inline friend VecF operator*(VecF a, VecF b) { return _mm256_mul_ps(a.v, b.v); }
+
+	// a * b + c
+	inline friend VecF fmadd(VecF a, VecF b, VecF c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+
+	// max(a, b) per lane
+	inline friend VecF max(VecF a, VecF b) { return _mm256_max_ps(a.v, b.v); }
+
+private:
+	__m256 v;
+};
+
+#else
+
+class VecF
+{
+public:
+	static constexpr size_t Lanes = 8;
+
+	inline VecF() : v{ 0.f } {}
+	inline VecF(float x) { for (size_t i = 0; i < Lanes; ++i) v[i] = x; }
+
+	template<class T>
+	static inline VecF load(const T* p)
+	{
+		VecF r;
+		for (size_t i = 0; i < Lanes; ++i) r.v[i] = float(p[i]);
+		return r;
+	}
+	inline void store(float* p) const { for (size_t i = 0; i < Lanes; ++i) p[i] = v[i]; }
+
+	inline friend VecF operator+(VecF a, VecF b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] += b.v[i]; return a; }
+	inline friend VecF operator-(VecF a, VecF b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] -= b.v[i]; return a; }
+	inline friend VecF operator*(VecF a, VecF b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] *= b.v[i]; return a; }
+
+	// a * b + c
+	inline friend VecF fmadd(VecF a, VecF b, VecF c) { return a * b + c; }
+
+	// max(a, b) per lane
+	inline friend VecF max(VecF a, VecF b) { for (size_t i = 0; i < Lanes; ++i) a.v[i] = (a.v[i] < b.v[i] ? b.v[i] : a.v[i]); return a; }
+
+private:
+	float v[Lanes];
+};
+
+#endif
+
+// scalar version to share the templated algorithms with the single fit
+static inline double fmadd(double a, double b, double c) { return a * b + c; }
+
+// sum of all lanes
+static inline double sum(VecD a)
+{
+	double v[VecD::Lanes];
+	a.store(v);
+	double s = 0.0;
+	for (size_t i = 0; i < VecD::Lanes; ++i)
+		s += v[i];
+	return s;
+}
+
+#ifdef USE_AVX_LUT
+// exp(x) = 2^n * exp(r) with r = x - n * ln(2) and the Pade approximation of exp(r),
+// returns exp(r) without the factor 2^n
+static inline VecD expReduced(VecD x, VecD n)
+{
+	// ln(2) is split into two parts for the extra precision
+	x = x - n * VecD(6.93145751953125E-1);
+	x = x - n * VecD(1.42860682030941723212E-6);
+
+	const VecD xx = x * x;
+	const VecD p = x * fmadd(fmadd(VecD(1.26177193074810590878E-4), xx, VecD(3.02994407707441961300E-2)), xx, VecD(9.99999999999999999910E-1));
+	const VecD q = fmadd(fmadd(fmadd(VecD(3.00198505138664455042E-6), xx, VecD(2.52448340349684104192E-3)), xx, VecD(2.27265548208155028766E-1)), xx, VecD(2.00000000000000000009E0));
+	return VecD(1.0) + VecD(2.0) * (p / (q - p));
+}
+#endif // USE_AVX_LUT
+
+} // namespace SIMD
+
+} // namespace LookUpSTORM
+
+#endif // !SIMD_H
@@ -0,0 +1,111 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "TemplateCache.h"
+
+#include <algorithm>
+
+using namespace LookUpSTORM;
+
+TemplateCache::TemplateCache(size_t stride, size_t capacity, Generator generator)
+	: m_shards(new Shard[SHARDS])
+	, m_generator(generator)
+	, m_stride(stride)
+	, m_capacity(std::max(capacity, SHARDS))
+{
+	for (size_t i = 0; i < SHARDS; ++i)
+		m_shards[i].capacity = (m_capacity + SHARDS - 1 - i) / SHARDS;
+}
+
+template<class T>
+bool TemplateCache::copy(size_t index, T* pixels)
+{
+	// neighbouring templates are spread over the shards
+	Shard& shard = m_shards[index % SHARDS];
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.slots.find(index);
+		if (it != shard.slots.end()) {
+			shard.referenced[it->second] = 1;
+			std::copy_n(shard.data.data() + it->second * m_stride, m_stride, pixels);
+			return true;
+		}
+	}
+
+	// the template is drawn without holding the lock
+	std::vector<double> buffer(m_stride);
+	if (!m_generator(index, buffer.data()))
+		return false;
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	// another thread could have drawn the same template in the meantime
+	if (shard.slots.find(index) == shard.slots.end()) {
+		const size_t slot = insert(shard, index);
+		std::copy_n(buffer.data(), m_stride, shard.data.data() + slot * m_stride);
+	}
+	std::copy_n(buffer.data(), m_stride, pixels);
+	return true;
+}
+
+template bool TemplateCache::copy<double>(size_t index, double* pixels);
+template bool TemplateCache::copy<float>(size_t index, float* pixels);
+
+size_t TemplateCache::insert(Shard& shard, size_t index)
+{
+	size_t slot = shard.indices.size();
+	if (slot < shard.capacity) {
+		// the shard grows until its capacity is reached
+		shard.indices.push_back(index);
+		shard.referenced.push_back(1);
+		shard.data.resize(shard.data.size() + m_stride);
+	} else {
+		// clock: the first slot not accessed since the last pass is replaced
+		while (shard.referenced[shard.hand]) {
+			shard.referenced[shard.hand] = 0;
+			shard.hand = (shard.hand + 1) % shard.capacity;
+		}
+		slot = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.capacity;
+		shard.slots.erase(shard.indices[slot]);
+		shard.indices[slot] = index;
+		shard.referenced[slot] = 1;
+	}
+	shard.slots[index] = slot;
+	return slot;
+}
+
+size_t TemplateCache::stride() const
+{
+	return m_stride;
+}
+
+size_t TemplateCache::capacity() const
+{
+	return m_capacity;
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef TEMPLATECACHE_H
+#define TEMPLATECACHE_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+namespace LookUpSTORM
+{
+
+/*
+ * class TemplateCache
+ * Thread-safe cache of LUT templates that are drawn on their first access.
+ * The cache is split into shards with their own lock, so threads fitting
+ * different positions do not block each other. A full shard replaces its
+ * least recently used templates (clock algorithm).
+ */
+class TemplateCache
+{
+public:
+	// draws the template with the index into pixels (stride values), returns false on failure
+	using Generator = std::function<bool(size_t index, double* pixels)>;
+
+	// stride is the number of values per template, capacity the maximum number of templates
+	TemplateCache(size_t stride, size_t capacity, Generator generator);
+
+	TemplateCache(const TemplateCache&) = delete;
+	TemplateCache& operator=(const TemplateCache&) = delete;
+
+	// thread-safe, copies the template with the index into pixels (stride values)
+	// and draws it first if it is not cached
+	template<class T>
+	bool copy(size_t index, T* pixels);
+
+	size_t stride() const;
+	size_t capacity() const;
+
+private:
+	static constexpr size_t SHARDS = 16;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		// template index -> slot
+		std::unordered_map<size_t, size_t> slots;
+		// slot -> template index
+		std::vector<size_t> indices;
+		// slot was accessed since the clock hand passed it
+		std::vector<uint8_t> referenced;
+		std::vector<double> data;
+		size_t capacity = 0;
+		size_t hand = 0;
+	};
+
+	// returns the slot for the new template, evicts a template if the shard is full
+	size_t insert(Shard& shard, size_t index);
+
+	std::unique_ptr<Shard[]> m_shards;
+	Generator m_generator;
+	size_t m_stride;
+	size_t m_capacity;
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !TEMPLATECACHE_H
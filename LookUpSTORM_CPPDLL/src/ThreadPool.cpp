@@ -0,0 +1,152 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace LookUpSTORM;
+
+// calls of a single run, the indices are taken by the calling thread and the helpers
+struct ThreadPool::Batch
+{
+	inline Batch(const std::function<void(size_t)>& job, size_t count)
+		: job(job), count(count), next(0), finished(0) {}
+
+	// only valid until all calls are finished
+	const std::function<void(size_t)>& job;
+	const size_t count;
+	std::atomic<size_t> next;
+	std::atomic<size_t> finished;
+	std::mutex mutex;
+	std::condition_variable done;
+};
+
+ThreadPool::ThreadPool(size_t threads)
+	: m_size(0)
+	, m_stop(false)
+{
+	setThreads(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+	setThreads(0);
+}
+
+void ThreadPool::setThreads(size_t threads)
+{
+	std::lock_guard<std::mutex> resize(m_resizeMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (threads == m_threads.size())
+			return;
+		m_stop = true;
+		m_size = 0;
+	}
+	m_available.notify_all();
+	for (auto& t : m_threads)
+		t.join();
+	m_threads.clear();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// the calls of queued batches are already taken by their calling threads
+	if (threads == 0)
+		m_queue.clear();
+	m_stop = false;
+	m_size = threads;
+	m_threads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i)
+		m_threads.emplace_back(&ThreadPool::loop, this);
+}
+
+size_t ThreadPool::threads() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_size;
+}
+
+void ThreadPool::run(size_t count, size_t parallelism, const std::function<void(size_t)>& job)
+{
+	size_t helpers = std::min(count, parallelism);
+	helpers = std::min(threads(), (helpers > 0) ? helpers - 1 : 0);
+	if (helpers == 0) {
+		for (size_t i = 0; i < count; ++i)
+			job(i);
+		return;
+	}
+
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>(job, count);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < helpers; ++i)
+			m_queue.push_back(batch);
+	}
+	if (helpers == 1)
+		m_available.notify_one();
+	else
+		m_available.notify_all();
+
+	work(*batch);
+
+	// wait for the calls taken by the helpers
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->done.wait(lock, [&batch]() { return batch->finished.load() == batch->count; });
+}
+
+void ThreadPool::loop()
+{
+	for (;;) {
+		std::shared_ptr<Batch> batch;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_available.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+			if (m_stop)
+				return;
+			batch = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+		work(*batch);
+	}
+}
+
+void ThreadPool::work(Batch& batch)
+{
+	size_t calls = 0;
+	for (size_t i = batch.next++; i < batch.count; i = batch.next++) {
+		batch.job(i);
+		++calls;
+	}
+	// the last finished call wakes up the calling thread
+	if ((calls > 0) && (batch.finished.fetch_add(calls) + calls == batch.count)) {
+		std::lock_guard<std::mutex> lock(batch.mutex);
+		batch.done.notify_all();
+	}
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+ *
+ * MIT License
+ *
+ * Copyright (C) 2021 Fabian Hauser
+ *
+ * Author: Fabian Hauser <fabian.hauser@fh-linz.at>
+ * University of Applied Sciences Upper Austria - Linz - Austria
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ****************************************************************************/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace LookUpSTORM
+{
+
+/*
+ * class ThreadPool
+ * Persistent helper threads for the parallel parts of a frame (detection bands,
+ * canidate fitting and photon/CRLB batches). The calling thread always takes part
+ * in its own jobs, so a frame never waits for busy helpers and jobs can be started
+ * from several threads (e.g. the pipeline workers) at the same time.
+ */
+class ThreadPool
+{
+public:
+	// starts threads helper threads
+	explicit ThreadPool(size_t threads = 0);
+	~ThreadPool();
+
+	// thread-safe, restarts the pool with threads helper threads, the jobs of
+	// running calls are finished by their calling threads if no helper is left
+	void setThreads(size_t threads);
+	// thread-safe, number of helper threads
+	size_t threads() const;
+
+	// thread-safe, calls job(i) for i in [0, count) on the calling thread and up to
+	// parallelism - 1 helper threads, returns after all calls are finished
+	void run(size_t count, size_t parallelism, const std::function<void(size_t)>& job);
+
+private:
+	struct Batch;
+
+	void loop();
+	static void work(Batch& batch);
+
+	mutable std::mutex m_mutex;
+	// serializes setThreads
+	std::mutex m_resizeMutex;
+	std::condition_variable m_available;
+	std::deque<std::shared_ptr<Batch>> m_queue;
+	std::vector<std::thread> m_threads;
+	size_t m_size;
+	bool m_stop;
+
+};
+
+} // namespace LookUpSTORM
+
+#endif // !THREADPOOL_H
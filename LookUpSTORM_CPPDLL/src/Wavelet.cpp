@@ -28,92 +28,176 @@
  ****************************************************************************/
 
 #include "Wavelet.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
 
 namespace LookUpSTORM
 {
 
-// Mainly calculates level 1 and level 2 wavelets. In addition, mean and sd is calcualted of the input image.
-inline void waveletFilter(const ImageU16& input, ImageF32& padded, ImageF32& result, float &mean, float &sd)
+// B3-spline kernel [1/16, 1/4, 3/8, 1/4, 1/16] of the a trous wavelet
+static constexpr float G0 = 0.0625f;
+static constexpr float G1 = 0.25f;
+static constexpr float G2 = 0.375f;
+
+// number of level 1 rows kept for the dilated column pass of level 2
+static constexpr int ROWS = 9;
+
+// column pass: dst[x] = g0 * r0[x] + g1 * r1[x] + g2 * r2[x] + g1 * r3[x] + g0 * r4[x],
+// the rows of the input image are converted to float in the registers
+template<class T>
+static inline void columnPass(const T* const* rows, float* dst, int n)
+{
+	using SIMD::VecF;
+	const VecF g0(G0), g1(G1), g2(G2);
+	int x = 0;
+	for (; x + int(VecF::Lanes) <= n; x += int(VecF::Lanes)) {
+		const VecF outer = VecF::load(rows[0] + x) + VecF::load(rows[4] + x);
+		const VecF inner = VecF::load(rows[1] + x) + VecF::load(rows[3] + x);
+		fmadd(g0, outer, fmadd(g1, inner, g2 * VecF::load(rows[2] + x))).store(dst + x);
+	}
+	for (; x < n; ++x)
+		dst[x] = G0 * (rows[0][x] + rows[4][x]) + G1 * (rows[1][x] + rows[3][x]) + G2 * rows[2][x];
+}
+
+// row pass of the taps src[x], src[x + Step], ..., src[x + 4 * Step]
+template<int Step>
+static inline SIMD::VecF rowTaps(const float* src)
+{
+	using SIMD::VecF;
+	const VecF outer = VecF::load(src) + VecF::load(src + 4 * Step);
+	const VecF inner = VecF::load(src + Step) + VecF::load(src + 3 * Step);
+	return fmadd(VecF(G0), outer, fmadd(VecF(G1), inner, VecF(G2) * VecF::load(src + 2 * Step)));
+}
+
+template<int Step>
+static inline float rowTap(const float* src)
+{
+	return G0 * (src[0] + src[4 * Step]) + G1 * (src[Step] + src[3 * Step]) + G2 * src[2 * Step];
+}
+
+// reflected row index (without repeating the edge row)
+static inline int mirror(int y, int h)
+{
+	return (y < 0) ? -y : ((y >= h) ? 2 * (h - 1) - y : y);
+}
+
+// minimal number of rows of a band filtered by its own thread
+static constexpr int MIN_BAND_ROWS = 64;
+
+// reflects the border of B pixels of a row with w0 pixels in x
+template<int B>
+static inline void padRow(float* row, int w0)
+{
+	float* px = row + B;
+	for (int k = 1; k <= B; ++k) {
+		px[-k] = px[k];
+		px[w0 - 1 + k] = px[w0 - 1 - k];
+	}
+}
+
+// Calculates the level 2 wavelet of the a trous algorithm (level 1 minus the level 2 smoothing of level 1)
+// of the rows [y0, y1) with separable row and column passes. The input is read without padding, the
+// borders are reflected by mirroring the row indices and the few columns at the left and right edge
+// of each pass. The level 1 rows are kept with a reflected 4 pixel border in a rolling buffer of ROWS
+// rows, the 4 level 1 rows above and below the band (halo) are calculated by each band itself.
+// The buffer needs (ROWS + 1) * (width + 8) values. The input rows of the band are added to the statistics.
+static void filterRows(const ImageU16& input, ImageF32& result, int y0, int y1, float* buffer, ImageStatistics& statistics)
+{
+	const int w0 = result.width();
+	const int h0 = result.height();
+	const int w1 = w0 + 8;
+
+	// Algorithm from: Izeddin et al., "Wavelet analysis for single molecule localization microscopy", 2012
+	// V1 = g1 * I, V2 = g2 * V1 and W2 = V1 - V2 with g1 = [1/16,1/4,3/8,1/4,1/16], g2 = [1/16,0,1/4,0,3/8,0,1/4,0,1/16]
+	const int lanes = int(SIMD::VecF::Lanes);
+	float* rows = buffer;
+	float* line = buffer + ROWS * size_t(w1);
+
+	statistics.reset();
+
+	// level 1 row y into its slot of the rolling buffer
+	auto level1 = [&](int y) {
+		const uint16_t* src[5];
+		for (int k = 0; k < 5; ++k)
+			src[k] = input.scanLine(mirror(y - 2 + k, h0));
+		// the column pass of the mirrored columns is the mirrored column pass
+		columnPass(src, line + 2, w0);
+		padRow<2>(line, w0);
+
+		float* row = rows + (y % ROWS) * size_t(w1);
+		float* out = row + 4;
+		int x = 0;
+		for (; x + lanes <= w0; x += lanes)
+			rowTaps<1>(line + x).store(out + x);
+		for (; x < w0; ++x)
+			out[x] = rowTap<1>(line + x);
+		padRow<4>(row, w0);
+
+		// each input row is counted by the band that contains it
+		if ((y >= y0) && (y < y1))
+			statistics.add(src[2], size_t(w0));
+	};
+
+	// level 2 wavelet of row y from the level 1 rows y-4, y-2, ..., y+4
+	auto level2 = [&](int y) {
+		const float* src[5];
+		for (int k = 0; k < 5; ++k)
+			src[k] = rows + (mirror(y + 2 * (k - 2), h0) % ROWS) * size_t(w1);
+		columnPass(src, line, w1);
+
+		const float* v1 = rows + (y % ROWS) * size_t(w1) + 4;
+		float* out = result.scanLine(y);
+		int x = 0;
+		for (; x + lanes <= w0; x += lanes)
+			(SIMD::VecF::load(v1 + x) - rowTaps<2>(line + x)).store(out + x);
+		for (; x < w0; ++x)
+			out[x] = v1[x] - rowTap<2>(line + x);
+	};
+
+	// the level 2 row y needs the level 1 rows up to y+4
+	for (int y = std::max(0, y0 - 4); y < y1 + 4; ++y) {
+		if (y < h0)
+			level1(y);
+		if (y - 4 >= y0)
+			level2(y - 4);
+	}
+}
+
+// Mainly calculates level 1 and level 2 wavelets. In addition, the statistics of the input image are calculated
+// in the same pass. The image is split into horizontal bands which are filtered by up to 'threads' threads.
+inline void waveletFilter(const ImageU16& input, ImageF32& result, std::vector<float>& buffers,
+	std::vector<ImageStatistics>& statistics, int threads, ThreadPool* pool, ImageStats& stats)
 {
 	if ((input.width() != result.width()) || (input.height() != result.height()))
 		return;
 
 	const int w0 = input.width();
 	const int h0 = input.height();
-	const int s0 = input.stride();
-
-	const int s1 = padded.stride();
-
-	mean = 0.f;
-	sd = 0.f;
-
-	// pad the image with a 4 pixel reflected boarder
-	const uint16_t* src = input.constData();
-	float* dst = padded.scanLine(4) + 4;
-	for (int y = 0; y < h0; ++y, dst += (s1 - s0)) {
-		//std::copy_n(src, w0, dst);
-		for (int x = 0; x < w0; ++x) {
-			mean += *src;
-			*dst++ = *src++;
-		}
-	}
-	mean /= w0 * h0;
-
-	// top pad (y-axis padding)
-	src = input.scanLine(4);
-	dst = padded.data() + 4;
-	for (int y = 0; y < 4; ++y, dst += s1, src -= s0)
-		std::copy_n(src, w0, dst);
-
-	// bottom pad
-	src = input.scanLine(h0 - 2);
-	dst = padded.scanLine(h0 + 4) + 4;
-	for (int y = 0; y < 4; ++y, dst += s1, src -= s0)
-		std::copy_n(src, w0, dst);
-
-	// x-axis padding
-	for (int y = 0; y < h0; ++y) {
-		// left pad
-		int srcX = 8, dstX;
-		for (int x = 0; x < 4; ++x, --srcX)
-			padded(x, y) = padded(srcX, y);
-
-		// right pad
-		dstX = 4 + w0;
-		srcX = 2 + w0;
-		for (int x = 0; x < 4; ++x, --srcX, ++dstX)
-			padded(dstX, y) = padded(srcX, y);
-	}
+	const int bands = std::max(1, std::min(threads, h0 / MIN_BAND_ROWS));
+	const size_t bufferSize = (ROWS + 1) * size_t(w0 + 8);
+	buffers.resize(bands * bufferSize);
+	if (statistics.size() < size_t(bands))
+		statistics.resize(bands);
 
-	// Algorithm from: Izeddin et al., "Wavelet analysis for single molecule localization microscopy", 2012
-	// g1 = [1/16,1/4,3/8,1/4,1/16], g2 = [1/16,0,1/4,0,3/8,0,1/4,0,1/16]
-	dst = result.data();
-	const uint16_t* src1 = input.constData();
-	for (int y = 0; y < h0; ++y) {
-		for (int x = 0; x < w0; ++x, ++src1) {
-			float val1 = 0.f, val2 = 0.f;
-			const auto* src = padded.constData() + (y + 2) * s1 + (x + 2);
-			val1 += 0.00390625f * src[0] + 0.015625f * src[1] + 0.0234375f * src[2] + 0.015625f * src[3] + 0.00390625f * src[4]; src += s1;
-			val1 += 0.015625f * src[0] + 0.0625f * src[1] + 0.09375f * src[2] + 0.0625f * src[3] + 0.015625f * src[4]; src += s1;
-			val1 += 0.0234375f * src[0] + 0.09375f * src[1] + 0.140625f * src[2] + 0.09375f * src[3] + 0.0234375f * src[4]; src += s1;
-			val1 += 0.015625f * src[0] + 0.0625f * src[1] + 0.09375f * src[2] + 0.0625f * src[3] + 0.015625f * src[4]; src += s1;
-			val1 += 0.00390625f * src[0] + 0.015625f * src[1] + 0.0234375f * src[2] + 0.015625f * src[3] + 0.00390625f * src[4];
-
-			src = padded.constData() + y * s1 + x;
-			val2 += 0.00390625f * src[0] + 0.015625f * src[2] + 0.0234375f * src[4] + 0.015625f * src[6] + 0.00390625f * src[8]; src += 2 * s1;
-			val2 += 0.015625f * src[0] + 0.0625f * src[2] + 0.09375f * src[4] + 0.0625f * src[6] + 0.015625f * src[8]; src += 2 * s1;
-			val2 += 0.0234375f * src[0] + 0.09375f * src[2] + 0.140625f * src[4] + 0.09375f * src[6] + 0.0234375f * src[8]; src += 2 * s1;
-			val2 += 0.015625f * src[0] + 0.0625f * src[2] + 0.09375f * src[4] + 0.0625f * src[6] + 0.015625f * src[8]; src += 2 * s1;
-			val2 += 0.00390625f * src[0] + 0.015625f * src[2] + 0.0234375f * src[4] + 0.015625f * src[6] + 0.00390625f * src[8];
-
-			*dst++ = val1 - val2;
-
-			sd += (*src1 - mean) * (*src1 - mean);
-		}
+	auto job = [&](int band) {
+		filterRows(input, result, int(int64_t(h0) * band / bands), int(int64_t(h0) * (band + 1) / bands), 
+			buffers.data() + band * bufferSize, statistics[band]);
+	};
+
+	// the calling thread takes part in the bands
+	if ((bands > 1) && pool) {
+		pool->run(size_t(bands), size_t(bands), [&job](size_t band) { job(int(band)); });
+	}
+	else {
+		for (int band = 0; band < bands; ++band)
+			job(band);
 	}
 
-	// divide sd by w0*h0 because the samples are from the complete population of the frame
-	sd /= (w0 * h0);
+	for (int band = 1; band < bands; ++band)
+		statistics[0].merge(statistics[band]);
+	stats = statistics[0].stats();
 }
 
 }
@@ -121,14 +205,15 @@ inline void waveletFilter(const ImageU16& input, ImageF32& padded, ImageF32& res
 using namespace LookUpSTORM;
 
 Wavelet::Wavelet()
-	: m_mean(0.f), m_sd(0.f)
+	: m_threads(1)
+	, m_ownPool(false)
 {
 }
 
 Wavelet::Wavelet(int width, int height)
-	: m_padded(width + 8, height + 8)
-	, m_result(width, height)
-	, m_mean(0.f), m_sd(0.f)
+	: m_result(width, height)
+	, m_threads(1)
+	, m_ownPool(false)
 {
 }
 
@@ -137,36 +222,68 @@ void Wavelet::setSize(int width, int height)
 	if ((width == m_result.width()) && (height  == m_result.height()))
 		return;
 	// allocate new buffers
-	m_padded = ImageF32(width + 8, height + 8);
 	m_result = ImageF32(width, height);
 }
 
 const ImageF32& Wavelet::filter(const ImageU16& input)
 {
-	waveletFilter(input, m_padded, m_result, m_mean, m_sd);
+	if ((m_threads > 1) && !m_pool) {
+		m_pool = std::make_shared<ThreadPool>(size_t(m_threads - 1));
+		m_ownPool = true;
+	}
+	waveletFilter(input, m_result, m_buffers, m_statistics, m_threads, m_pool.get(), m_stats);
 	return m_result;
 }
 
+void Wavelet::setThreads(int threads)
+{
+	m_threads = std::max(1, threads);
+	if (m_ownPool && (m_pool->threads() != size_t(m_threads - 1)))
+		m_pool->setThreads(size_t(m_threads - 1));
+}
+
+void Wavelet::setThreadPool(std::shared_ptr<ThreadPool> pool)
+{
+	m_pool = std::move(pool);
+	m_ownPool = false;
+}
+
+int Wavelet::threads() const
+{
+	return m_threads;
+}
+
 const float Wavelet::inputMean() const
 {
-	return m_mean;
+	return float(m_stats.mean);
 }
 
 const float Wavelet::inputSD() const
 {
-	return m_sd;
+	return float(m_stats.sd * m_stats.sd);
 }
 
 const float Wavelet::inputSTD() const
 {
-	return std::sqrt(m_sd);
+	return float(m_stats.sd);
+}
+
+const float Wavelet::inputNoise() const
+{
+	return float(m_stats.noise);
+}
+
+const ImageStats& Wavelet::inputStats() const
+{
+	return m_stats;
 }
 
 ImageF32 LookUpSTORM::waveletFilter(const ImageU16& input)
 {
-	float mean, sd;
-	ImageF32 padded(input.width() + 8, input.height() + 8);
+	ImageStats stats;
 	ImageF32 ret(input.width(), input.height());
-	waveletFilter(input, padded, ret, mean, sd);
+	std::vector<float> buffers;
+	std::vector<ImageStatistics> statistics;
+	waveletFilter(input, ret, buffers, statistics, 1, nullptr, stats);
 	return ret;
 }
@@ -29,16 +29,22 @@
 
 package at.fhlinz.imagej;
 
-import ij.IJ;
 import java.io.*;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.util.zip.CRC32;
 
 /**
  * LUT implementation that loads a binary file containing the PSF at discrete 3D
  * positions including their derivatives. Can also be loaded using the CPP 
  * library (much faster!).
  * 
+ * Version 1, followed by the interleaved double templates:
  * struct HeaderLUT {
  *    char id[8];
  *    uint64 dataSize;
@@ -50,9 +56,39 @@ import java.nio.ByteOrder;
  *    float64 rangeAx;
  * }
  * 
+ * Version 2 (128 bytes), the templates start at payloadOffset and are followed
+ * by the CRC-32 of each chunk of the payload (uint32 each):
+ * struct HeaderLUTv2 {
+ *    char id[8];
+ *    uint32 version;
+ *    uint32 headerSize;
+ *    uint64 payloadOffset;
+ *    uint64 payloadSize;
+ *    uint64 chunkSize;
+ *    uint64 templates;
+ *    uint64 windowSize;
+ *    float64 dLat;
+ *    float64 dAx;
+ *    float64 rangeLat;
+ *    float64 rangeAx;
+ *    uint32 precision;    // 0: float64, 1: float32
+ *    uint32 layout;       // 0: interleaved, 1: planar
+ *    uint32 compression;  // 0: none, 1: symmetry
+ *    uint8 reserved[24];
+ *    uint32 headerCrc;
+ * }
+ * The templates are always converted to uncompressed interleaved doubles.
+ * 
  * @author Fabian Hauser
  */
 public class BinaryLUT implements LUT {
+    // the payload is mapped in windows, a single mapping is limited to 2 GiB
+    private static final long MAP_WINDOW = 1L << 30;
+    // largest array length supported by the JVMs
+    private static final long MAX_ARRAY_LENGTH = Integer.MAX_VALUE - 8;
+    // floats converted at once when reading single precision payloads
+    private static final int FLOAT_BLOCK = 1 << 16;
+    
     private double _dLat;
     private double _dAx;
     private double _minLat;
@@ -63,39 +99,45 @@ public class BinaryLUT implements LUT {
     private int _countIndices;
     private String _fileName;
     private double[] _templates;
+    private int _version;
+    private long _payloadOffset;
+    private long _payloadSize;
+    private long _chunkSize;
+    private int _precision;
+    private int _layout;
+    private int _compression;
     
     public BinaryLUT() {
         
     }
     
-    private double readDouble64(FileInputStream in) throws IOException {
-        byte[] bytes = new byte[] {
-            (byte)(in.read() & 0xff), (byte)(in.read() & 0xff),
-            (byte)(in.read() & 0xff), (byte)(in.read() & 0xff),
-            (byte)(in.read() & 0xff), (byte)(in.read() & 0xff),
-            (byte)(in.read() & 0xff), (byte)(in.read() & 0xff)
-        };
-        return ByteBuffer.wrap(bytes).order(ByteOrder.LITTLE_ENDIAN).getDouble();
-    }
-    
     public boolean load(String fileName) {
         if (!loadHeader(fileName))
             return false;
         
-        try {
-            File file = new File(fileName);
-            FileInputStream in = new FileInputStream(file);
-            final long fileSize = file.length();
-            final int size = (int)((fileSize - 64) / 8);
-            _templates = new double[size];
-
-            for (int i = 0; i < size; i++) {
-                _templates[i] = readDouble64(in);
-                IJ.showProgress(i, size);
+        final long values = _payloadSize / ((_precision == 1) ? 4 : 8);
+        if (values > MAX_ARRAY_LENGTH) {
+            System.err.println("BinaryLUT: The LUT has " + values + " values, but Java arrays are limited to " 
+                    + MAX_ARRAY_LENGTH + "! Load the file with LookUpSTORM.setLookUpTable(String) instead.");
+            return false;
+        }
+        
+        // map the templates behind the header instead of reading them byte by byte
+        try (FileChannel channel = FileChannel.open(Paths.get(fileName), StandardOpenOption.READ)) {
+            if ((_version >= 2) && !verify(channel))
+                return false;
+            
+            double[] templates = new double[(int)values];
+            readTemplates(channel, templates);
+            
+            if ((_layout == 0) && (_compression == 0)) {
+                _templates = templates;
+                return true;
             }
-            return true;
-        } catch (FileNotFoundException ex) {
+            _templates = expand(templates);
+            return _templates != null;
         } catch (IOException ex) {
+            System.err.println("BinaryLUT: " + ex.getMessage());
         }
         return false;
     }
@@ -106,8 +148,17 @@ public class BinaryLUT implements LUT {
             FileInputStream in = new FileInputStream(file);
             final long fileSize = file.length();
             
-            byte[] hdr = new byte[64];
-            if (in.read(hdr) != 64) {
+            // version 1 files have a 64 byte header
+            byte[] hdr = new byte[128];
+            int read = 0;
+            while (read < hdr.length) {
+                final int n = in.read(hdr, read, hdr.length - read);
+                if (n < 0)
+                    break;
+                read += n;
+            }
+            in.close();
+            if (read < 64) {
                 System.err.println("BinaryLUT: Could not read header!");
                 return false;
             }
@@ -120,13 +171,47 @@ public class BinaryLUT implements LUT {
             
             ByteBuffer buf = ByteBuffer.wrap(hdr).order(ByteOrder.LITTLE_ENDIAN);
             
-            final long dataSize = buf.getLong(8);
-            _countIndices = (int)buf.getLong(16);
-            _winSize = (int)buf.getLong(24);
-            _dLat = buf.getDouble(32);
-            _dAx = buf.getDouble(40);
-            final double rangeLat = buf.getDouble(48);
-            final double rangeAx = buf.getDouble(56);
+            // the data size of version 1 is a multiple of 8 at the offset of the version
+            double rangeLat, rangeAx;
+            if (buf.getInt(8) == 2) {
+                CRC32 crc = new CRC32();
+                crc.update(hdr, 0, 124);
+                if ((read < 128) || (buf.getInt(12) != 128) || (crc.getValue() != (buf.getInt(124) & 0xFFFFFFFFL))) {
+                    System.err.println("BinaryLUT: Header of version 2 is not valid!");
+                    return false;
+                }
+                _version = 2;
+                _payloadOffset = buf.getLong(16);
+                _payloadSize = buf.getLong(24);
+                _chunkSize = buf.getLong(32);
+                _countIndices = (int)buf.getLong(40);
+                _winSize = (int)buf.getLong(48);
+                _dLat = buf.getDouble(56);
+                _dAx = buf.getDouble(64);
+                rangeLat = buf.getDouble(72);
+                rangeAx = buf.getDouble(80);
+                _precision = buf.getInt(88);
+                _layout = buf.getInt(92);
+                _compression = buf.getInt(96);
+                if (((_precision | _layout | _compression) & ~1) != 0 || (_chunkSize <= 0)) {
+                    System.err.println("BinaryLUT: Format of version 2 is not supported!");
+                    return false;
+                }
+            } else {
+                _version = 1;
+                _payloadOffset = 64;
+                _payloadSize = buf.getLong(8);
+                _chunkSize = 0;
+                _countIndices = (int)buf.getLong(16);
+                _winSize = (int)buf.getLong(24);
+                _dLat = buf.getDouble(32);
+                _dAx = buf.getDouble(40);
+                rangeLat = buf.getDouble(48);
+                rangeAx = buf.getDouble(56);
+                _precision = 0;
+                _layout = 0;
+                _compression = 0;
+            }
             
             final double borderLat = Math.floor((_winSize - rangeLat) / 2);
             if (borderLat < 1.0)
@@ -138,7 +223,8 @@ public class BinaryLUT implements LUT {
             _minAx = -0.5 * rangeAx;
             _maxAx = 0.5 * rangeAx;
             
-            if (dataSize != (fileSize - 64)) {
+            final long crcSize = (_version >= 2) ? 4 * numberOfChunks() : 0;
+            if (_payloadOffset + _payloadSize + crcSize != fileSize) {
                 System.err.println("BinaryLUT: FileSize invalid!");
                 return false;
             }
@@ -151,6 +237,143 @@ public class BinaryLUT implements LUT {
         return false;
     }
     
+    /**
+     * Copies the payload in mapped windows of at most MAP_WINDOW bytes, 
+     * single precision values are converted block wise
+     */
+    private void readTemplates(FileChannel channel, double[] templates) throws IOException {
+        float[] floats = (_precision == 1) ? new float[FLOAT_BLOCK] : null;
+        int index = 0;
+        for (long offset = 0; offset < _payloadSize; offset += MAP_WINDOW) {
+            final long size = Math.min(MAP_WINDOW, _payloadSize - offset);
+            MappedByteBuffer buf = channel.map(FileChannel.MapMode.READ_ONLY, _payloadOffset + offset, size);
+            buf.order(ByteOrder.LITTLE_ENDIAN);
+            if (floats == null) {
+                final int count = (int)(size / 8);
+                buf.asDoubleBuffer().get(templates, index, count);
+                index += count;
+                continue;
+            }
+            FloatBuffer src = buf.asFloatBuffer();
+            while (src.hasRemaining()) {
+                final int count = Math.min(FLOAT_BLOCK, src.remaining());
+                src.get(floats, 0, count);
+                for (int i = 0; i < count; ++i)
+                    templates[index++] = floats[i];
+            }
+        }
+    }
+    
+    private long numberOfChunks() {
+        return (_payloadSize + _chunkSize - 1) / _chunkSize;
+    }
+    
+    /**
+     * Checks the CRC-32 of each chunk of the payload (version 2)
+     */
+    private boolean verify(FileChannel channel) throws IOException {
+        final int chunks = (int)numberOfChunks();
+        ByteBuffer crcs = channel.map(FileChannel.MapMode.READ_ONLY, _payloadOffset + _payloadSize, 4L * chunks);
+        crcs.order(ByteOrder.LITTLE_ENDIAN);
+        
+        // chunks may span two windows, the CRC is updated with the slice of each
+        CRC32 crc = new CRC32();
+        int chunk = 0;
+        long chunkEnd = Math.min(_chunkSize, _payloadSize);
+        for (long offset = 0; offset < _payloadSize; offset += MAP_WINDOW) {
+            final long size = Math.min(MAP_WINDOW, _payloadSize - offset);
+            MappedByteBuffer buf = channel.map(FileChannel.MapMode.READ_ONLY, _payloadOffset + offset, size);
+            while (buf.hasRemaining()) {
+                final long pos = offset + buf.position();
+                buf.limit(buf.position() + (int)Math.min(buf.remaining(), chunkEnd - pos));
+                crc.update(buf);
+                buf.limit((int)size);
+                if (offset + buf.position() < chunkEnd)
+                    continue;
+                if (crc.getValue() != (crcs.getInt(4 * chunk) & 0xFFFFFFFFL)) {
+                    System.err.println("BinaryLUT: CRC of chunk " + chunk + " is not correct!");
+                    return false;
+                }
+                crc.reset();
+                ++chunk;
+                chunkEnd = Math.min(chunkEnd + _chunkSize, _payloadSize);
+            }
+        }
+        return true;
+    }
+    
+    /**
+     * Converts planar or symmetry compressed templates into uncompressed 
+     * interleaved ones. A mirrored template is the stored one flipped at the 
+     * window center with the sign of the derivative changed.
+     */
+    private double[] expand(double[] stored) {
+        final int n = _winSize * _winSize;
+        final int stride = 4 * n;
+        final int step = (_layout == 1) ? 1 : 4;
+        final int plane = (_layout == 1) ? n : 1;
+        final int countLat = (int)Math.floor((_maxLat - _minLat) / _dLat + 1);
+        final int countAx = (int)Math.floor((_maxAx - _minAx) / _dAx + 1);
+        
+        // stored lateral position of each grid index (same for x and y)
+        int[] slot = new int[countLat];
+        boolean[] mirrored = new boolean[countLat];
+        int slots = countLat;
+        if (_compression == 1) {
+            final double mirror = ((_winSize - 1.0) - 2.0 * _minLat) / _dLat;
+            final long m = Math.round(mirror);
+            if (Math.abs(mirror - m) > 1E-6) {
+                System.err.println("BinaryLUT: Mirrored positions are not on the grid!");
+                return null;
+            }
+            slots = 0;
+            for (int i = 0; i < countLat; ++i) {
+                final long partner = m - i;
+                if ((partner >= 0) && (partner < i)) {
+                    slot[i] = slot[(int)partner];
+                    mirrored[i] = true;
+                } else {
+                    slot[i] = slots++;
+                }
+            }
+        } else {
+            for (int i = 0; i < countLat; ++i)
+                slot[i] = i;
+        }
+        if ((long)slots * slots * countAx * stride != stored.length) {
+            System.err.println("BinaryLUT: Number of templates is invalid!");
+            return null;
+        }
+        
+        if ((long)countLat * countLat * countAx * stride > MAX_ARRAY_LENGTH) {
+            System.err.println("BinaryLUT: The expanded LUT exceeds the Java array limit!");
+            return null;
+        }
+        final int count = countLat * countLat * countAx;
+        double[] templates = new double[count * stride];
+        for (int i = 0; i < count; ++i) {
+            final int zi = i % countAx;
+            final int yi = (i / countAx) % countLat;
+            final int xi = i / (countAx * countLat);
+            final int src = (zi + slot[yi] * countAx + slot[xi] * countAx * slots) * stride;
+            final boolean mx = mirrored[xi];
+            final boolean my = mirrored[yi];
+            for (int py = 0; py < _winSize; ++py) {
+                final int sy = my ? _winSize - 1 - py : py;
+                for (int px = 0; px < _winSize; ++px) {
+                    final int sx = mx ? _winSize - 1 - px : px;
+                    final int s = src + (sy * _winSize + sx) * step;
+                    final int d = i * stride + 4 * (py * _winSize + px);
+                    templates[d] = stored[s];
+                    templates[d + 1] = mx ? -stored[s + plane] : stored[s + plane];
+                    templates[d + 2] = my ? -stored[s + 2 * plane] : stored[s + 2 * plane];
+                    templates[d + 3] = stored[s + 3 * plane];
+                }
+            }
+        }
+        return templates;
+    }
+    
     /** 
      * Get the fileName from the header check
      * @return file name
@@ -582,6 +582,9 @@ public class DialogLookUpSTORM extends JFrame {
         _lookUpSTORM.setThreshold(threshold);
         _lookUpSTORM.setEpsilon(eps);
         _lookUpSTORM.setMaxIter(maxIter);
+        // the frames are processed one after another, so all cores work on a frame
+        _lookUpSTORM.setFittingThreads(0);
+        _lookUpSTORM.setDetectionThreads(0);
         
         final int rw = w * scale;
         final int rh = h * scale;
@@ -29,8 +29,6 @@
 
 package at.fhlinz.imagej;
 
-import java.io.FileNotFoundException;
-import java.io.PrintWriter;
 import static java.lang.Thread.sleep;
 
 public class LookUpSTORM {
@@ -72,11 +70,23 @@ public class LookUpSTORM {
      *    float64 rangeAx;
      * }
      * 
+     * Files of version 2 (see BinaryLUT) are mapped in their stored format 
+     * after checking the CRC of the header. The templates are not read up 
+     * front, use verifyLookUpTable to check the CRC of each chunk.
+     * 
      * @param fileName file name including the path to the LUT binary file.
      * @return returns true if the LUT file could be loaded
      */
     public native boolean setLookUpTable(String fileName);
     
+    /**
+     * Checks the CRC of the header and of each chunk of a version 2 LUT file
+     * (see BinaryLUT) without loading it. Reads the whole file once.
+     * @param fileName file name including the path to the LUT binary file.
+     * @return returns true if the LUT file is intact
+     */
+    public native boolean verifyLookUpTable(String fileName);
+    
     /** 
      * Releases the memory used for the internal LUT
      * @return returns true if the LUT memory could be released
@@ -137,6 +147,100 @@ public class LookUpSTORM {
      */
     public native int numberOfAllLocs();
     
+    /**
+     * Number of values per localization of copyAllLocs 
+     * [bg,peak,x,y,z,frame,xfit,yfit,time]
+     */
+    public static final int LOC_VALUES = 9;
+    
+    /** 
+     * Copies the localizations into a flat array without creating an object
+     * per localization. The localizations since the last call are retrieved 
+     * by passing the number of already copied localizations as first.
+     * @param first index of the first localization
+     * @param data receives up to data.length / LOC_VALUES localizations
+     * @param columnMajor if true the values are stored per column 
+     * data[value * count + i], otherwise per localization 
+     * data[i * LOC_VALUES + value] with count the returned number
+     * @return Number of copied localizations
+     * @see LookUpSTORM#LOC_VALUES
+     */
+    public native int copyAllLocs(int first, double data[], boolean columnMajor);
+    
+    /** 
+     * Same as copyAllLocs for a direct buffer, the values are stored as 
+     * doubles in native byte order (ByteOrder.nativeOrder()).
+     * @param first index of the first localization
+     * @param data receives up to capacity / (8 * LOC_VALUES) localizations
+     * @param columnMajor layout of the values (see copyAllLocs)
+     * @return Number of copied localizations
+     */
+    public native int copyAllLocsDirect(int first, java.nio.ByteBuffer data, boolean columnMajor);
+    
+    /** 
+     * Get the cursor behind the last localization. Each localization gets an
+     * increasing sequence number, which is not reseted by reset(). (Thread-Safe)
+     * @return Sequence number of the next localization
+     * @see LookUpSTORM#getLocsSince(long[], double[], boolean) 
+     */
+    public native long getLocCursor();
+    
+    /** 
+     * Copies the localizations added since the cursor (e.g. for a live table 
+     * during the acquisition) and advances the cursor. Localizations removed 
+     * by reset() are skipped. Start with a cursor of 0. (Thread-Safe)
+     * @param cursor cursor[0] is the sequence number of the first localization
+     * and receives the cursor for the next call
+     * @param data receives up to data.length / LOC_VALUES localizations in the
+     * layout of copyAllLocs
+     * @param columnMajor layout of the values (see copyAllLocs)
+     * @return Number of copied localizations
+     */
+    public native int getLocsSince(long cursor[], double data[], boolean columnMajor);
+    
+    /** Binary file of columnar blocks (frame as int, the other values as float) */
+    public static final int LOC_FORMAT_BINARY = 0;
+    /** Binary file with run-length encoded blocks */
+    public static final int LOC_FORMAT_BINARY_COMPRESSED = 1;
+    /** CSV file with the header of saveMolsCSV */
+    public static final int LOC_FORMAT_CSV = 2;
+    
+    /** 
+     * Writes all localizations since the last reset natively into a file 
+     * with the position and CRLB in nm and the intensity and background 
+     * in photons.
+     * @param fileName Output file name
+     * @param format LOC_FORMAT_BINARY, LOC_FORMAT_BINARY_COMPRESSED or LOC_FORMAT_CSV
+     * @param pixelSize Pixels size of the input image in nm
+     * @param adu ADU (EM CCD Camera ADC count to photons)
+     * @param gain EM-Gain (1 if deactivated)
+     * @param baseline Baseline of camera in ADC values
+     * @return True if the file is written
+     */
+    public native boolean saveLocs(String fileName, int format, double pixelSize, double adu, double gain, double baseline);
+    
+    /** 
+     * Reads a binary localization file of saveLocs or startRecording back 
+     * and checks the CRC of each column.
+     * @param fileName Binary localization file
+     * @return True if the file is complete and not corrupt
+     */
+    public native boolean verifyLocs(String fileName);
+    
+    /** 
+     * Streams the localizations of all following frames into a file while 
+     * they are fitted (same parameters as saveLocs). (Thread-Safe)
+     * @return True if the file is opened
+     * @see LookUpSTORM#saveLocs(String, int, double, double, double, double) 
+     */
+    public native boolean startRecording(String fileName, int format, double pixelSize, double adu, double gain, double baseline);
+    
+    /** 
+     * Closes the file of startRecording. (Thread-Safe)
+     * @return True if the file is written completely
+     */
+    public native boolean stopRecording();
+    
     /** 
      * Set the input image parameters
      * @param imageWidth width of image in pixels
@@ -250,6 +354,80 @@ public class LookUpSTORM {
      */
     public native Molecule[] getFittedMolecules(double pixelSize, double adu, double gain, double baseline);
     
+    /**
+     * Starts the streaming mode for live acquisition. The frames pushed by
+     * pushFrame are queued in preallocated native buffers and fitted by 
+     * background worker threads. The LUT and the image parameters have to be
+     * set before.
+     * @param workers number of worker threads (0 uses all cores)
+     * @param queueSize number of queued frames including the frames whose 
+     *        results are not polled yet (0 uses 4 per worker)
+     * @return True if the workers are started
+     * @see LookUpSTORM#setImagePara(int, int) 
+     */
+    public native boolean startStreaming(int workers, int queueSize);
+    
+    /**
+     * Stops the worker threads, queued frames and results are discarded
+     */
+    public native void stopStreaming();
+    
+    /**
+     * Copies the frame into the queue of the streaming mode without blocking 
+     * the garbage collector. Never waits, the frame is dropped if the queue is
+     * full (see getStreamingStats).
+     * @param data image of width * height pixels
+     * @param width image width
+     * @param height image height
+     * @param frame frame number
+     * @return False if the frame was dropped
+     */
+    public native boolean pushFrame(short data[], int width, int height, int frame);
+    
+    /**
+     * Same as pushFrame for a direct buffer of native ordered 16 bit pixels
+     * (e.g. the buffer of a camera driver)
+     * @param data direct buffer of at least width * height * 2 bytes
+     * @param width image width
+     * @param height image height
+     * @param frame frame number
+     * @return False if the frame was dropped
+     */
+    public native boolean pushFrameDirect(java.nio.ByteBuffer data, int width, int height, int frame);
+    
+    /**
+     * Adds the localizations of the fitted frames in frame order to the 
+     * localizations and the render image.
+     * @param wait waits until the next pushed frame is fitted
+     * @param renderImage
+     * @param renderWidth
+     * @param renderHeight
+     * @return number of retrieved frames
+     */
+    public native int pollFrames(boolean wait, int renderImage[], int renderWidth, int renderHeight);
+    
+    /**
+     * Back-pressure statistics of the streaming mode since start
+     * @return [submitted, dropped, processed, capacity, occupancy, 
+     * maxOccupancy, waitMicroseconds]
+     */
+    public native long[] getStreamingStats();
+    
+    /**
+     * Sets the number of threads that fit the candidates of a single frame in
+     * parallel (default is 1). The threads are shared with the workers of the
+     * streaming mode and never exceed the number of cores.
+     * @param threads number of threads (0 uses all cores)
+     */
+    public native void setFittingThreads(int threads);
+    
+    /**
+     * Sets the number of threads that search a single frame for candidates
+     * in parallel (default is 1), the found candidates do not change.
+     * @param threads number of threads (0 uses all cores)
+     */
+    public native void setDetectionThreads(int threads);
+    
     /**
      * Calculate the bytes needed for the LUT template array with the supplied
      * parameters.
@@ -291,41 +469,6 @@ public class LookUpSTORM {
      * @see LookUpSTORM#getAllLocs() 
      */
     public boolean saveMolsCSV(String fileName, double pixelSize, double adu, double gain, double baseline) {
-        Molecule[] mols = getFittedMolecules(pixelSize, adu, gain, baseline);
-        try {
-            PrintWriter stream = new PrintWriter(fileName);
-            stream.write("index,frame,x_nm,y_nm,z_nm,intensity,background,crlb_x,crlb_y,crlb_z\n");
-            int idx = 1;
-            for (Molecule m:mols) {
-                // [bg,peak,x,y,z,frame,xfit,yfit,time]
-                StringBuilder builder = new StringBuilder();
-                builder.append(idx++);
-                builder.append(',');
-                builder.append(m.frame + 1);
-                builder.append(',');
-                builder.append(m.x);
-                builder.append(',');
-                builder.append(m.y);
-                builder.append(',');
-                builder.append(m.z);
-                builder.append(',');
-                builder.append(m.intensity);
-                builder.append(',');
-                builder.append(m.background);
-                builder.append(',');
-                builder.append(m.crlb_x);
-                builder.append(',');
-                builder.append(m.crlb_y);
-                builder.append(',');
-                builder.append(m.crlb_z);
-                builder.append('\n');
-                stream.write(builder.toString());
-            }
-            stream.close();
-            return true;
-        } catch (FileNotFoundException ex) {
-            System.out.println("LookUpSTORM: Could not save file " + fileName);
-            return false;
-        }
+        return saveLocs(fileName, LOC_FORMAT_CSV, pixelSize, adu, gain, baseline);
     }
 }